@@ -7,11 +7,14 @@
 #include "partition.cpp"
 #include "select.cpp"
 #include "tpch.cpp"
+#include "lazyTransformation.cpp"
+#include "randomTransformation.cpp"
 #include "utilities.cpp"
 #include <benchmark/benchmark.h>
 #include <iostream>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace boss::utilities;
@@ -33,6 +36,7 @@ int VELOX_MINIMUM_OUTPUT_BATCH_SIZE = 0;
 
 std::vector<std::string> librariesToTest = {};
 std::string storageLibrary = {};
+std::string lazyTransformationLibrary = {};
 int latestDataSize = -1;
 int latestBlockSize = -1;
 std::string latestDataSet;
@@ -51,12 +55,39 @@ static void releaseBOSSEngines() {
 
 void initAndRunBenchmarks(int argc, char** argv) {
   std::set<int> tpchQueriesToBenchmark;
+  std::set<int> etlQueriesToBenchmark;
+  std::set<int> etlTransformationsToBenchmark;
+  std::set<int> etlVariantsToBenchmark;
+  std::string etlMatrixOutput = "etl_matrix.json";
+  bool benchmarkLazyTransformationRewrite = false;
+  bool benchmarkLazyTransformationClients = false;
+  bool benchmarkRandomTransformations = false;
+  int randomTransformationSeeds = 4;
+  unsigned int firstRandomTransformationSeed = 1;
 
   for(int i = 0; i < argc; ++i) {
     if(std::string("--library") == argv[i]) {
       if(++i < argc) {
         librariesToTest.emplace_back(argv[i]);
       }
+    } else if(std::string("--lazy-transformation-library") == argv[i]) {
+      if(++i < argc) {
+        lazyTransformationLibrary = argv[i];
+      }
+    } else if(std::string("--lazy-transformation-rewrite") == argv[i]) {
+      benchmarkLazyTransformationRewrite = true;
+    } else if(std::string("--lazy-transformation-clients") == argv[i]) {
+      benchmarkLazyTransformationClients = true;
+    } else if(std::string("--random-transformations") == argv[i]) {
+      benchmarkRandomTransformations = true;
+    } else if(std::string("--random-transformation-seeds") == argv[i]) {
+      if(++i < argc) {
+        randomTransformationSeeds = atoi(argv[i]);
+      }
+    } else if(std::string("--random-transformation-first-seed") == argv[i]) {
+      if(++i < argc) {
+        firstRandomTransformationSeed = static_cast<unsigned int>(atoi(argv[i]));
+      }
     } else if(std::string("--benchmark-min-warmup-iterations") == argv[i]) {
       if(++i < argc) {
         BENCHMARK_MIN_WARMPUP_ITERATIONS = atoi(argv[i]);
@@ -98,13 +129,23 @@ void initAndRunBenchmarks(int argc, char** argv) {
         VELOX_MINIMUM_OUTPUT_BATCH_SIZE = atoi(argv[i]);
       }
     } else if(std::string("--etl") == argv[i]) {
-      tpchQueriesToBenchmark.insert({LINE_VIEW_03, LINE_VIEW_04, BUTTERFLY_1_VIEW_12, BUTTERFLY_1_VIEW_13});
+      etlQueriesToBenchmark.insert({LINE_VIEW_03, LINE_VIEW_04, BUTTERFLY_1_VIEW_12, BUTTERFLY_1_VIEW_13});
     } else if(std::string("--etl-line") == argv[i]) {
-      tpchQueriesToBenchmark.insert({LINE_VIEW_03, LINE_VIEW_04});
-    } else if(std::string("--etl-butterfly") == argv[i]) {;
-      tpchQueriesToBenchmark.insert({BUTTERFLY_1_VIEW_12, BUTTERFLY_1_VIEW_13});
-    } else if(std::string("--etl-transformation") == argv[i]) {;
-      tpchQueriesToBenchmark.insert({LINE, BUTTERFLY});
+      etlQueriesToBenchmark.insert({LINE_VIEW_03, LINE_VIEW_04});
+    } else if(std::string("--etl-butterfly") == argv[i]) {
+      etlQueriesToBenchmark.insert({BUTTERFLY_1_VIEW_12, BUTTERFLY_1_VIEW_13});
+    } else if(std::string("--etl-baseline") == argv[i]) {
+      etlVariantsToBenchmark.insert(ETL_BASELINE);
+    } else if(std::string("--etl-eager") == argv[i]) {
+      etlVariantsToBenchmark.insert(ETL_EAGER);
+    } else if(std::string("--etl-lazy") == argv[i]) {
+      etlVariantsToBenchmark.insert(ETL_LAZY);
+    } else if(std::string("--etl-matrix-out") == argv[i]) {
+      if(++i < argc) {
+        etlMatrixOutput = argv[i];
+      }
+    } else if(std::string("--etl-transformation") == argv[i]) {
+      etlTransformationsToBenchmark.insert({LINE, BUTTERFLY});
     } else if(std::string("--tpch") == argv[i]) {
       tpchQueriesToBenchmark.insert({TPCH_Q1, TPCH_Q3, TPCH_Q6, TPCH_Q9, TPCH_Q18});
     } else if(std::string("--tpch-q1") == argv[i]) {
@@ -339,22 +380,6 @@ void initAndRunBenchmarks(int argc, char** argv) {
     }
   }
 
-  // std::ostringstream testName1;
-  // // auto const& queryName = etlQueriesNoTransformNames()[DATASETS::TPCH + query + dataSize + percentage];
-  // auto const& queryName1 = etlQueriesTransformNames()[DATASETS::TPCH + 5];
-  // testName1 << queryName1 << "/";
-  // benchmark::RegisterBenchmark(testName1.str(), TPCH_Benchmark, DATASETS::TPCH + 5,
-  //                             0, 0)
-  //     ->MeasureProcessCPUTime()
-  //     ->UseRealTime();
-  // std::ostringstream testName2;
-  // // auto const& queryName = etlQueriesNoTransformNames()[DATASETS::TPCH + query + dataSize + percentage];
-  // auto const& queryName2 = etlQueriesTransformNames()[DATASETS::TPCH + 6];
-  // testName2 << queryName2 << "/";
-  // benchmark::RegisterBenchmark(testName2.str(), TPCH_Benchmark, DATASETS::TPCH + 6,
-  //                             0, 0)
-  //     ->MeasureProcessCPUTime()
-  //     ->UseRealTime();
   /* register TPC-H benchmarks */
   for(int dataSize : std::vector<int>{1, 10, 100, 1000, 10000, 20000}) {
     for(int64_t blockSize :
@@ -363,23 +388,101 @@ void initAndRunBenchmarks(int argc, char** argv) {
                                     std::numeric_limits<int32_t>::max()}
              : std::vector<int64_t>{DEFAULT_STORAGE_BLOCK_SIZE})) {
       for(int query : tpchQueriesToBenchmark) {
-        // for (int percentage : {20, 40, 60, 80, 100}) {
-        // for (int percentage : {20}) {
+        std::ostringstream testName;
+        auto const& queryName = tpchQueryNames()[DATASETS::TPCH + query];
+        testName << queryName << "/";
+        testName << dataSize << "MB";
+        if(BENCHMARK_STORAGE_BLOCK_SIZE) {
+          testName << "/bs:";
+          testName << (blockSize >> 20) << "MB";
+        }
+        benchmark::RegisterBenchmark(testName.str(), TPCH_Benchmark, DATASETS::TPCH + query,
+                                     dataSize, blockSize)
+            ->MeasureProcessCPUTime()
+            ->UseRealTime();
+      }
+    }
+  }
+
+  /* register eager ETL transformation benchmarks */
+  for(int dataSize : std::vector<int>{1, 10, 100, 1000, 10000, 20000}) {
+    for(int transformation : etlTransformationsToBenchmark) {
+      std::ostringstream testName;
+      testName << etlTransformationNames()[DATASETS::TPCH + transformation] << "/";
+      testName << dataSize << "MB";
+      benchmark::RegisterBenchmark(testName.str(), ETL_Transformation_Benchmark,
+                                   DATASETS::TPCH + transformation, dataSize,
+                                   DEFAULT_STORAGE_BLOCK_SIZE)
+          ->MeasureProcessCPUTime()
+          ->UseRealTime();
+    }
+  }
+
+  /* register the ETL matrix: every view query at every data size and percentage, in every variant */
+  if(etlVariantsToBenchmark.empty()) {
+    etlVariantsToBenchmark.insert({ETL_BASELINE, ETL_EAGER, ETL_LAZY});
+  }
+  for(int dataSize : std::vector<int>{1, 10, 100, 1000, 10000, 20000}) {
+    for(int query : etlQueriesToBenchmark) {
+      for(int percentage : {20, 40, 60, 80, 100}) {
+        for(int variant : etlVariantsToBenchmark) {
           std::ostringstream testName;
-          // auto const& queryName = etlQueriesNoTransformNames()[DATASETS::TPCH + query + dataSize + percentage];
-          auto const& queryName = etlQueriesTransformNames()[DATASETS::TPCH + query];
-          testName << queryName << "/";
+          testName << etlQueryName(query) << "/";
+          testName << etlVariantName(variant) << "/";
           testName << dataSize << "MB/";
-          // testName << percentage << "pc";
-          if(BENCHMARK_STORAGE_BLOCK_SIZE) {
-            testName << "/bs:";
-            testName << (blockSize >> 20) << "MB";
-          }
-          benchmark::RegisterBenchmark(testName.str(), TPCH_Benchmark, DATASETS::TPCH + query,
-                                      dataSize, blockSize)
+          testName << percentage << "pc";
+          etlMatrixCells().try_emplace(testName.str(),
+                                       ETLMatrixCell{query, dataSize, percentage, variant});
+          benchmark::RegisterBenchmark(testName.str(), ETL_Benchmark, variant, query, dataSize,
+                                       percentage, DEFAULT_STORAGE_BLOCK_SIZE)
               ->MeasureProcessCPUTime()
               ->UseRealTime();
-        // }
+        }
+      }
+    }
+  }
+
+  /* register concurrent client benchmarks of the lazy transformation engine */
+  if(benchmarkLazyTransformationClients) {
+    for(int dataSize : std::vector<int>{1, 10, 100, 1000, 10000, 20000}) {
+      std::ostringstream testName;
+      testName << "LAZY_TRANSFORMATION_CLIENTS/";
+      testName << dataSize << "MB";
+      benchmark::RegisterBenchmark(testName.str(), lazy_transformation_clients_Benchmark, dataSize,
+                                   DEFAULT_STORAGE_BLOCK_SIZE, false)
+          ->UseRealTime()
+          ->ArgName("clients")
+          ->RangeMultiplier(2)
+          ->Range(1, 64);
+    }
+  }
+  if(benchmarkLazyTransformationRewrite) {
+    // the rewrite doesn't depend on the data, so the queries of the smallest data size are rewritten
+    benchmark::RegisterBenchmark("LAZY_TRANSFORMATION_CLIENTS/rewrite", lazy_transformation_clients_Benchmark,
+                                 SF_1, DEFAULT_STORAGE_BLOCK_SIZE, true)
+        ->UseRealTime()
+        ->ArgName("clients")
+        ->RangeMultiplier(2)
+        ->Range(1, static_cast<int>(std::max(1U, std::thread::hardware_concurrency())));
+  }
+
+  /* register random transformation benchmarks, each seed with the baseline, lazy and rewrite-only variants */
+  if(benchmarkRandomTransformations) {
+    for(int dataSize : std::vector<int>{1, 10, 100, 1000, 10000, 20000}) {
+      for(int seedIdx = 0; seedIdx < randomTransformationSeeds; ++seedIdx) {
+        auto seed = firstRandomTransformationSeed + static_cast<unsigned int>(seedIdx);
+        for(int variant : {RANDOM_BASELINE, RANDOM_LAZY, RANDOM_REWRITE}) {
+          std::ostringstream testName;
+          testName << "RANDOM_TRANSFORMATION_" << seed << "/";
+          testName << randomTransformationVariantName(variant) << "/";
+          testName << dataSize << "MB";
+          benchmark::RegisterBenchmark(testName.str(), random_transformation_Benchmark, variant,
+                                       seed, dataSize, DEFAULT_STORAGE_BLOCK_SIZE)
+              ->MeasureProcessCPUTime()
+              ->UseRealTime()
+              ->ArgNames({"operators", "pc"})
+              ->ArgsProduct({{1, 2, 4, 8, 16, 32}, {20, 40, 60, 80, 100}});
+        }
       }
     }
   }
@@ -388,7 +491,12 @@ void initAndRunBenchmarks(int argc, char** argv) {
   storageLibrary = "/mnt/e/University/Andrii/BOSSArrowStorageEngine/build/libBOSSArrowStorage.so";
 
   benchmark::Initialize(&argc, argv, ::benchmark::PrintDefaultHelp);
-  benchmark::RunSpecifiedBenchmarks();
+  if(etlQueriesToBenchmark.empty()) {
+    benchmark::RunSpecifiedBenchmarks();
+  } else {
+    ETLMatrixReporter reporter(etlMatrixOutput);
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+  }
 
   releaseBOSSEngines();
 }
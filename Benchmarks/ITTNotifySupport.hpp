@@ -33,6 +33,19 @@ public:
 #ifdef WITH_ITT_NOTIFY
     __itt_task_end(domain);
     __itt_pause();
+#endif // WITH_ITT_NOTIFY
+  }
+  // Marks a task without resuming or pausing the collection, so that tasks can be nested in a sampled region
+  void startTask(char const* taskname) const {
+#ifdef WITH_ITT_NOTIFY
+    __itt_task_begin(domain, __itt_null, __itt_null, __itt_string_handle_create(taskname));
+#else
+    (void)taskname; // Silence the "unused parameter" warning
+#endif // WITH_ITT_NOTIFY
+  }
+  void stopTask() const {
+#ifdef WITH_ITT_NOTIFY
+    __itt_task_end(domain);
 #endif // WITH_ITT_NOTIFY
   }
 };
@@ -0,0 +1,153 @@
+// Microbenchmarks of the rewrite of the lazy transformation engine. The engine is linked directly and the
+// rewritten queries are not evaluated, so neither the storage nor the Velox engine is involved.
+// Run with --benchmark_format=json (or --benchmark_out=<file>) for the format of the results folder
+#include <BOSS.hpp>
+#include <ExpressionUtilities.hpp>
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+#include "../Source/BOSSLazyTransformationEngine.hpp"
+
+using namespace boss::utilities;
+
+namespace {
+
+// Shape of a synthetic transformation and of the queries over it
+enum REWRITE_SHAPE_ARGS { DEPTH = 0, WIDTH, CONJUNCTS, OR_BRANCHES, SET_OPERATORS };
+
+boss::Symbol column(int64_t index) { return boss::Symbol("C" + std::to_string(index)); }
+
+// Table with `width` columns of three rows each
+boss::Expression syntheticTable(int64_t width) {
+  boss::ExpressionArguments columns;
+  for(int64_t i = 0; i < width; ++i) {
+    columns.emplace_back("Column"_(column(i), "List"_(1, 2, 3)));
+  }
+  return boss::ComplexExpression("Table"_, {}, std::move(columns), {});
+}
+
+// `depth` stacked projections over the table, each computing all `width` columns from the ones below. With set
+// operators, the input is a Union of that many + 1 tables
+boss::ComplexExpression syntheticTransformation(int64_t depth, int64_t width, int64_t setOperators) {
+  boss::Expression input = syntheticTable(width);
+  if(setOperators > 0) {
+    boss::ExpressionArguments inputs;
+    inputs.emplace_back(std::move(input));
+    for(int64_t i = 0; i < setOperators; ++i) {
+      inputs.emplace_back(syntheticTable(width));
+    }
+    input = boss::ComplexExpression("Union"_, {}, std::move(inputs), {});
+  }
+  for(int64_t level = 0; level < depth; ++level) {
+    boss::ExpressionArguments asArguments;
+    for(int64_t i = 0; i < width; ++i) {
+      asArguments.emplace_back(column(i));
+      // Every other column is computed, so only the others can be pushed through
+      if(i % 2 == 0) {
+        asArguments.emplace_back(column(i));
+      } else {
+        asArguments.emplace_back("Plus"_(column(i), 1));
+      }
+    }
+    input = "Project"_(std::move(input), boss::ComplexExpression("As"_, {}, std::move(asArguments), {}));
+  }
+  return std::get<boss::ComplexExpression>(std::move(input));
+}
+
+// Selection of one column of the transformation by `orBranches` branches of `conjuncts` comparisons each
+boss::ComplexExpression syntheticQuery(int64_t width, int64_t conjuncts, int64_t orBranches) {
+  boss::ExpressionArguments branches;
+  for(int64_t branch = 0; branch < orBranches; ++branch) {
+    boss::ExpressionArguments comparisons;
+    for(int64_t i = 0; i < conjuncts; ++i) {
+      comparisons.emplace_back("Greater"_(column(i % width), static_cast<int32_t>(branch + i)));
+    }
+    branches.emplace_back(boss::ComplexExpression("And"_, {}, std::move(comparisons), {}));
+  }
+  boss::Expression condition = std::move(branches[0]);
+  if(orBranches > 1) {
+    condition = boss::ComplexExpression("Or"_, {}, std::move(branches), {});
+  }
+  return "Project"_("Select"_("Transformation"_, "Where"_(std::move(condition))), "As"_(column(0), column(0)));
+}
+
+void rewrite_AddTransformation_Benchmark(benchmark::State& state) {
+  auto transformation =
+      syntheticTransformation(state.range(DEPTH), state.range(WIDTH), state.range(SET_OPERATORS));
+  boss::engines::LazyTransformation::Engine engine;
+  for(auto _ : state) { // NOLINT
+    auto result = engine.evaluate("AddTransformation"_(
+        transformation.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING)));
+    benchmark::DoNotOptimize(result);
+    state.PauseTiming();
+    engine.evaluate("RemoveAllTransformations"_());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Same shape with the same literals on every iteration, so all but the first are served by the rewrite cache
+void rewrite_ApplyTransformation_Benchmark(benchmark::State& state) {
+  boss::engines::LazyTransformation::Engine engine;
+  engine.evaluate("AddTransformation"_(
+      syntheticTransformation(state.range(DEPTH), state.range(WIDTH), state.range(SET_OPERATORS))));
+  auto query =
+      syntheticQuery(state.range(WIDTH), state.range(CONJUNCTS), state.range(OR_BRANCHES));
+  for(auto _ : state) { // NOLINT
+    auto result = engine.evaluate(
+        "ApplyTransformation"_(query.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING)));
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// The full rewrite on every iteration, bypassing the rewrite cache of Engine::evaluate
+void rewrite_ApplyTransformationUncached_Benchmark(benchmark::State& state) {
+  boss::engines::LazyTransformation::Engine engine;
+  auto plan = boss::engines::LazyTransformation::compileTransformationPlan(
+      syntheticTransformation(state.range(DEPTH), state.range(WIDTH), state.range(SET_OPERATORS)));
+  auto query =
+      syntheticQuery(state.range(WIDTH), state.range(CONJUNCTS), state.range(OR_BRANCHES));
+  for(auto _ : state) { // NOLINT
+    auto result = engine.applyTransformation(
+        query.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING), *plan);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Varies one dimension of the shape at a time around a base shape. The query dimensions are only varied for
+// benchmarks that apply the transformation
+void applyRewriteShapes(benchmark::internal::Benchmark* b, bool varyQuery) {
+  b->ArgNames({"depth", "width", "conjuncts", "or", "setops"});
+  std::vector<int64_t> const base = {4, 8, 4, 1, 0};
+  std::vector<std::vector<int64_t>> const sweeps = {
+      {1, 2, 4, 8, 16, 32}, {2, 8, 32, 128}, {1, 2, 4, 8, 16}, {1, 2, 4, 8}, {0, 1, 3, 7}};
+  b->Args(base);
+  for(size_t dimension = 0; dimension < sweeps.size(); ++dimension) {
+    if(!varyQuery && (dimension == CONJUNCTS || dimension == OR_BRANCHES)) {
+      continue;
+    }
+    for(auto value : sweeps[dimension]) {
+      if(value == base[dimension]) {
+        continue;
+      }
+      auto args = base;
+      args[dimension] = value;
+      b->Args(args);
+    }
+  }
+}
+
+void applyTransformationShapes(benchmark::internal::Benchmark* b) { applyRewriteShapes(b, false); }
+
+void applyQueryShapes(benchmark::internal::Benchmark* b) { applyRewriteShapes(b, true); }
+
+} // namespace
+
+BENCHMARK(rewrite_AddTransformation_Benchmark)->Apply(applyTransformationShapes);
+BENCHMARK(rewrite_ApplyTransformation_Benchmark)->Apply(applyQueryShapes);
+BENCHMARK(rewrite_ApplyTransformationUncached_Benchmark)->Apply(applyQueryShapes);
+
+BENCHMARK_MAIN();
@@ -22,6 +22,7 @@ extern int VELOX_MINIMUM_OUTPUT_BATCH_SIZE;
 
 extern std::vector<std::string> librariesToTest;
 extern std::string storageLibrary;
+extern std::string lazyTransformationLibrary;
 extern int latestDataSize; // Scale factor for TPCH and num of elements for custom
 extern int latestBlockSize;
 extern std::string latestDataSet;
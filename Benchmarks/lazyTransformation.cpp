@@ -0,0 +1,114 @@
+// Uses the ETL transformations and queries of tpch.cpp, so it has to be included after it
+#include "config.hpp"
+#include "utilities.cpp"
+#include <algorithm>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static boss::Expression evaluateInLazyTransformationEngine(boss::Expression&& expression) {
+  return boss::evaluate(
+      "EvaluateInEngines"_("List"_(lazyTransformationLibrary), std::move(expression)));
+}
+
+// The lazy ETL views at every percentage, over the line transformation (index 0) and the butterfly
+// transformation (index 1)
+static std::vector<boss::ComplexExpression> const& lazyTransformationClientQueries(int dataSize) {
+  static std::map<int, std::vector<boss::ComplexExpression>> queries;
+  auto& dataSizeQueries = queries[dataSize];
+  if(dataSizeQueries.empty()) {
+    for(int percentage : {20, 40, 60, 80, 100}) {
+      for(int query : {LINE_VIEW_03, LINE_VIEW_04, BUTTERFLY_1_VIEW_12, BUTTERFLY_1_VIEW_13}) {
+        auto const& applyTransformation = std::get<boss::ComplexExpression>(
+            etlQueriesTransform().find(static_cast<int>(DATASETS::TPCH) + dataSize + percentage + query)->second);
+        int transformationIndex = (query == LINE_VIEW_03 || query == LINE_VIEW_04) ? 0 : 1;
+        dataSizeQueries.emplace_back("ApplyTransformation"_(
+            applyTransformation.getDynamicArguments()[0].clone(
+                boss::expressions::CloneReason::EXPRESSION_WRAPPING),
+            transformationIndex));
+      }
+    }
+  }
+  return dataSizeQueries;
+}
+
+// Starts state.range(0) client threads on the loaded TPC-H data. In every iteration, each client evaluates the whole
+// query mix once, starting from a different query. Reports the aggregate throughput and the latency percentiles over
+// the queries of all the clients. With rewriteOnly, the queries are only rewritten by the lazy transformation library
+// and no data is loaded, which shows how the rewrite alone scales with concurrent callers.
+// The transformations are registered before the timed loop, as the clients are threads of the benchmark itself
+void lazy_transformation_clients_Benchmark(benchmark::State& state, int dataSize, int blockSize,
+                                           bool rewriteOnly) {
+  auto clients = static_cast<int>(state.range(0));
+  std::function<boss::Expression(boss::Expression&&)> eval = evaluateInLazyTransformationEngine;
+  if(rewriteOnly) {
+    if(lazyTransformationLibrary.empty()) {
+      state.SkipWithError("The rewrite is measured with --lazy-transformation-library");
+      return;
+    }
+  } else {
+    initStorageEngine_TPCH(dataSize, blockSize);
+    // the views group by the part or the supplier key, so there are at most as many groups as parts
+    setCardinalityEnvironmentVariable(std::max(1, 200 * dataSize));
+    eval = getEvaluateLambda();
+  }
+  auto error_found = getErrorFoundLambda();
+  eval("RemoveAllTransformations"_());
+  for(auto transformation : {LINE_VIEW_TRANSFORM, BUTTERFLY_TRANSFORM}) {
+    eval(utilities::shallowCopy(std::get<boss::ComplexExpression>(
+        etlQueriesTransform().find(static_cast<int>(DATASETS::TPCH) + transformation)->second)));
+  }
+  auto const& queries = lazyTransformationClientQueries(dataSize);
+  for(auto const& query : queries) {
+    if(error_found(eval(utilities::shallowCopy(query)), "LAZY_TRANSFORMATION_CLIENTS")) {
+      throw std::runtime_error("Error in client query");
+    }
+  }
+
+  std::vector<double> latencies;
+  std::mutex latenciesMutex;
+  std::atomic<bool> failed = false;
+  for(auto _ : state) { // NOLINT
+    std::vector<std::thread> threads;
+    threads.reserve(clients);
+    for(int client = 0; client < clients; ++client) {
+      threads.emplace_back([&, client]() {
+        std::vector<double> clientLatencies;
+        clientLatencies.reserve(queries.size());
+        for(size_t i = 0; i < queries.size(); ++i) {
+          auto start = std::chrono::high_resolution_clock::now();
+          auto result = eval(utilities::shallowCopy(queries[(client + i) % queries.size()]));
+          std::chrono::duration<double, std::milli> latency =
+              std::chrono::high_resolution_clock::now() - start;
+          if(error_found(result, "LAZY_TRANSFORMATION_CLIENTS")) {
+            failed = true;
+          }
+          clientLatencies.push_back(latency.count());
+        }
+        std::lock_guard lock(latenciesMutex);
+        latencies.insert(latencies.end(), clientLatencies.begin(), clientLatencies.end());
+      });
+    }
+    for(auto& thread : threads) {
+      thread.join();
+    }
+    if(failed) {
+      state.SkipWithError("Error in client query");
+      break;
+    }
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  state.counters["clients"] = clients;
+  state.counters["queries_per_second"] =
+      benchmark::Counter(static_cast<double>(latencies.size()), benchmark::Counter::kIsRate);
+  state.counters["p50_ms"] = percentile(latencies, 50);
+  state.counters["p95_ms"] = percentile(latencies, 95);
+  state.counters["p99_ms"] = percentile(latencies, 99);
+  state.SetItemsProcessed(static_cast<int64_t>(latencies.size()));
+}
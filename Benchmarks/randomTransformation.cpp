@@ -0,0 +1,279 @@
+// Seeded generator of random but valid transformations over the TPC-H schema, with ApplyTransformation queries
+// of controlled selectivity over them. Uses the TPC-H loading of tpch.cpp and the lazy transformation helpers of
+// lazyTransformation.cpp, so it has to be included after both
+#include "config.hpp"
+#include "utilities.cpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+enum RANDOM_TRANSFORMATION_VARIANTS { RANDOM_BASELINE = 0, RANDOM_LAZY, RANDOM_REWRITE };
+
+enum RANDOM_TRANSFORMATION_OPERATORS {
+  RANDOM_PROJECT = 0,
+  RANDOM_SELECT,
+  RANDOM_JOIN,
+  RANDOM_GROUP,
+  RANDOM_UNION
+};
+
+// A TPC-H table keyed by the part key, with the numeric columns it contributes to a transformation
+struct RandomTransformationTable {
+  boss::Symbol table;
+  boss::Symbol key;
+  std::vector<boss::Symbol> columns;
+};
+
+// A generated transformation. Every operator keeps the part key, so the queries can select on it
+struct RandomTransformation {
+  boss::Expression expression;
+  boss::Symbol key;
+  // numeric output columns other than the key
+  std::vector<boss::Symbol> columns;
+  std::set<std::string> joinedTables;
+  int operators = 0;
+  int generatedColumns = 0;
+};
+
+static std::vector<RandomTransformationTable> const& randomTransformationTables() {
+  static std::vector<RandomTransformationTable> const tables = {
+      {"LINEITEM"_, "l_partkey"_, {"l_quantity"_, "l_extendedprice"_, "l_discount"_, "l_tax"_}},
+      {"PARTSUPP"_, "ps_partkey"_, {"ps_availqty"_, "ps_supplycost"_}},
+      {"PART"_, "p_partkey"_, {"p_size"_, "p_retailprice"_}}};
+  return tables;
+}
+
+// TPC-H has 200,000 parts per scale factor and the data sizes are in MB (1000MB is SF 1)
+static int randomTransformationMaxKey(int dataSize) { return std::max(1, 200 * dataSize); }
+
+static boss::Symbol const& randomColumn(std::mt19937& gen, std::vector<boss::Symbol> const& columns) {
+  return columns[std::uniform_int_distribution<size_t>(0, columns.size() - 1)(gen)];
+}
+
+static boss::Symbol newRandomTransformationColumn(RandomTransformation& transformation,
+                                                  std::string const& prefix) {
+  return boss::Symbol(prefix + "_" + std::to_string(transformation.generatedColumns++));
+}
+
+static boss::Expression projectRandomTransformationTable(RandomTransformationTable const& table) {
+  boss::ExpressionArguments asArguments;
+  asArguments.emplace_back(table.key);
+  asArguments.emplace_back(table.key);
+  for(auto const& column : table.columns) {
+    asArguments.emplace_back(column);
+    asArguments.emplace_back(column);
+  }
+  return "Project"_(table.table, boss::ComplexExpression("As"_, {}, std::move(asArguments), {}));
+}
+
+// Computes a new column from an existing one and sometimes drops another
+static void addRandomProject(RandomTransformation& transformation, std::mt19937& gen) {
+  auto const& source = randomColumn(gen, transformation.columns);
+  auto newColumn = newRandomTransformationColumn(transformation, "calc");
+  boss::Expression definition = "Times"_(source, 1.1); // NOLINT
+  switch(std::uniform_int_distribution<int>(0, 2)(gen)) {
+  case 0:
+    break;
+  case 1:
+    definition = "Plus"_(source, 1);
+    break;
+  default:
+    definition = "Minus"_(source, randomColumn(gen, transformation.columns));
+    break;
+  }
+  if(transformation.columns.size() > 1 && std::bernoulli_distribution(1.0 / 3)(gen)) {
+    transformation.columns.erase(transformation.columns.begin() +
+                                 std::uniform_int_distribution<size_t>(
+                                     0, transformation.columns.size() - 1)(gen));
+  }
+
+  boss::ExpressionArguments asArguments;
+  asArguments.emplace_back(transformation.key);
+  asArguments.emplace_back(transformation.key);
+  for(auto const& column : transformation.columns) {
+    asArguments.emplace_back(column);
+    asArguments.emplace_back(column);
+  }
+  asArguments.emplace_back(newColumn);
+  asArguments.emplace_back(std::move(definition));
+  transformation.columns.emplace_back(std::move(newColumn));
+  transformation.expression =
+      "Project"_(std::move(transformation.expression),
+                 boss::ComplexExpression("As"_, {}, std::move(asArguments), {}));
+}
+
+// All the TPC-H columns used are non-negative, so the condition keeps most rows
+static void addRandomSelect(RandomTransformation& transformation, std::mt19937& gen) {
+  transformation.expression =
+      "Select"_(std::move(transformation.expression),
+                "Where"_("Greater"_(randomColumn(gen, transformation.columns), 0)));
+}
+
+// Joins a table that is not in the transformation yet. Falls back to a projection when all of them are
+static void addRandomJoin(RandomTransformation& transformation, std::mt19937& gen) {
+  std::vector<RandomTransformationTable const*> candidates;
+  for(auto const& table : randomTransformationTables()) {
+    if(transformation.joinedTables.count(table.table.getName()) == 0) {
+      candidates.push_back(&table);
+    }
+  }
+  if(candidates.empty()) {
+    addRandomProject(transformation, gen);
+    return;
+  }
+  auto const& table =
+      *candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(gen)];
+  transformation.expression =
+      "Join"_(std::move(transformation.expression), projectRandomTransformationTable(table),
+              "Where"_("Equal"_(transformation.key, table.key)));
+  transformation.columns.insert(transformation.columns.end(), table.columns.begin(),
+                                table.columns.end());
+  transformation.joinedTables.insert(table.table.getName());
+}
+
+static void addRandomGroup(RandomTransformation& transformation, std::mt19937& gen) {
+  boss::ExpressionArguments asArguments;
+  std::vector<boss::Symbol> aggregates;
+  for(auto const& column : transformation.columns) {
+    auto aggregate = newRandomTransformationColumn(transformation, "agg");
+    asArguments.emplace_back(aggregate);
+    switch(std::uniform_int_distribution<int>(0, 2)(gen)) {
+    case 0:
+      asArguments.emplace_back("Sum"_(column));
+      break;
+    case 1:
+      asArguments.emplace_back("Max"_(column));
+      break;
+    default:
+      asArguments.emplace_back("Min"_(column));
+      break;
+    }
+    aggregates.emplace_back(std::move(aggregate));
+  }
+  transformation.columns = std::move(aggregates);
+  transformation.expression =
+      "Group"_(std::move(transformation.expression), "By"_(transformation.key),
+               boss::ComplexExpression("As"_, {}, std::move(asArguments), {}));
+}
+
+// Splits the input on a random key and unions the two halves back, so the input subtree is shared by both
+// inputs of the Union and the rows are unchanged
+static void addRandomUnion(RandomTransformation& transformation, std::mt19937& gen, int maxKey) {
+  int split = std::uniform_int_distribution<int>(1, maxKey)(gen);
+  auto const& input = std::get<boss::ComplexExpression>(transformation.expression);
+  auto lower = "Select"_(input.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING),
+                         "Where"_("Greater"_(split, transformation.key)));
+  auto upper = "Select"_(std::move(transformation.expression),
+                         "Where"_("Greater"_(transformation.key, split - 1)));
+  transformation.expression = "Union"_(std::move(lower), std::move(upper));
+}
+
+// Builds `operators` random operators on top of a projection of a random base table. The same seed, number of
+// operators and data size always build the same transformation
+RandomTransformation createRandomTransformation(unsigned int seed, int operators, int dataSize) {
+  std::mt19937 gen(seed);
+  auto maxKey = randomTransformationMaxKey(dataSize);
+  auto const& tables = randomTransformationTables();
+  auto const& base = tables[std::uniform_int_distribution<size_t>(0, tables.size() - 1)(gen)];
+
+  RandomTransformation transformation{
+      projectRandomTransformationTable(base), base.key, base.columns, {base.table.getName()}};
+
+  // projections are the most common operators of the hand-written transformations
+  std::discrete_distribution<int> operatorDistribution({3, 2, 1, 1, 1});
+  for(; transformation.operators < operators; ++transformation.operators) {
+    switch(operatorDistribution(gen)) {
+    case RANDOM_PROJECT:
+      addRandomProject(transformation, gen);
+      break;
+    case RANDOM_SELECT:
+      addRandomSelect(transformation, gen);
+      break;
+    case RANDOM_JOIN:
+      addRandomJoin(transformation, gen);
+      break;
+    case RANDOM_GROUP:
+      addRandomGroup(transformation, gen);
+      break;
+    default:
+      addRandomUnion(transformation, gen, maxKey);
+      break;
+    }
+  }
+  return transformation;
+}
+
+// Aggregates the rows of `input` whose key is within the first `percentage` percent of the key domain. With
+// "Transformation"_ as input it is the lazy query, with the transformation itself it is the baseline query
+boss::ComplexExpression createRandomTransformationQuery(boss::Expression&& input,
+                                                        RandomTransformation const& transformation,
+                                                        int dataSize, int percentage) {
+  int keyFilter = randomTransformationMaxKey(dataSize) * percentage / 100 + 1;
+  return boss::ComplexExpression(
+      "Group"_("Select"_(std::move(input), "Where"_("Greater"_(keyFilter, transformation.key))),
+               "As"_("sum_key"_, "Sum"_(transformation.key), "sum_value"_,
+                     "Sum"_(transformation.columns.front()))));
+}
+
+static std::string randomTransformationVariantName(int variant) {
+  switch(variant) {
+  case RANDOM_BASELINE:
+    return "baseline";
+  case RANDOM_LAZY:
+    return "lazy";
+  default:
+    return "rewrite";
+  }
+}
+
+// Arguments are the number of operators of the transformation and the percentage of the key domain selected by
+// the query. The baseline evaluates the query over the transformation, the lazy variant applies the
+// transformation and evaluates the result and the rewrite variant only applies it
+void random_transformation_Benchmark(benchmark::State& state, int variant, unsigned int seed,
+                                     int dataSize, int blockSize) {
+  auto operators = static_cast<int>(state.range(0));
+  auto percentage = static_cast<int>(state.range(1));
+  initStorageEngine_TPCH(dataSize, blockSize);
+  // the transformations group by the part key
+  setCardinalityEnvironmentVariable(randomTransformationMaxKey(dataSize));
+
+  auto transformation = createRandomTransformation(seed, operators, dataSize);
+  state.counters["operators"] = operators;
+  state.counters["percentage"] = percentage;
+
+  std::ostringstream queryName;
+  queryName << "RANDOM_TRANSFORMATION_" << seed << "_OP_" << operators << "_PC_" << percentage << "_"
+            << randomTransformationVariantName(variant);
+
+  if(variant == RANDOM_BASELINE) {
+    auto const& input = std::get<boss::ComplexExpression>(transformation.expression);
+    boss::Expression query = createRandomTransformationQuery(
+        input.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING), transformation, dataSize,
+        percentage);
+    runBenchmark(state, queryName.str(), query);
+    return;
+  }
+
+  boss::Expression query = boss::ComplexExpression("ApplyTransformation"_(
+      createRandomTransformationQuery("Transformation"_, transformation, dataSize, percentage), 0));
+
+  if(variant == RANDOM_LAZY) {
+    auto eval = getEvaluateLambda();
+    eval("RemoveAllTransformations"_());
+    eval("AddTransformation"_(std::move(transformation.expression)));
+    runBenchmark(state, queryName.str(), query);
+    return;
+  }
+
+  evaluateInLazyTransformationEngine("RemoveAllTransformations"_());
+  evaluateInLazyTransformationEngine("AddTransformation"_(std::move(transformation.expression)));
+  for(auto _ : state) { // NOLINT
+    auto result = evaluateInLazyTransformationEngine(
+        utilities::shallowCopy(std::get<boss::ComplexExpression>(query)));
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
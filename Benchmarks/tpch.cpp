@@ -1,8 +1,16 @@
 #include "config.hpp"
 #include "dataGeneration.cpp"
 #include "utilities.cpp"
+#include <array>
 #include <benchmark/benchmark.h>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <tuple>
 
 using SpanArguments = boss::DefaultExpressionSystem::ExpressionSpanArguments;
 using SpanArgument = boss::DefaultExpressionSystem::ExpressionSpanArgument;
@@ -51,6 +59,11 @@ enum TRANSFORMATION {
   LINE = 1,
   BUTTERFLY = 2
 };
+enum ETL_VARIANTS {
+  ETL_BASELINE = 0,
+  ETL_EAGER = 1,
+  ETL_LAZY = 2
+};
 
 void initStorageEngine_TPCH(int dataSize, int blockSize) {
   static auto dataSet = std::string("TPCH");
@@ -946,16 +959,207 @@ void TPCH_Benchmark(benchmark::State& state, int queryIdx, int dataSize, int blo
   initStorageEngine_TPCH(dataSize, blockSize);
   setTPCH_groupResultCardinality(queryIdx, dataSize);
 
-  // auto const& queryName = etlQueriesNoTransformNames().find(queryIdx)->second;
-  // auto const& query = etlQueriesNoTransform().find(queryIdx)->second;
-  auto const& queryName = etlTransformationNames().find(queryIdx)->second;
-  auto const& query = etlTransformationsQueries().find(queryIdx)->second;
-  // auto const& queryName = etlQueriesTransformNames().find(queryIdx)->second;
-  // auto const& query = etlQueriesTransform().find(queryIdx)->second;
+  auto const& queryName = tpchQueryNames().find(queryIdx)->second;
+  auto const& query = tpchQueries().find(queryIdx)->second;
+
+  runBenchmark(state, queryName, query);
+}
+
+// Evaluates one of the ETL transformations eagerly, i.e. the cost of materialising it
+void ETL_Transformation_Benchmark(benchmark::State& state, int transformationIdx, int dataSize,
+                                  int blockSize) {
+  initStorageEngine_TPCH(dataSize, blockSize);
+
+  auto const& queryName = etlTransformationNames().find(transformationIdx)->second;
+  auto const& query = etlTransformationsQueries().find(transformationIdx)->second;
 
   runBenchmark(state, queryName, query);
 }
 
+static std::string etlVariantName(int variant) {
+  switch(variant) {
+  case ETL_BASELINE:
+    return "baseline";
+  case ETL_EAGER:
+    return "eager";
+  default:
+    return "lazy";
+  }
+}
+
+static std::string etlQueryName(int query) {
+  switch(query) {
+  case LINE_VIEW_03:
+    return "LINE_03";
+  case LINE_VIEW_04:
+    return "LINE_04";
+  case BUTTERFLY_1_VIEW_12:
+    return "BUTT_12";
+  default:
+    return "BUTT_13";
+  }
+}
+
+static bool isLineQuery(int query) { return query == LINE_VIEW_03 || query == LINE_VIEW_04; }
+
+// Cells of the ETL matrix, by the name their benchmark is registered with
+struct ETLMatrixCell {
+  int query;
+  int dataSize;
+  int percentage;
+  int variant;
+};
+
+static auto& etlMatrixCells() {
+  static std::map<std::string, ETLMatrixCell> cells;
+  return cells;
+}
+
+// Copies the query with every "Transformation"_ replaced by a shallow copy of the materialised transformation
+static boss::ComplexExpression replaceTransformationSymbol(boss::ComplexExpression const& query,
+                                                           boss::ComplexExpression const& materialised) {
+  boss::ExpressionArguments dynamics;
+  for(auto const& arg : query.getDynamicArguments()) {
+    if(std::holds_alternative<boss::Symbol>(arg) && std::get<boss::Symbol>(arg) == "Transformation"_) {
+      dynamics.emplace_back(utilities::shallowCopy(materialised));
+    } else if(std::holds_alternative<boss::ComplexExpression>(arg)) {
+      dynamics.emplace_back(
+          replaceTransformationSymbol(std::get<boss::ComplexExpression>(arg), materialised));
+    } else {
+      dynamics.emplace_back(arg.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+  }
+  return boss::ComplexExpression(query.getHead(), {}, std::move(dynamics), {});
+}
+
+// One cell of the ETL matrix. The baseline evaluates the whole view, the eager variant evaluates the view over
+// the transformation materialised beforehand (the materialisation time is reported as a counter) and the lazy
+// variant applies the transformation with the lazy transformation engine
+void ETL_Benchmark(benchmark::State& state, int variant, int query, int dataSize, int percentage,
+                   int blockSize) {
+  initStorageEngine_TPCH(dataSize, blockSize);
+  // the views group by the part or the supplier key, so there are at most as many groups as parts
+  setCardinalityEnvironmentVariable(std::max(1, 200 * dataSize));
+
+  int queryIdx = static_cast<int>(DATASETS::TPCH) + dataSize + percentage + query;
+  std::ostringstream queryName;
+  queryName << etlQueryName(query) << "_" << etlVariantName(variant) << "_SF_" << dataSize << "PC"
+            << percentage;
+  auto eval = getEvaluateLambda();
+
+  if(variant == ETL_BASELINE) {
+    runBenchmark(state, queryName.str(), etlQueriesNoTransform().find(queryIdx)->second);
+    return;
+  }
+
+  auto const& lazyQuery = etlQueriesTransform().find(queryIdx)->second;
+  if(variant == ETL_LAZY) {
+    auto const& transformation =
+        etlQueriesTransform()
+            .find(static_cast<int>(DATASETS::TPCH) +
+                  (isLineQuery(query) ? LINE_VIEW_TRANSFORM : BUTTERFLY_TRANSFORM))
+            ->second;
+    eval("RemoveAllTransformations"_());
+    eval(utilities::shallowCopy(std::get<boss::ComplexExpression>(transformation)));
+    runBenchmark(state, queryName.str(), lazyQuery);
+    return;
+  }
+
+  auto const& transformation =
+      etlTransformationsQueries()
+          .find(static_cast<int>(DATASETS::TPCH) + (isLineQuery(query) ? LINE : BUTTERFLY))
+          ->second;
+  auto start = std::chrono::high_resolution_clock::now();
+  auto materialised = eval(utilities::shallowCopy(std::get<boss::ComplexExpression>(transformation)));
+  std::chrono::duration<double> materialisationTime = std::chrono::high_resolution_clock::now() - start;
+  if(getErrorFoundLambda()(materialised, queryName.str())) {
+    throw std::runtime_error("Error in materialised transformation");
+  }
+  state.counters["materialisation_s"] = materialisationTime.count();
+
+  // the view is the argument of ApplyTransformation
+  boss::Expression eagerQuery = replaceTransformationSymbol(
+      std::get<boss::ComplexExpression>(
+          std::get<boss::ComplexExpression>(lazyQuery).getDynamicArguments()[0]),
+      std::get<boss::ComplexExpression>(materialised));
+  runBenchmark(state, queryName.str(), eagerQuery);
+}
+
+// Console reporter that also collects the runs of the ETL matrix. On Finalize, it writes one entry per query,
+// data size and percentage with the mean time of each variant and the speedups of the lazy variant
+class ETLMatrixReporter : public benchmark::ConsoleReporter {
+public:
+  explicit ETLMatrixReporter(std::string outputPath) : outputPath(std::move(outputPath)) {}
+
+  void ReportRuns(std::vector<Run> const& reports) override {
+    ConsoleReporter::ReportRuns(reports);
+    for(auto const& run : reports) {
+      auto cell = etlMatrixCells().find(run.run_name.function_name);
+      if(run.run_type != Run::RT_Iteration || cell == etlMatrixCells().end()) {
+        continue;
+      }
+      timeUnit = benchmark::GetTimeUnitString(run.time_unit);
+      auto& times = cells[{cell->second.query, cell->second.dataSize, cell->second.percentage}];
+      times.sum[cell->second.variant] += run.GetAdjustedRealTime();
+      times.count[cell->second.variant]++;
+      auto materialisation = run.counters.find("materialisation_s");
+      if(materialisation != run.counters.end()) {
+        times.materialisationSeconds = materialisation->second.value;
+      }
+    }
+  }
+
+  void Finalize() override {
+    ConsoleReporter::Finalize();
+    std::ofstream output(outputPath);
+    output << "{\n  \"time_unit\": \"" << timeUnit << "\",\n  \"cells\": [";
+    bool first = true;
+    for(auto const& [key, times] : cells) {
+      auto const& [query, dataSize, percentage] = key;
+      output << (first ? "\n" : ",\n") << "    {\"query\": \"" << etlQueryName(query)
+             << "\", \"data_size_mb\": " << dataSize << ", \"percentage\": " << percentage;
+      for(int variant : {ETL_BASELINE, ETL_EAGER, ETL_LAZY}) {
+        output << ", \"" << etlVariantName(variant) << "\": ";
+        writeValue(output, times.mean(variant));
+      }
+      output << ", \"eager_materialisation_s\": ";
+      writeValue(output, times.materialisationSeconds);
+      output << ", \"lazy_speedup_over_baseline\": ";
+      writeValue(output, times.mean(ETL_BASELINE) / times.mean(ETL_LAZY));
+      output << ", \"lazy_speedup_over_eager\": ";
+      writeValue(output, times.mean(ETL_EAGER) / times.mean(ETL_LAZY));
+      output << "}";
+      first = false;
+    }
+    output << "\n  ]\n}\n";
+  }
+
+private:
+  struct CellTimes {
+    std::array<double, 3> sum = {};
+    std::array<int, 3> count = {};
+    double materialisationSeconds = std::numeric_limits<double>::quiet_NaN();
+
+    double mean(int variant) const {
+      return count[variant] == 0 ? std::numeric_limits<double>::quiet_NaN()
+                                 : sum[variant] / count[variant];
+    }
+  };
+
+  // missing variants are NaN, written as null
+  static void writeValue(std::ofstream& output, double value) {
+    if(std::isnan(value)) {
+      output << "null";
+    } else {
+      output << value;
+    }
+  }
+
+  std::string outputPath;
+  std::string timeUnit = "ns";
+  std::map<std::tuple<int, int, int>, CellTimes> cells;
+};
+
 void initStorageEngine_tpch_q6_clustering(int dataSize, uint32_t spreadInCluster) {
   auto evalStorage = getEvaluateStorageLambda();
   auto checkForErrors = getCheckForErrorsLambda();
@@ -3,11 +3,19 @@
 
 #include <BOSS.hpp>
 #include <ExpressionUtilities.hpp>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <benchmark/benchmark.h>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "config.hpp"
 
@@ -200,6 +208,94 @@ size_t getNumberOfRowsInTable(std::string& filepath) {
   return rowCount;
 }
 
+// Nearest-rank percentile of values sorted in ascending order
+double percentile(std::vector<double> const& sortedValues, double percentage) {
+  if(sortedValues.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(std::ceil(percentage / 100 * static_cast<double>(sortedValues.size())));
+  return sortedValues[std::max<size_t>(rank, 1) - 1];
+}
+
+// Log-linear latency histogram in the style of HdrHistogram. Latencies below 256ns are recorded exactly and longer
+// ones with a relative error below 1/128, in constant memory whatever the number of iterations
+class LatencyHistogram {
+public:
+  void record(std::chrono::nanoseconds latency) {
+    auto value = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    counts[bucketIndex(value)]++;
+    total++;
+    maxValue = std::max(maxValue, value);
+  }
+
+  // Upper bound of the bucket holding the percentile, in nanoseconds
+  double percentile(double percentage) const {
+    if(total == 0) {
+      return 0;
+    }
+    auto target = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(percentage / 100 * static_cast<double>(total))));
+    uint64_t cumulative = 0;
+    for(size_t i = 0; i < counts.size(); ++i) {
+      cumulative += counts[i];
+      if(cumulative >= target) {
+        return static_cast<double>(std::min(bucketUpperBound(i), maxValue));
+      }
+    }
+    return static_cast<double>(maxValue);
+  }
+
+  uint64_t count() const { return total; }
+
+private:
+  static constexpr uint64_t SUB_BUCKET_BITS = 7;
+  static constexpr uint64_t SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+  static constexpr uint64_t EXACT_VALUES = SUB_BUCKETS * 2;
+  static constexpr size_t BUCKETS = EXACT_VALUES + (64 - SUB_BUCKET_BITS - 2) * SUB_BUCKETS;
+
+  // Index of the highest set bit of a value that is not 0
+  static uint64_t highestBitIndex(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return static_cast<uint64_t>(63 - __builtin_clzll(value));
+#endif
+  }
+
+  // The values from 2^(7 + shift) to 2^(8 + shift) share 128 buckets of width 2^shift
+  static size_t bucketIndex(uint64_t value) {
+    if(value < EXACT_VALUES) {
+      return value;
+    }
+    auto shift = highestBitIndex(value) - SUB_BUCKET_BITS;
+    return EXACT_VALUES + (shift - 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+  }
+
+  static uint64_t bucketUpperBound(size_t index) {
+    if(index < EXACT_VALUES) {
+      return index;
+    }
+    auto shift = (index - EXACT_VALUES) / SUB_BUCKETS + 1;
+    auto subBucket = (index - EXACT_VALUES) % SUB_BUCKETS + SUB_BUCKETS;
+    return ((subBucket + 1) << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS, 0);
+  uint64_t total = 0;
+  uint64_t maxValue = 0;
+};
+
+// Reports the p50, p90, p99 and p99.9 latencies of the histogram as <name>_p50_ms, ..., <name>_p999_ms
+void addLatencyCounters(benchmark::State& state, std::string const& name,
+                        LatencyHistogram const& histogram) {
+  for(auto const& [suffix, percentage] : std::vector<std::pair<std::string, double>>{
+          {"p50", 50}, {"p90", 90}, {"p99", 99}, {"p999", 99.9}}) { // NOLINT
+    state.counters[name + "_" + suffix + "_ms"] = histogram.percentile(percentage) / 1e6;
+  }
+}
+
 void runBenchmark(benchmark::State& state, const std::string& queryName, const boss::Expression& query) {
   auto eval = getEvaluateLambda();
   auto error_found = getErrorFoundLambda();
@@ -255,12 +351,41 @@ void runBenchmark(benchmark::State& state, const std::string& queryName, const b
     }
   }
 
+  // ApplyTransformation queries are rewritten by the lazy transformation engine alone first, so that the latency
+  // of the rewrite and of the evaluation of the rewritten query are recorded separately
+  bool splitRewrite = !lazyTransformationLibrary.empty() &&
+                      std::get<boss::ComplexExpression>(query).getHead() == "ApplyTransformation"_;
+  LatencyHistogram latencies;
+  LatencyHistogram rewriteLatencies;
+  LatencyHistogram executionLatencies;
+
   vtune.startSampling(queryName + " - BOSS");
   for(auto _ : state) { // NOLINT
-    auto result = eval(utilities::shallowCopy(std::get<boss::ComplexExpression>(query)));
-    benchmark::DoNotOptimize(result);
+    auto start = std::chrono::high_resolution_clock::now();
+    if(splitRewrite) {
+      auto rewrittenQuery = boss::evaluate(
+          "EvaluateInEngines"_("List"_(lazyTransformationLibrary),
+                               utilities::shallowCopy(std::get<boss::ComplexExpression>(query))));
+      auto rewriteEnd = std::chrono::high_resolution_clock::now();
+      auto result = eval(std::move(rewrittenQuery));
+      benchmark::DoNotOptimize(result);
+      auto end = std::chrono::high_resolution_clock::now();
+      rewriteLatencies.record(rewriteEnd - start);
+      executionLatencies.record(end - rewriteEnd);
+      latencies.record(end - start);
+    } else {
+      auto result = eval(utilities::shallowCopy(std::get<boss::ComplexExpression>(query)));
+      benchmark::DoNotOptimize(result);
+      latencies.record(std::chrono::high_resolution_clock::now() - start);
+    }
   }
   vtune.stopSampling();
+
+  addLatencyCounters(state, "latency", latencies);
+  if(splitRewrite) {
+    addLatencyCounters(state, "rewrite", rewriteLatencies);
+    addLatencyCounters(state, "execution", executionLatencies);
+  }
 }
 
 template<typename T>
@@ -5,12 +5,19 @@
 #include <Expression.hpp>
 #include <ExpressionUtilities.hpp>
 #include <Utilities.hpp>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
 #include <typeinfo>
 #include <unordered_set>
 #include <variant>
 
+#include "../Benchmarks/ITTNotifySupport.hpp"
 #include "Utilities.hpp"
 
 using std::string_literals::operator""s;
@@ -24,10 +31,43 @@ using boss::Expression;
 namespace boss::engines::LazyTransformation {
 
 // ---------------------------- EXPRESSION EXTRACTION RELATED OPERATIONS START ----------------------------
-Expression Engine::extractOperatorsFromSelect(
-    ComplexExpression&& expr, std::vector<ComplexExpression>& conditionsToMove,
-    std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumnsDependencies,
-    std::unordered_set<Symbol>& usedSymbols) {
+
+// Same result as isConditionMoveable, for an OR operator. It is only moveable if every branch is, where a branch is
+// a pushable predicate or an AND operator of pushable predicates
+static std::vector<bool> isDisjunctionMoveable(const utilities::ExpressionAnnotation& inputAnnotation,
+                                               const ComplexExpression& disjunction,
+                                               const ColumnDictionary& transformationColumns, ColumnSet& usedColumns) {
+  std::vector<bool> result = {!disjunction.getDynamicArguments().empty(), false};
+  for (const auto& branch : disjunction.getDynamicArguments()) {
+    if (!std::holds_alternative<ComplexExpression>(branch)) {
+      return {false, false};
+    }
+    const auto& branchExpr = std::get<ComplexExpression>(branch);
+    std::vector<const ComplexExpression*> predicates = {&branchExpr};
+    if (branchExpr.getHead() == "And"_) {
+      predicates.clear();
+      for (const auto& predicate : branchExpr.getDynamicArguments()) {
+        if (!std::holds_alternative<ComplexExpression>(predicate)) {
+          return {false, false};
+        }
+        predicates.push_back(&std::get<ComplexExpression>(predicate));
+      }
+    }
+    for (const auto* predicate : predicates) {
+      auto predicateResult =
+          utilities::isConditionMoveable(inputAnnotation, *predicate, transformationColumns, usedColumns);
+      if (!predicateResult[0]) {
+        return {false, false};
+      }
+      result[1] = result[1] || predicateResult[1];
+    }
+  }
+  return result;
+}
+
+Expression Engine::extractOperatorsFromSelect(ComplexExpression&& expr, std::vector<ComplexExpression>& conditionsToMove,
+                                              const ColumnDictionary& transformationColumns,
+                                              ColumnSet& usedColumns) const {
   // decomposes the SELECT expression
   auto [selectHead, _, selectDynamics, unused1] = std::move(expr).decompose();
   // gets the WHERE expression
@@ -37,17 +77,26 @@ Expression Engine::extractOperatorsFromSelect(
   // gets the WHERE condition expression
   auto&& conditionExpression = std::get<ComplexExpression>(std::move(whereDynamics[0]));
   // Subprocess the input expression
-  auto processedInput = processExpression(std::move(selectDynamics[0]), transformationColumnsDependencies, usedSymbols);
+  // Conditions extracted from nested SELECT operators are moved before the ones of this operator
+  auto processedInput =
+      processExpression(std::move(selectDynamics[0]), conditionsToMove, transformationColumns, usedColumns);
+  // Annotate the input once, so that every (sub)condition is checked against it without traversing it again
+  auto processedInputAnnotation = utilities::annotateExpression(processedInput, transformationColumns);
+  // Columns of conditions that stay in this operator are read from the transformation as well
+  for (const auto& arg : conditionExpression.getDynamicArguments()) {
+    utilities::getUsedColumnsFromExpressions(arg, transformationColumns, usedColumns);
+  }
 
   // If the condition is a simple single condition
-  if (conditionExpression.getHead() == "Greater"_ || conditionExpression.getHead() == "Equal"_) {
+  if (utilities::isPushablePredicate(conditionExpression.getHead())) {
     // First value represents if the value is extractable. Second is if the condition should be added to inner
     // Union, Intersect, Except, Difference operators
     std::vector<bool> result =
-        utilities::isConditionMoveable(processedInput, conditionExpression, transformationColumnsDependencies, usedSymbols);
+        utilities::isConditionMoveable(processedInputAnnotation, conditionExpression, transformationColumns, usedColumns);
     if (result[0]) {
       if (result[1]) {
-        processedInput = wrapNestedSetOperatorsWithSelect(std::move(processedInput), std::move(conditionExpression));
+        processedInput = wrapNestedSetOperatorsWithSelect(
+            std::move(processedInput), conditionExpression.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
       }
 
       // If the single condition is extractable, then we can remove the whole SELECT operator and return its input
@@ -55,19 +104,21 @@ Expression Engine::extractOperatorsFromSelect(
       return boss::Expression(std::move(processedInput));
     }
   } else if (conditionExpression.getHead() == "And"_) {
-    // You can always extract from the AND operator, unless AND is inside of the OR operator
-    // If you have an OR operator, then you can extract the condition if the condition on that column is present
-    // in all OR branches
+    // Each subcondition of the AND operator is extracted on its own, OR subconditions only as a whole
     auto [andHead, unused4, andDynamics, unused5] = std::move(conditionExpression).decompose();
     boss::ExpressionArguments remainingSubconditions = {};
     // If the condition is a complex condition, we need to check each subcondition
     for (auto& andSubcondition : andDynamics) {
       auto subConditionExpr = std::get<ComplexExpression>(std::move(andSubcondition));
       std::vector<bool> result =
-          utilities::isConditionMoveable(processedInput, subConditionExpr, transformationColumnsDependencies, usedSymbols);
+          subConditionExpr.getHead() == "Or"_
+              ? isDisjunctionMoveable(processedInputAnnotation, subConditionExpr, transformationColumns, usedColumns)
+              : utilities::isConditionMoveable(processedInputAnnotation, subConditionExpr, transformationColumns,
+                                               usedColumns);
       if (result[0]) {
         if (result[1]) {
-          processedInput = wrapNestedSetOperatorsWithSelect(std::move(processedInput), std::move(conditionExpression));
+          processedInput = wrapNestedSetOperatorsWithSelect(
+              std::move(processedInput), subConditionExpr.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
         }
         conditionsToMove.emplace_back(std::move(subConditionExpr));
       } else {
@@ -96,134 +147,17 @@ Expression Engine::extractOperatorsFromSelect(
       }
     }
   } else if (conditionExpression.getHead() == "Or"_) {
-    // If the condition is an OR operator, we need to check if the condition is extractable from each branch
-    auto [orHead, unused6, orDynamics, unused7] = std::move(conditionExpression).decompose();
-    std::vector<std::unordered_set<Symbol>> allOrBranches;
-    bool isFirstBranch = true;
-    for (const auto& orSubcondition : orDynamics) {
-      auto& subConditionExpr = std::get<ComplexExpression>(orSubcondition);
-      std::vector<std::unordered_set<Symbol>> currentBranchConditions = {};
-      if (subConditionExpr.getHead() == "And"_) {
-        for (const auto& andSubcondition : subConditionExpr.getDynamicArguments()) {
-          auto& subConditionExpr = std::get<ComplexExpression>(andSubcondition);
-          std::vector<bool> result = utilities::isConditionMoveable(processedInput, subConditionExpr,
-                                                                    transformationColumnsDependencies, usedSymbols);
-          if (result[0]) {
-            std::unordered_set<Symbol> conditionSymbols = {};
-            utilities::getUsedSymbolsFromExpressions(andSubcondition, conditionSymbols);
-            currentBranchConditions.emplace_back(std::move(conditionSymbols));
-          }
-        }
-      } else if (subConditionExpr.getHead() == "Greater"_ || subConditionExpr.getHead() == "Equal"_) {
-        std::vector<bool> result =
-            utilities::isConditionMoveable(processedInput, subConditionExpr, transformationColumnsDependencies, usedSymbols);
-        if (result[0]) {
-          std::unordered_set<Symbol> conditionSymbols = {};
-          utilities::getUsedSymbolsFromExpressions(orSubcondition, conditionSymbols);
-          currentBranchConditions.emplace_back(std::move(conditionSymbols));
-        }
-      } else {
-        allOrBranches.clear();
-        break;
-      }
-      if (isFirstBranch) {
-        for (auto& condition : currentBranchConditions) {
-          allOrBranches.emplace_back(std::move(condition));
-        }
-        isFirstBranch = false;
-      } else {
-        std::vector<std::unordered_set<Symbol>> newOrBranches = {};
-        for (auto& intersection : allOrBranches) {
-          for (auto& currentBranchCondition : currentBranchConditions) {
-            bool isIntersection = true;
-            for (const auto& symbol : currentBranchCondition) {
-              if (intersection.find(symbol) != intersection.end()) {
-                isIntersection = false;
-              }
-            }
-            if (isIntersection) {
-              newOrBranches.emplace_back(std::move(intersection));
-            }
-          }
-        }
-      }
-    }
-    if (allOrBranches.size() == 0) {
-      // If there are no common conditions in all branches, then we can't extract the condition
-      return boss::Expression(std::move(expr));
-    } else {
-      // If there are common conditions in all branches, we need to extract them
-      boss::ExpressionArguments extractedOrConditions = {};
-      boss::ExpressionArguments remainingOrSubconditions = {};
-      for (auto& orSubcondition : orDynamics) {
-        auto subConditionExpr = std::get<ComplexExpression>(std::move(orSubcondition));
-        if (subConditionExpr.getHead() == "And"_) {
-          auto [andHead, unused8, andDynamics, unused9] = std::move(subConditionExpr).decompose();
-          boss::ExpressionArguments remainingAndSubconditions = {};
-          boss::ExpressionArguments extractedAndConditions = {};
-          for (auto& andSubcondition : andDynamics) {
-            std::unordered_set<Symbol> conditionSymbols = {};
-            utilities::getUsedSymbolsFromExpressions(andSubcondition, conditionSymbols);
-            bool isExtractable = false;
-            for (auto allOrBranch : allOrBranches) {
-              bool allConditions = true;
-              for (const auto& symbol : conditionSymbols) {
-                if (allOrBranch.find(symbol) == allOrBranch.end()) {
-                  allConditions = false;
-                  break;
-                }
-              }
-              if (allConditions) {
-                isExtractable = true;
-                break;
-              }
-            }
-            if (isExtractable) {
-              extractedAndConditions.emplace_back(std::move(andSubcondition));
-            } else {
-              remainingAndSubconditions.emplace_back(std::move(andSubcondition));
-            }
-          }
-          if (extractedAndConditions.size() == 1) {
-            extractedOrConditions.emplace_back(std::move(extractedAndConditions[0]));
-          } else {
-            extractedOrConditions.emplace_back(
-                boss::ComplexExpression(std::move(andHead), {}, std::move(extractedAndConditions), {}));
-          }
-
-          if (remainingAndSubconditions.size() == 1) {
-            remainingOrSubconditions.emplace_back(std::move(remainingAndSubconditions[0]));
-          } else if (remainingAndSubconditions.size() > 1) {
-            remainingOrSubconditions.emplace_back(
-                boss::ComplexExpression("And"_, {}, std::move(remainingAndSubconditions), {}));
-          }
-        } else if (subConditionExpr.getHead() == "Greater"_ || subConditionExpr.getHead() == "Equal"_) {
-          // If the condition is a simple single condition, then it was verified before for extraction (allOrBranches != 0)
-          extractedOrConditions.emplace_back(std::move(subConditionExpr));
-        }
-      }
-      auto newExtractedOr = boss::ComplexExpression(std::move(orHead), {}, std::move(extractedOrConditions), {});
-      conditionsToMove.emplace_back(std::move(newExtractedOr));
-      if (remainingOrSubconditions.size() == 0) {
-        // If all subconditions are extractable, then we can remove the whole SELECT operator and return its input
-        return boss::Expression(std::move(processedInput));
-      } else {
-        if (remainingOrSubconditions.size() == 1) {
-          // If size is one, we don't need to recreate the whole OR operator
-          auto newWhere = boss::ComplexExpression(std::move(whereHead), {},
-                                                  boss::ExpressionArguments(std::move(remainingOrSubconditions[0])), {});
-          auto newSelect = boss::ComplexExpression(
-              std::move(selectHead), {}, boss::ExpressionArguments(std::move(processedInput), std::move(newWhere)), {});
-          return boss::Expression(std::move(newSelect));
-        } else {
-          auto newRemainingOr = boss::ComplexExpression("Or"_, {}, std::move(remainingOrSubconditions), {});
-          auto newWhere =
-              boss::ComplexExpression(std::move(whereHead), {}, boss::ExpressionArguments(std::move(newRemainingOr)), {});
-          auto newSelect = boss::ComplexExpression(
-              std::move(selectHead), {}, boss::ExpressionArguments(std::move(processedInput), std::move(newWhere)), {});
-          return boss::Expression(std::move(newSelect));
-        }
+    // An OR operator can only be extracted as a whole. Extracting some of its branches would drop the rows that
+    // only the other branches select
+    std::vector<bool> result =
+        isDisjunctionMoveable(processedInputAnnotation, conditionExpression, transformationColumns, usedColumns);
+    if (result[0]) {
+      if (result[1]) {
+        processedInput = wrapNestedSetOperatorsWithSelect(
+            std::move(processedInput), conditionExpression.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
       }
+      conditionsToMove.emplace_back(std::move(conditionExpression));
+      return boss::Expression(std::move(processedInput));
     }
   }
   // Compose and return the original expression in case if the condition is not extractable
@@ -275,15 +209,21 @@ Expression wrapNestedSetOperatorsWithSelect(Expression&& expr, ComplexExpression
 
 ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& expression,
                                                                  ComplexExpression&& extractedExpression,
-                                                                 const std::unordered_set<Symbol>& extractedExprSymbols) {
+                                                                 const std::unordered_set<Symbol>& extractedExprSymbols,
+                                                                 boss::ExpressionArguments* trace) {
   if (std::holds_alternative<ComplexExpression>(expression)) {
     auto transformingExpression = std::get<ComplexExpression>(std::move(expression));
+    // Why the condition is not pushed further, reported in the trace if it stops at this operator
+    Symbol stopReason = "UnsupportedOperator"_;
     if (transformingExpression.getHead() == "Select"_) {
       // Push through the SELECT operator
+      if (trace != nullptr) {
+        trace->emplace_back("Select"_);
+      }
       auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
       auto selectInput = std::move(dynamics[0]);
       auto newSelectInput = moveExctractedSelectExpressionToTransformation(
-          std::move(selectInput), std::move(extractedExpression), extractedExprSymbols);
+          std::move(selectInput), std::move(extractedExpression), extractedExprSymbols, trace);
       auto newTransformingExpression =
           boss::ComplexExpression(std::move(head), std::move(statics),
                                   boss::ExpressionArguments(std::move(newSelectInput), std::move(dynamics[1])), {});
@@ -292,22 +232,35 @@ ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& ex
     } else if (transformingExpression.getHead() == "Project"_) {
       // Push through the PROJECT operator if the condition can be moved through the projection
       if (utilities::canMoveConditionThroughProjection(transformingExpression, extractedExpression, extractedExprSymbols)) {
+        // The condition is on the output columns of the projection, so it is rewritten on its input columns
+        auto rewrittenExpression =
+            utilities::rewriteConditionThroughProjection(transformingExpression, std::move(extractedExpression));
+        std::unordered_set<Symbol> rewrittenExprSymbols = {};
+        for (const auto& arg : rewrittenExpression.getDynamicArguments()) {
+          utilities::getUsedSymbolsFromExpressions(arg, rewrittenExprSymbols);
+        }
+        if (trace != nullptr) {
+          trace->emplace_back("Project"_);
+        }
         auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
         auto projectInput = std::move(dynamics[0]);
-        // TODO: Need to modify the projection function and the extractedExpression
         auto newProjectInput = moveExctractedSelectExpressionToTransformation(
-            std::move(projectInput), std::move(extractedExpression), extractedExprSymbols);
+            std::move(projectInput), std::move(rewrittenExpression), rewrittenExprSymbols, trace);
         return boss::ComplexExpression(std::move(head), std::move(statics),
                                        boss::ExpressionArguments(std::move(newProjectInput), std::move(dynamics[1])),
                                        std::move(spans));
       }
+      stopReason = "ConditionOnComputedColumns"_;
     } else if (transformingExpression.getHead() == "Sort"_ || transformingExpression.getHead() == "SortBy"_ ||
                transformingExpression.getHead() == "Order"_ || transformingExpression.getHead() == "OrderBy"_) {
       // Can safely push through Sort and Order as filtering rows doesn't change the order
+      if (trace != nullptr) {
+        trace->emplace_back(transformingExpression.getHead());
+      }
       auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
       auto expressionInput = std::move(dynamics[0]);
       auto newExpressionInput = moveExctractedSelectExpressionToTransformation(
-          std::move(expressionInput), std::move(extractedExpression), extractedExprSymbols);
+          std::move(expressionInput), std::move(extractedExpression), extractedExprSymbols, trace);
       return boss::ComplexExpression(std::move(head), std::move(statics),
                                      boss::ExpressionArguments(std::move(newExpressionInput), std::move(dynamics[1])),
                                      std::move(spans));
@@ -318,12 +271,19 @@ ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& ex
       // future Am not fully sure on the naming between Except and Difference, so I include both
       auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
       ExpressionArguments newArguments = {};
+      // The condition is traced separately through every input
+      ExpressionArguments inputTraces = {};
       // Need to push to all inputs of the expressions
       for (auto& arg : dynamics) {
+        ExpressionArguments inputTrace = {};
         // Need to clone the extracted expression as it will be consumed by each input
         newArguments.emplace_back(moveExctractedSelectExpressionToTransformation(
             std::move(arg), std::move(extractedExpression.clone(expressions::CloneReason::EXPRESSION_WRAPPING)),
-            extractedExprSymbols));
+            extractedExprSymbols, trace != nullptr ? &inputTrace : nullptr));
+        inputTraces.emplace_back(boss::ComplexExpression("List"_, {}, std::move(inputTrace), {}));
+      }
+      if (trace != nullptr) {
+        trace->emplace_back(boss::ComplexExpression(head, {}, std::move(inputTraces), {}));
       }
       return boss::ComplexExpression(std::move(head), std::move(statics), std::move(newArguments), std::move(spans));
     } else if (transformingExpression.getHead() == "Group"_ || transformingExpression.getHead() == "GroupBy"_) {
@@ -334,18 +294,38 @@ ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& ex
       if (std::get<ComplexExpression>(groupByExpression).getHead() == "By"_) {
         std::unordered_set<Symbol> groupingColumns = {};
         utilities::getUsedSymbolsFromExpressions(groupByExpression, groupingColumns);
+        // Grouping columns can be renamed by the As of the Group. Aggregated columns are defined by a function
+        std::unordered_map<Symbol, const Expression*> definitions = {};
+        if (constDynamics.size() == 3) {
+          definitions = utilities::getColumnDefinitions(std::get<ComplexExpression>(constDynamics[2]));
+        }
         bool canPushThrough = true;
         for (const auto& symbol : extractedExprSymbols) {
-          if (groupingColumns.find(symbol) == groupingColumns.end()) {
+          auto definition = definitions.find(symbol);
+          bool isGroupingColumn =
+              definition == definitions.end()
+                  ? groupingColumns.find(symbol) != groupingColumns.end()
+                  : std::holds_alternative<Symbol>(*definition->second) &&
+                        groupingColumns.find(std::get<Symbol>(*definition->second)) != groupingColumns.end();
+          if (!isGroupingColumn) {
             canPushThrough = false;
             break;
           }
         }
         if (canPushThrough) {
+          // The condition is on the output names of the grouping columns, so it is rewritten on the input names
+          auto renamedExpression = utilities::substituteColumnDefinitions(std::move(extractedExpression), definitions);
+          std::unordered_set<Symbol> renamedExprSymbols = {};
+          for (const auto& arg : renamedExpression.getDynamicArguments()) {
+            utilities::getUsedSymbolsFromExpressions(arg, renamedExprSymbols);
+          }
+          if (trace != nullptr) {
+            trace->emplace_back(transformingExpression.getHead());
+          }
           auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
           auto expressionInput = std::move(dynamics[0]);
           auto newExpressionInput = moveExctractedSelectExpressionToTransformation(
-              std::move(expressionInput), std::move(extractedExpression), extractedExprSymbols);
+              std::move(expressionInput), std::move(renamedExpression), renamedExprSymbols, trace);
           ExpressionArguments newGroupByArguments = {};
           newGroupByArguments.emplace_back(std::move(newExpressionInput));
           newGroupByArguments.emplace_back(std::move(dynamics[1]));
@@ -355,6 +335,9 @@ ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& ex
           return boss::ComplexExpression(std::move(head), std::move(statics), std::move(newGroupByArguments),
                                          std::move(spans));
         }
+        stopReason = "ConditionOnAggregatedColumns"_;
+      } else {
+        stopReason = "NoGroupingColumns"_;
       }
       // If cannot move through the Group operator, drop to the base case to wrap it with the SELECT operator
     } else if (transformingExpression.getHead() == "Join"_) {
@@ -398,31 +381,61 @@ ComplexExpression moveExctractedSelectExpressionToTransformation(Expression&& ex
 
       // Check that they are not both true or both false (both true should not possible for valid input)
       if (canPushThrough1 != canPushThrough2) {
+        size_t pushedInput = canPushThrough1 ? 0 : 1;
+        // Columns that are equal in the join condition have the same values in every joined row. If every column
+        // of the condition has such an equivalent in the other input, the condition is duplicated onto it, so both
+        // inputs are filtered before the join
+        auto equivalentColumns = utilities::getEquivalentJoinColumns(std::get<ComplexExpression>(constDynamics[2]),
+                                                                     canPushThrough1 ? joinInput2Columns : joinInput1Columns);
+        bool canTransfer = std::all_of(
+            extractedExprSymbols.begin(), extractedExprSymbols.end(),
+            [&equivalentColumns](const Symbol& symbol) { return equivalentColumns.find(symbol) != equivalentColumns.end(); });
+        std::vector<ComplexExpression> transferredExpression = {};
+        std::unordered_set<Symbol> transferredExprSymbols = {};
+        if (canTransfer) {
+          transferredExpression.emplace_back(utilities::substituteColumnDefinitions(
+              extractedExpression.clone(expressions::CloneReason::EXPRESSION_WRAPPING), equivalentColumns));
+          for (const auto& arg : transferredExpression[0].getDynamicArguments()) {
+            utilities::getUsedSymbolsFromExpressions(arg, transferredExprSymbols);
+          }
+        }
+
+        // The condition is traced separately through both inputs, the one it is not on stays empty unless the
+        // condition is transferred to it
+        std::vector<ExpressionArguments> inputTraces(2);
         auto [head, statics, dynamics, spans] = std::move(transformingExpression).decompose();
-        if (canPushThrough1) {
-          auto newJoinInput1 = moveExctractedSelectExpressionToTransformation(
-              std::move(dynamics[0]), std::move(extractedExpression), extractedExprSymbols);
-          return boss::ComplexExpression(
-              std::move(head), std::move(statics),
-              boss::ExpressionArguments(std::move(newJoinInput1), std::move(dynamics[1]), std::move(dynamics[2])),
-              std::move(spans));
-        } else if (canPushThrough2) {
-          auto newJoinInput2 = moveExctractedSelectExpressionToTransformation(
-              std::move(dynamics[1]), std::move(extractedExpression), extractedExprSymbols);
-          return boss::ComplexExpression(
-              std::move(head), std::move(statics),
-              boss::ExpressionArguments(std::move(dynamics[0]), std::move(newJoinInput2), std::move(dynamics[2])),
-              std::move(spans));
+        dynamics[pushedInput] = moveExctractedSelectExpressionToTransformation(
+            std::move(dynamics[pushedInput]), std::move(extractedExpression), extractedExprSymbols,
+            trace != nullptr ? &inputTraces[pushedInput] : nullptr);
+        if (canTransfer) {
+          dynamics[1 - pushedInput] = moveExctractedSelectExpressionToTransformation(
+              std::move(dynamics[1 - pushedInput]), std::move(transferredExpression[0]), transferredExprSymbols,
+              trace != nullptr ? &inputTraces[1 - pushedInput] : nullptr);
         }
+        if (trace != nullptr) {
+          trace->emplace_back("Join"_(boss::ComplexExpression("List"_, {}, std::move(inputTraces[0]), {}),
+                                      boss::ComplexExpression("List"_, {}, std::move(inputTraces[1]), {})));
+        }
+        return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
       }
+      stopReason = "ConditionOnBothJoinInputs"_;
       // If cannot move through the Join operator, drop to the base case to wrap it with the SELECT operator
     }
+    if (transformingExpression.getHead() == "Table"_) {
+      stopReason = "ReachedInput"_;
+    }
+    if (trace != nullptr) {
+      trace->emplace_back("StoppedAt"_(transformingExpression.getHead(), stopReason));
+    }
     // Encapsulate the transformingExpression into the new select
     auto newWhere = boss::ComplexExpression("Where"_, {}, boss::ExpressionArguments(std::move(extractedExpression)), {});
     auto newSelect = boss::ComplexExpression(
         "Select"_, {}, boss::ExpressionArguments(std::move(transformingExpression), std::move(newWhere)), {});
     return std::move(newSelect);
   } else {
+    if (trace != nullptr) {
+      trace->emplace_back("StoppedAt"_(expression.clone(expressions::CloneReason::EXPRESSION_WRAPPING), "ReachedInput"_));
+    }
     auto newWhere = boss::ComplexExpression("Where"_, {}, boss::ExpressionArguments(std::move(extractedExpression)), {});
     auto newSelect =
         boss::ComplexExpression("Select"_, {}, boss::ExpressionArguments(std::move(expression), std::move(newWhere)), {});
@@ -500,178 +513,2000 @@ Expression replaceTransformSymbolsWithQuery(Expression&& expr, Expression&& tran
 
 // ---------------------------- EXPRESSION PROPAGATION RELATED OPERATIONS END ----------------------------
 
-Expression Engine::processExpression(
-    Expression&& inputExpr, std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumnsDependencies,
-    std::unordered_set<Symbol>& usedSymbols) {
-  return std::visit(
-      boss::utilities::overload(
-          [this, &transformationColumnsDependencies, &usedSymbols](ComplexExpression&& complexExpr) -> Expression {
-            if (complexExpr.getHead() == "Transformation"_) {
-              return boss::Expression(std::move(complexExpr));
-            } else if (complexExpr.getHead() == "Select"_) {
-              std::vector<ComplexExpression> extractedExpressions = {};
-              auto expression = extractOperatorsFromSelect(std::move(complexExpr), extractedExpressions,
-                                                           transformationColumnsDependencies, usedSymbols);
-              for (auto& extractedExpr : extractedExpressions) {
-                std::unordered_set<Symbol> extractedExprSymbols = {};
-                for (const auto& arg : extractedExpr.getDynamicArguments()) {
-                  utilities::getUsedSymbolsFromExpressions(arg, extractedExprSymbols);
-                }
-                currentTransformationQuery = std::move(moveExctractedSelectExpressionToTransformation(
-                    std::move(currentTransformationQuery), std::move(extractedExpr), extractedExprSymbols));
-              }
-              return std::move(expression);
-            } else if (complexExpr.getHead() == "Project"_) {
-              auto [head, _, dynamics, unused] = std::move(complexExpr).decompose();
-              // Process Project's input expression
-              auto& projectionInputExpr = dynamics[0];
-              auto updatedInput = processExpression(std::move(std::move(projectionInputExpr)),
-                                                    transformationColumnsDependencies, usedSymbols);
+// ---------------------------- GROUP COLLAPSING RELATED OPERATIONS START ----------------------------
 
-              // Extract used symbols from the projection function
-              auto& projectionAsExpr = std::get<ComplexExpression>(dynamics[1]);
-              for (const auto& arg : projectionAsExpr.getDynamicArguments()) {
-                utilities::getUsedSymbolsFromExpressions(arg, usedSymbols);
-              }
-              // Compose and return the original expression
-              boss::ExpressionArguments&& remainingSubconditions = {};
-              remainingSubconditions.emplace_back(std::move(updatedInput));
-              remainingSubconditions.emplace_back(boss::Expression(std::move(projectionAsExpr)));
-              ComplexExpression resultExpr = boss::ComplexExpression(head, {}, {std::move(remainingSubconditions)}, {});
-              return boss::Expression(std::move(resultExpr));
-            }
+// Sets the aggregate that computes an outer aggregate of an inner aggregate directly from the input of the inner
+// group. E.g. the Sum of per group Counts is the Count of the whole group
+static bool getCollapsedAggregate(const Symbol& outerAggregate, const Symbol& innerAggregate, Symbol& collapsedAggregate) {
+  if ((outerAggregate == "Sum"_ && (innerAggregate == "Sum"_ || innerAggregate == "Count"_)) ||
+      ((outerAggregate == "Max"_ || outerAggregate == "Min"_) && innerAggregate == outerAggregate)) {
+    collapsedAggregate = innerAggregate;
+    return true;
+  }
+  return false;
+}
 
-            auto [head, statics, dynamics, spans] = std::move(complexExpr).decompose();
-            // Recursively process sub-expressions
-            std::transform(std::make_move_iterator(dynamics.begin()), std::make_move_iterator(dynamics.end()),
-                           dynamics.begin(), [&](auto&& subExpr) {
-                             return processExpression(std::forward<decltype(subExpr)>(subExpr),
-                                                      transformationColumnsDependencies, usedSymbols);
-                           });
-            return boss::ComplexExpression(head, std::move(statics), std::move(dynamics), std::move(spans));
-          },
-          [this, transformationColumnsDependencies, &usedSymbols](Symbol&& symbol) -> Expression {
-            if (symbol == "Transformation"_) {
-              return boss::Expression(std::move(symbol));
-            }
-            if (utilities::isInTransformationColumns(transformationColumnsDependencies, symbol)) {
-              usedSymbols.insert(symbol);
-            }
-            return boss::Expression(std::move(symbol));
-          },
-          [](auto&& otherExpr) -> Expression { return std::forward<decltype(otherExpr)>(otherExpr); }),
-      std::move(inputExpr));
+static bool isGroupOperator(const Expression& expr) {
+  return std::holds_alternative<ComplexExpression>(expr) && (std::get<ComplexExpression>(expr).getHead() == "Group"_ ||
+                                                             std::get<ComplexExpression>(expr).getHead() == "GroupBy"_);
 }
 
-Expression Engine::evaluate(Expression&& expr) {
-  return std::visit(
-      boss::utilities::overload(
-          [this](ComplexExpression&& infoExpr) -> Expression {
-            auto [head, statics, dynamics, spans] = std::move(infoExpr).decompose();
-            if (head == "ApplyTransformation"_) {
-              if (transformationQueries.size() == 0) {
-                return "Error"_("No transformations added");
-              }
-              int index = 0;
-              if (dynamics.size() == 2) {
-                index = std::get<int>(std::move(dynamics[1]));
-                if (index >= transformationQueries.size() || index < 0) {
-                  return "Error"_("Transformation index out of bounds"_);
-                }
-              }
-              currentTransformationQuery =
-                  std::move(transformationQueries[index].clone(expressions::CloneReason::EXPRESSION_WRAPPING));
-              auto currentUntouchableColumns = transformationsUntouchableColumns[index];
-              auto currentColumnDependencies = transformationsColumnDependencies[index];
+// Fuses Group(Group(input, By(inner keys), As(...)), By(outer keys), As(...)) into a single Group over the input, if
+// the outer keys are a subset of the inner keys and every outer aggregate is decomposable over the inner one.
+// A Select between the groups is kept if it only filters on the inner keys, as it then removes whole groups.
+// Returns the group unchanged if it can't be collapsed
+static ComplexExpression collapseGroup(ComplexExpression&& outerGroup) {
+  const auto& outerDynamics = outerGroup.getDynamicArguments();
+  bool hasOuterBy = outerDynamics.size() == 3;
+  if ((outerDynamics.size() != 2 && !hasOuterBy) ||
+      std::get<ComplexExpression>(outerDynamics[outerDynamics.size() - 1]).getHead() != "As"_) {
+    return std::move(outerGroup);
+  }
+  const ComplexExpression* intermediateSelect = nullptr;
+  const Expression* innerExpression = &outerDynamics[0];
+  if (std::holds_alternative<ComplexExpression>(*innerExpression) &&
+      std::get<ComplexExpression>(*innerExpression).getHead() == "Select"_) {
+    intermediateSelect = &std::get<ComplexExpression>(*innerExpression);
+    innerExpression = &intermediateSelect->getDynamicArguments()[0];
+  }
+  if (!isGroupOperator(*innerExpression)) {
+    return std::move(outerGroup);
+  }
+  const auto& innerDynamics = std::get<ComplexExpression>(*innerExpression).getDynamicArguments();
+  if (innerDynamics.size() != 3 || std::get<ComplexExpression>(innerDynamics[1]).getHead() != "By"_ ||
+      std::get<ComplexExpression>(innerDynamics[2]).getHead() != "As"_) {
+    return std::move(outerGroup);
+  }
+
+  std::unordered_set<Symbol> innerKeys = {};
+  utilities::getUsedSymbolsFromExpressions(innerDynamics[1], innerKeys);
+  auto isInnerKey = [&innerKeys](const Symbol& symbol) { return innerKeys.find(symbol) != innerKeys.end(); };
+  if (hasOuterBy) {
+    for (const auto& key : std::get<ComplexExpression>(outerDynamics[1]).getDynamicArguments()) {
+      if (!std::holds_alternative<Symbol>(key) || !isInnerKey(std::get<Symbol>(key))) {
+        return std::move(outerGroup);
+      }
+    }
+  }
+  if (intermediateSelect != nullptr) {
+    std::unordered_set<Symbol> filterColumns = {};
+    utilities::getUsedSymbolsFromExpressions(intermediateSelect->getDynamicArguments()[1], filterColumns);
+    if (!std::all_of(filterColumns.begin(), filterColumns.end(), isInnerKey)) {
+      return std::move(outerGroup);
+    }
+  }
+
+  auto innerDefinitions = utilities::getColumnDefinitions(std::get<ComplexExpression>(innerDynamics[2]));
+  const auto& outerAsDynamics = std::get<ComplexExpression>(outerDynamics[outerDynamics.size() - 1]).getDynamicArguments();
+  boss::ExpressionArguments collapsedAsArguments = {};
+  for (size_t i = 0; i + 1 < outerAsDynamics.size(); i += 2) {
+    if (!std::holds_alternative<ComplexExpression>(outerAsDynamics[i + 1])) {
+      return std::move(outerGroup);
+    }
+    const auto& outerAggregate = std::get<ComplexExpression>(outerAsDynamics[i + 1]);
+    if (outerAggregate.getDynamicArguments().size() != 1 ||
+        !std::holds_alternative<Symbol>(outerAggregate.getDynamicArguments()[0])) {
+      return std::move(outerGroup);
+    }
+    const auto& aggregatedColumn = std::get<Symbol>(outerAggregate.getDynamicArguments()[0]);
+    auto innerDefinition = innerDefinitions.find(aggregatedColumn);
+    Symbol collapsedAggregate = outerAggregate.getHead();
+    if (innerDefinition != innerDefinitions.end()) {
+      if (!std::holds_alternative<ComplexExpression>(*innerDefinition->second)) {
+        return std::move(outerGroup);
+      }
+      const auto& innerAggregate = std::get<ComplexExpression>(*innerDefinition->second);
+      if (innerAggregate.getDynamicArguments().size() != 1 ||
+          !getCollapsedAggregate(outerAggregate.getHead(), innerAggregate.getHead(), collapsedAggregate)) {
+        return std::move(outerGroup);
+      }
+      collapsedAsArguments.emplace_back(outerAsDynamics[i].clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+      collapsedAsArguments.emplace_back(innerAggregate.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    } else if (isInnerKey(aggregatedColumn) && (collapsedAggregate == "Max"_ || collapsedAggregate == "Min"_)) {
+      // Max and Min of a key are the same over the groups as over their rows, unlike Sum and Count
+      collapsedAsArguments.emplace_back(outerAsDynamics[i].clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+      collapsedAsArguments.emplace_back(outerAggregate.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    } else {
+      return std::move(outerGroup);
+    }
+  }
 
-              ComplexExpression complexExpr = std::get<ComplexExpression>(std::move(dynamics[0]));
-              std::unordered_set<Symbol> usedSymbols = {};
+  auto [outerHead, outerStatics, outerGroupDynamics, outerSpans] = std::move(outerGroup).decompose();
+  Expression innerGroup = std::move(outerGroupDynamics[0]);
+  ExpressionArguments intermediateWhere = {};
+  if (intermediateSelect != nullptr) {
+    auto [selectHead, selectStatics, selectDynamics, selectSpans] =
+        std::get<ComplexExpression>(std::move(innerGroup)).decompose();
+    innerGroup = std::move(selectDynamics[0]);
+    intermediateWhere.emplace_back(std::move(selectDynamics[1]));
+  }
+  auto [innerHead, innerStatics, innerGroupDynamics, innerSpans] =
+      std::get<ComplexExpression>(std::move(innerGroup)).decompose();
+  Expression collapsedInput = std::move(innerGroupDynamics[0]);
+  if (!intermediateWhere.empty()) {
+    collapsedInput = utilities::mergeConsecutiveSelectOperators(boss::ComplexExpression(
+        "Select"_, {}, boss::ExpressionArguments(std::move(collapsedInput), std::move(intermediateWhere[0])), {}));
+  }
 
-              Expression result = processExpression(std::move(complexExpr), currentColumnDependencies, usedSymbols);
-              auto allUsedSymbols = utilities::getAllDependentSymbols(currentColumnDependencies, usedSymbols);
-              currentTransformationQuery = std::move(removeUnusedTransformationColumns(
-                  std::move(currentTransformationQuery), allUsedSymbols, currentUntouchableColumns));
+  ExpressionArguments collapsedArguments = {};
+  collapsedArguments.emplace_back(std::move(collapsedInput));
+  if (hasOuterBy) {
+    collapsedArguments.emplace_back(std::move(outerGroupDynamics[1]));
+  }
+  collapsedArguments.emplace_back(boss::ComplexExpression("As"_, {}, std::move(collapsedAsArguments), {}));
+  return boss::ComplexExpression(std::move(outerHead), std::move(outerStatics), std::move(collapsedArguments),
+                                 std::move(outerSpans));
+}
 
-              result = replaceTransformSymbolsWithQuery(std::move(result), std::move(currentTransformationQuery));
+// Collapses stacked groups bottom-up, so that a stack of more than two groups collapses into one
+Expression collapseStackedGroups(Expression&& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::move(expr);
+  }
+  auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+  for (auto& arg : dynamics) {
+    arg = collapseStackedGroups(std::move(arg));
+  }
+  auto result = boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  if (result.getHead() == "Group"_ || result.getHead() == "GroupBy"_) {
+    return collapseGroup(std::move(result));
+  }
+  return std::move(result);
+}
 
-              return std::move(result);
-            } else if (head == "AddTransformation"_) {
-              ComplexExpression transformationQuery = std::get<ComplexExpression>(std::move(dynamics[0]));
-              std::unordered_map<Symbol, std::unordered_set<Symbol>> dependencyColumns = {};
-              std::unordered_set<Symbol> untouchableColumns = {};
+// ---------------------------- GROUP COLLAPSING RELATED OPERATIONS END ----------------------------
 
-              utilities::buildColumnDependencies(transformationQuery, dependencyColumns, untouchableColumns);
+// ---------------------------- PROJECTION FUSION RELATED OPERATIONS START ----------------------------
 
-              transformationQueries.emplace_back(std::move(transformationQuery));
-              transformationsUntouchableColumns.emplace_back(std::move(untouchableColumns));
-              transformationsColumnDependencies.emplace_back(std::move(dependencyColumns));
+static void countColumnReferences(const Expression& expr, std::unordered_map<Symbol, size_t>& references) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    references[std::get<Symbol>(expr)]++;
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    for (const auto& arg : std::get<ComplexExpression>(expr).getDynamicArguments()) {
+      countColumnReferences(arg, references);
+    }
+  }
+}
 
-              return "Transformation added successfully"_;
-            } else if (head == "GetTransformation"_) {
-              if (transformationQueries.size() == 0) {
-                return "Error"_("No transformations added"_);
-              }
-              int index = 0;
-              if (dynamics.size() == 1) {
-                index = std::get<int>(std::move(dynamics[0]));
-                if (index >= transformationQueries.size()) {
-                  return "Error"_("Transformation index out of bounds"_);
-                }
-              }
-              return transformationQueries[index].clone(expressions::CloneReason::EXPRESSION_WRAPPING);
-            } else if (head == "RemoveTransformation"_) {
-              if (transformationQueries.size() == 0) {
-                return "Transformation removed successfully"_;
-              }
-              int index = 0;
-              if (dynamics.size() == 1) {
-                index = std::get<int>(std::move(dynamics[0]));
-                if (index >= transformationQueries.size()) {
-                  return "Error"_("Transformation index out of bounds"_);
-                }
-              }
+// Fuses Project(Project(input, As(inner)), As(outer)) into Project(input, As(outer with the inner definitions
+// substituted)), so that the inner columns are never materialised. Inner pass-through columns disappear with the
+// inner projection. Only done if the outer projection reads nothing but inner columns, and computed inner columns
+// are used at most once, so that fusing never computes a value twice (which would undo eliminateCommonSubexpressions).
+// Returns the projection unchanged otherwise
+static ComplexExpression fuseProjection(ComplexExpression&& outerProject) {
+  const auto& outerDynamics = outerProject.getDynamicArguments();
+  if (outerDynamics.size() != 2 || !std::holds_alternative<ComplexExpression>(outerDynamics[0]) ||
+      std::get<ComplexExpression>(outerDynamics[0]).getHead() != "Project"_) {
+    return std::move(outerProject);
+  }
+  const auto& innerDynamics = std::get<ComplexExpression>(outerDynamics[0]).getDynamicArguments();
+  if (innerDynamics.size() != 2) {
+    return std::move(outerProject);
+  }
+  const auto& innerAs = std::get<ComplexExpression>(innerDynamics[1]);
+  const auto& outerAsDynamics = std::get<ComplexExpression>(outerDynamics[1]).getDynamicArguments();
 
-              if (index >= transformationQueries.size() || index < 0) {
-                return "Error"_("Transformation index out of bounds"_);
-              }
-              transformationQueries.erase(transformationQueries.begin() + index);
-              transformationsUntouchableColumns.erase(transformationsUntouchableColumns.begin() + index);
-              transformationsColumnDependencies.erase(transformationsColumnDependencies.begin() + index);
+  std::unordered_map<Symbol, const Expression*> innerColumns = {};
+  const auto& innerAsDynamics = innerAs.getDynamicArguments();
+  for (size_t i = 0; i + 1 < innerAsDynamics.size(); i += 2) {
+    innerColumns.emplace(std::get<Symbol>(innerAsDynamics[i]), &innerAsDynamics[i + 1]);
+  }
+  std::unordered_map<Symbol, size_t> references = {};
+  for (size_t i = 1; i < outerAsDynamics.size(); i += 2) {
+    countColumnReferences(outerAsDynamics[i], references);
+  }
+  for (const auto& [column, count] : references) {
+    auto innerColumn = innerColumns.find(column);
+    if (innerColumn == innerColumns.end() ||
+        (count > 1 && !std::holds_alternative<Symbol>(*innerColumn->second) &&
+         !utilities::isStaticValue(*innerColumn->second))) {
+      return std::move(outerProject);
+    }
+  }
 
-              return "Transformation removed successfully"_;
-            } else if (head == "RemoveAllTransformations"_) {
-              transformationQueries.clear();
-              transformationsUntouchableColumns.clear();
-              transformationsColumnDependencies.clear();
+  auto innerDefinitions = utilities::getColumnDefinitions(innerAs);
+  ExpressionArguments fusedAsArguments = {};
+  for (size_t i = 0; i + 1 < outerAsDynamics.size(); i += 2) {
+    fusedAsArguments.emplace_back(outerAsDynamics[i].clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    const auto& definition = outerAsDynamics[i + 1];
+    if (std::holds_alternative<Symbol>(definition)) {
+      fusedAsArguments.emplace_back(
+          innerColumns[std::get<Symbol>(definition)]->clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    } else if (std::holds_alternative<ComplexExpression>(definition)) {
+      fusedAsArguments.emplace_back(utilities::substituteColumnDefinitions(
+          std::get<ComplexExpression>(definition).clone(expressions::CloneReason::EXPRESSION_WRAPPING),
+          innerDefinitions));
+    } else {
+      fusedAsArguments.emplace_back(definition.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+  }
 
-              return "All transformations removed successfully"_;
-            } else if (head == "GetLazyTransformationEngineCapabilities"_) {
-              return "List"_("ApplyTransformation"_, "AddTransformation"_, "GetTransformation"_, "RemoveTransformation"_,
-                             "RemoveAllTransformations"_);
-            }
-            std::transform(std::make_move_iterator(dynamics.begin()), std::make_move_iterator(dynamics.end()),
-                           dynamics.begin(), [this](auto&& arg) { return evaluate(std::forward<decltype(arg)>(arg)); });
-            return boss::ComplexExpression(std::move(head), {}, std::move(dynamics), std::move(spans));
-          },
-          [this](Symbol&& symbol) -> Expression { return std::move(symbol); },
-          [](auto&& otherExpr) -> Expression { return std::forward<decltype(otherExpr)>(otherExpr); }),
-      std::move(expr));
+  auto [outerHead, outerStatics, outerProjectDynamics, outerSpans] = std::move(outerProject).decompose();
+  auto [innerHead, innerStatics, innerProjectDynamics, innerSpans] =
+      std::get<ComplexExpression>(std::move(outerProjectDynamics[0])).decompose();
+  return boss::ComplexExpression(
+      std::move(outerHead), std::move(outerStatics),
+      boss::ExpressionArguments(std::move(innerProjectDynamics[0]),
+                                boss::ComplexExpression("As"_, {}, std::move(fusedAsArguments), {})),
+      std::move(outerSpans));
 }
-}  // namespace boss::engines::LazyTransformation
 
-static auto& enginePtr(bool initialise = true) {
-  static auto engine = std::unique_ptr<boss::engines::LazyTransformation::Engine>();
-  if (!engine && initialise) {
-    engine.reset(new boss::engines::LazyTransformation::Engine());
+// Fuses chains of projections bottom-up, so that any number of consecutive projections becomes one
+Expression fuseConsecutiveProjections(Expression&& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::move(expr);
   }
-  return engine;
+  auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+  for (auto& arg : dynamics) {
+    arg = fuseConsecutiveProjections(std::move(arg));
+  }
+  auto result = boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  if (result.getHead() == "Project"_) {
+    return fuseProjection(std::move(result));
+  }
+  return std::move(result);
 }
 
-extern "C" BOSSExpression* evaluate(BOSSExpression* e) {
-  static std::mutex m;
-  std::lock_guard lock(m);
-  auto* r = new BOSSExpression{enginePtr()->evaluate(std::move(e->delegate))};
+// ---------------------------- PROJECTION FUSION RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- COMMON SUBEXPRESSION ELIMINATION RELATED OPERATIONS START ----------------------------
+
+// Computed values that are worth sharing. Dates and parameters are literals
+static bool isComputedExpression(const Expression& expr) {
+  return std::holds_alternative<ComplexExpression>(expr) && !utilities::isStaticValue(expr) &&
+         std::get<ComplexExpression>(expr).getSpanArguments().empty();
+}
+
+struct SubexpressionOccurrences {
+  const Expression* expression;
+  size_t count;
+  size_t size;
+};
+
+// Adds every computed subexpression of expr to the occurrences, grouped by their structural hash. Returns the number
+// of nodes of expr
+static size_t countSubexpressions(const Expression& expr,
+                                  std::unordered_map<size_t, std::vector<SubexpressionOccurrences>>& occurrences) {
+  if (!isComputedExpression(expr)) {
+    return 1;
+  }
+  size_t size = 1;
+  for (const auto& arg : std::get<ComplexExpression>(expr).getDynamicArguments()) {
+    size += countSubexpressions(arg, occurrences);
+  }
+  auto& candidates = occurrences[utilities::hashExpression(expr)];
+  auto candidate = std::find_if(candidates.begin(), candidates.end(), [&expr](const SubexpressionOccurrences& other) {
+    return *other.expression == expr;
+  });
+  if (candidate == candidates.end()) {
+    candidates.push_back({&expr, 1, size});
+  } else {
+    candidate->count++;
+  }
+  return size;
+}
+
+static Expression replaceSubexpression(Expression&& expr, const Expression& subexpression, const Symbol& column) {
+  if (!isComputedExpression(expr)) {
+    return std::move(expr);
+  }
+  if (expr == subexpression) {
+    return column;
+  }
+  auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+  for (auto& arg : dynamics) {
+    arg = replaceSubexpression(std::move(arg), subexpression, column);
+  }
+  return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+}
+
+// Adds the columns read by expr to the As arguments as pass-through columns, in the order they are read
+static void addPassedColumns(const Expression& expr, std::unordered_set<Symbol>& passedColumns,
+                             ExpressionArguments& asArguments) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    if (passedColumns.insert(std::get<Symbol>(expr)).second) {
+      asArguments.emplace_back(std::get<Symbol>(expr));
+      asArguments.emplace_back(std::get<Symbol>(expr));
+    }
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    for (const auto& arg : std::get<ComplexExpression>(expr).getDynamicArguments()) {
+      addPassedColumns(arg, passedColumns, asArguments);
+    }
+  }
+}
+
+// Hoists the subexpressions that are computed more than once by the projection into a projection below it, which
+// computes each of them once as a new column. The largest shared subexpression is hoisted first, so that its own
+// subexpressions are not hoisted separately. Returns the projection unchanged if nothing is shared
+static ComplexExpression eliminateCommonSubexpressions(ComplexExpression&& project, size_t& nextColumnIndex,
+                                                       const std::unordered_set<Symbol>& usedSymbols) {
+  auto [head, statics, dynamics, spans] = std::move(project).decompose();
+  auto [asHead, asStatics, asDynamics, asSpans] = std::get<ComplexExpression>(std::move(dynamics[1])).decompose();
+  ExpressionArguments hoistedArguments = {};
+  while (true) {
+    std::unordered_map<size_t, std::vector<SubexpressionOccurrences>> occurrences = {};
+    for (size_t i = 1; i < asDynamics.size(); i += 2) {
+      countSubexpressions(asDynamics[i], occurrences);
+    }
+    const SubexpressionOccurrences* largestShared = nullptr;
+    for (const auto& [hash, candidates] : occurrences) {
+      for (const auto& candidate : candidates) {
+        if (candidate.count > 1 && (largestShared == nullptr || candidate.size > largestShared->size)) {
+          largestShared = &candidate;
+        }
+      }
+    }
+    if (largestShared == nullptr) {
+      break;
+    }
+    auto column = Symbol("__cse" + std::to_string(nextColumnIndex++));
+    while (usedSymbols.find(column) != usedSymbols.end()) {
+      column = Symbol("__cse" + std::to_string(nextColumnIndex++));
+    }
+    auto sharedExpression = largestShared->expression->clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+    for (size_t i = 1; i < asDynamics.size(); i += 2) {
+      asDynamics[i] = replaceSubexpression(std::move(asDynamics[i]), sharedExpression, column);
+    }
+    hoistedArguments.emplace_back(column);
+    hoistedArguments.emplace_back(std::move(sharedExpression));
+  }
+  if (hoistedArguments.empty()) {
+    dynamics[1] = boss::ComplexExpression(std::move(asHead), std::move(asStatics), std::move(asDynamics),
+                                          std::move(asSpans));
+    return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  }
+
+  // The hoisting projection passes through the input columns that the projection still reads. The hoisted columns
+  // are already in it
+  std::unordered_set<Symbol> hoistedColumns = {};
+  for (size_t i = 0; i < hoistedArguments.size(); i += 2) {
+    hoistedColumns.insert(std::get<Symbol>(hoistedArguments[i]));
+  }
+  for (size_t i = 1; i < asDynamics.size(); i += 2) {
+    addPassedColumns(asDynamics[i], hoistedColumns, hoistedArguments);
+  }
+  auto hoistingProject = boss::ComplexExpression(
+      "Project"_, {},
+      boss::ExpressionArguments(std::move(dynamics[0]),
+                                boss::ComplexExpression("As"_, {}, std::move(hoistedArguments), {})),
+      {});
+  return boss::ComplexExpression(
+      std::move(head), std::move(statics),
+      boss::ExpressionArguments(std::move(hoistingProject), boss::ComplexExpression(std::move(asHead), std::move(asStatics),
+                                                                                    std::move(asDynamics),
+                                                                                    std::move(asSpans))),
+      std::move(spans));
+}
+
+static Expression eliminateCommonSubexpressions(Expression&& expr, size_t& nextColumnIndex,
+                                                const std::unordered_set<Symbol>& usedSymbols) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::move(expr);
+  }
+  auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+  for (auto& arg : dynamics) {
+    arg = eliminateCommonSubexpressions(std::move(arg), nextColumnIndex, usedSymbols);
+  }
+  auto result = boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  if (result.getHead() == "Project"_ && result.getDynamicArguments().size() == 2) {
+    return eliminateCommonSubexpressions(std::move(result), nextColumnIndex, usedSymbols);
+  }
+  return std::move(result);
+}
+
+// Shared subexpressions are hoisted into new __cse columns, numbered across the whole transformation so that they are
+// unique. Numbers whose name is already used by the transformation are skipped. The new columns that are not needed
+// by a query are removed by the column pruning like any other column
+Expression eliminateCommonSubexpressions(Expression&& expr) {
+  std::unordered_set<Symbol> usedSymbols = {};
+  utilities::getUsedSymbolsFromExpressions(expr, usedSymbols);
+  size_t nextColumnIndex = 0;
+  return eliminateCommonSubexpressions(std::move(expr), nextColumnIndex, usedSymbols);
+}
+
+// ---------------------------- COMMON SUBEXPRESSION ELIMINATION RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- LIMIT PUSHDOWN RELATED OPERATIONS START ----------------------------
+
+// Returns the Select of Limit(Select(Project(...), Where(condition)), n) if its condition can be moved through the
+// projection together with the limit, or nullptr
+static const ComplexExpression* getSelectOverProjection(const Expression& limitInput) {
+  if (!std::holds_alternative<ComplexExpression>(limitInput)) {
+    return nullptr;
+  }
+  const auto& select = std::get<ComplexExpression>(limitInput);
+  const auto& selectDynamics = select.getDynamicArguments();
+  if (select.getHead() != "Select"_ || selectDynamics.size() != 2 ||
+      !std::holds_alternative<ComplexExpression>(selectDynamics[0]) ||
+      !std::holds_alternative<ComplexExpression>(selectDynamics[1])) {
+    return nullptr;
+  }
+  const auto& project = std::get<ComplexExpression>(selectDynamics[0]);
+  const auto& where = std::get<ComplexExpression>(selectDynamics[1]);
+  if (project.getHead() != "Project"_ || project.getDynamicArguments().size() != 2 || where.getHead() != "Where"_ ||
+      where.getDynamicArguments().size() != 1 ||
+      !std::holds_alternative<ComplexExpression>(where.getDynamicArguments()[0]) ||
+      !utilities::canMoveConditionThroughProjection(project,
+                                                    std::get<ComplexExpression>(where.getDynamicArguments()[0]))) {
+    return nullptr;
+  }
+  return &select;
+}
+
+// Turns Select(Project(input, As(...)), Where(c)) into Project(Select(input, Where(c')), As(...)), where c' is c
+// rewritten on the input columns of the projection
+static ComplexExpression moveSelectBelowProjection(ComplexExpression&& select) {
+  auto [selectHead, selectStatics, selectDynamics, selectSpans] = std::move(select).decompose();
+  auto [whereHead, whereStatics, whereDynamics, whereSpans] =
+      std::get<ComplexExpression>(std::move(selectDynamics[1])).decompose();
+  auto condition = utilities::rewriteConditionThroughProjection(std::get<ComplexExpression>(selectDynamics[0]),
+                                                                std::get<ComplexExpression>(std::move(whereDynamics[0])));
+  auto [projectHead, projectStatics, projectDynamics, projectSpans] =
+      std::get<ComplexExpression>(std::move(selectDynamics[0])).decompose();
+  whereDynamics[0] = std::move(condition);
+  selectDynamics[0] = std::move(projectDynamics[0]);
+  selectDynamics[1] = boss::ComplexExpression(std::move(whereHead), std::move(whereStatics), std::move(whereDynamics),
+                                              std::move(whereSpans));
+  projectDynamics[0] = boss::ComplexExpression(std::move(selectHead), std::move(selectStatics),
+                                               std::move(selectDynamics), std::move(selectSpans));
+  return boss::ComplexExpression(std::move(projectHead), std::move(projectStatics), std::move(projectDynamics),
+                                 std::move(projectSpans));
+}
+
+// Pushes Top(Project(input, As(...)), By(keys), n) and Limit(Project(input, As(...)), n) below the projection, as
+// a projection computes every row independently and keeps their order. A Top is only pushed if all of its keys are
+// passed through or renamed by the projection, so that they can be ordered on before it. A Select directly below the
+// limit is pushed together with it, i.e. Limit(Select(Project(input, As(...)), Where(c)), n) becomes
+// Project(Limit(Select(input, Where(c')), n), As(...)), where c' is c rewritten on the input columns. Limits are not
+// pushed below a Select on its own, or below Group, Join or Sort, as those change which rows come first
+static ComplexExpression pushDownLimit(ComplexExpression&& limit) {
+  const auto& limitDynamics = limit.getDynamicArguments();
+  bool isTop = limit.getHead() == "Top"_;
+  if (limitDynamics.empty() || (isTop && (limitDynamics.size() != 3 ||
+                                          !std::holds_alternative<ComplexExpression>(limitDynamics[1])))) {
+    return std::move(limit);
+  }
+  const auto* selectOverProjection = getSelectOverProjection(limitDynamics[0]);
+  const auto& projectCandidate =
+      selectOverProjection != nullptr ? selectOverProjection->getDynamicArguments()[0] : limitDynamics[0];
+  if (!std::holds_alternative<ComplexExpression>(projectCandidate) ||
+      std::get<ComplexExpression>(projectCandidate).getHead() != "Project"_ ||
+      std::get<ComplexExpression>(projectCandidate).getDynamicArguments().size() != 2) {
+    return std::move(limit);
+  }
+  const auto& projectAs = std::get<ComplexExpression>(std::get<ComplexExpression>(projectCandidate).getDynamicArguments()[1]);
+
+  ExpressionArguments inputKeys = {};
+  if (isTop) {
+    std::unordered_map<Symbol, const Expression*> projectedColumns = {};
+    const auto& asDynamics = projectAs.getDynamicArguments();
+    for (size_t i = 0; i + 1 < asDynamics.size(); i += 2) {
+      projectedColumns.emplace(std::get<Symbol>(asDynamics[i]), &asDynamics[i + 1]);
+    }
+    for (const auto& key : std::get<ComplexExpression>(limitDynamics[1]).getDynamicArguments()) {
+      if (!std::holds_alternative<Symbol>(key)) {
+        return std::move(limit);
+      }
+      const auto& keyColumn = std::get<Symbol>(key);
+      if (keyColumn == "desc"_ || keyColumn == "asc"_) {
+        // Sort directions follow their key
+        inputKeys.emplace_back(keyColumn);
+        continue;
+      }
+      auto definition = projectedColumns.find(keyColumn);
+      if (definition == projectedColumns.end() || !std::holds_alternative<Symbol>(*definition->second)) {
+        return std::move(limit);
+      }
+      inputKeys.emplace_back(std::get<Symbol>(*definition->second));
+    }
+  }
+
+  auto [limitHead, limitStatics, dynamics, limitSpans] = std::move(limit).decompose();
+  if (selectOverProjection != nullptr) {
+    dynamics[0] = moveSelectBelowProjection(std::get<ComplexExpression>(std::move(dynamics[0])));
+  }
+  auto [projectHead, projectStatics, projectDynamics, projectSpans] =
+      std::get<ComplexExpression>(std::move(dynamics[0])).decompose();
+  dynamics[0] = std::move(projectDynamics[0]);
+  if (isTop) {
+    auto [byHead, byStatics, unused1, unused2] = std::get<ComplexExpression>(std::move(dynamics[1])).decompose();
+    dynamics[1] = boss::ComplexExpression(std::move(byHead), std::move(byStatics), std::move(inputKeys), {});
+  }
+  // Keep pushing in case the input is another projection
+  projectDynamics[0] = pushDownLimit(
+      boss::ComplexExpression(std::move(limitHead), std::move(limitStatics), std::move(dynamics), std::move(limitSpans)));
+  return boss::ComplexExpression(std::move(projectHead), std::move(projectStatics), std::move(projectDynamics),
+                                 std::move(projectSpans));
+}
+
+Expression pushDownLimits(Expression&& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::move(expr);
+  }
+  auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+  for (auto& arg : dynamics) {
+    arg = pushDownLimits(std::move(arg));
+  }
+  auto result = boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  if (result.getHead() == "Top"_ || result.getHead() == "Limit"_) {
+    return pushDownLimit(std::move(result));
+  }
+  return std::move(result);
+}
+
+// ---------------------------- LIMIT PUSHDOWN RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- TRANSFORMATION PLAN RELATED OPERATIONS START ----------------------------
+
+std::shared_ptr<const TransformationPlan> compileTransformationPlan(ComplexExpression&& transformationQuery,
+                                                                   HybridOptions&& hybridOptions,
+                                                                   utilities::ColumnSample&& sample) {
+  // Projection chains are fused first, so that values shared across the chain are found in a single projection.
+  // Only the compiled copy is optimised, the registered query is kept as it is
+  auto originalQuery = transformationQuery.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+  auto optimisedQuery =
+      eliminateCommonSubexpressions(fuseConsecutiveProjections(boss::Expression(std::move(transformationQuery))));
+  auto plan = std::make_shared<TransformationPlan>(
+      TransformationPlan{std::get<ComplexExpression>(std::move(optimisedQuery)), std::move(originalQuery), {}, {}, {}, {},
+                         {}, std::move(hybridOptions), std::move(sample)});
+  utilities::buildColumnDependencies(plan->query, plan->columnDependencies, plan->untouchableColumns);
+  for (const auto& [column, unused] : plan->columnDependencies) {
+    plan->columns.intern(column);
+  }
+  // Symbols that are not interned, e.g. tables, are not columns. Inserting NOT_A_COLUMN would grow the sets to 2^32 bits
+  for (const auto& column : plan->untouchableColumns) {
+    uint32_t id = plan->columns.find(column);
+    if (id != NOT_A_COLUMN) {
+      plan->untouchableColumnSet.insert(id);
+    }
+  }
+  // Resolve the dependency closure of every column once, so applying the transformation only has to merge them
+  plan->columnDependencyClosures.reserve(plan->columns.size());
+  for (uint32_t id = 0; id < plan->columns.size(); ++id) {
+    ColumnSet closure(plan->columns.size());
+    for (const auto& symbol :
+         utilities::getAllDependentSymbols(plan->columnDependencies, {plan->columns.getSymbol(id)})) {
+      uint32_t dependencyId = plan->columns.find(symbol);
+      if (dependencyId != NOT_A_COLUMN) {
+        closure.insert(dependencyId);
+      }
+    }
+    plan->columnDependencyClosures.emplace_back(std::move(closure));
+  }
+  return plan;
+}
+
+// Builds the transformation query that is handed to the next engine from the shared plan. Works as a clone
+// combined with removeUnusedTransformationColumns, except that the removed columns are never copied at all
+ComplexExpression instantiateTransformationPlan(const ComplexExpression& planQuery, const ColumnDictionary& columns,
+                                                const ColumnSet& keptColumns) {
+  const auto& dynamics = planQuery.getDynamicArguments();
+  ExpressionArguments newArguments = {};
+  newArguments.reserve(dynamics.size());
+  if (planQuery.getHead() == "As"_) {
+    for (size_t i = 0; i + 1 < dynamics.size(); i += 2) {
+      const auto& column = std::get<Symbol>(dynamics[i]);
+      if (keptColumns.contains(columns.find(column))) {
+        newArguments.emplace_back(column);
+        newArguments.emplace_back(dynamics[i + 1].clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+      }
+    }
+    return boss::ComplexExpression(planQuery.getHead(), {}, std::move(newArguments), {});
+  }
+  if (!planQuery.getSpanArguments().empty()) {
+    // Data nodes (e.g. tables passed by value) cannot contain projections, so they are copied as they are
+    return planQuery.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+  }
+  for (const auto& arg : dynamics) {
+    if (std::holds_alternative<ComplexExpression>(arg)) {
+      newArguments.emplace_back(
+          instantiateTransformationPlan(std::get<ComplexExpression>(arg), columns, keptColumns));
+    } else {
+      newArguments.emplace_back(arg.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+  }
+  return boss::ComplexExpression(planQuery.getHead(), {}, std::move(newArguments), {});
+}
+
+// ---------------------------- TRANSFORMATION PLAN RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- REWRITE CACHE RELATED OPERATIONS START ----------------------------
+
+// Replaces every literal of the expression with a Parameter slot, moving the literal into parameters. The shape of
+// the expression (heads, symbols and literal types) is appended to shapeKey, so that queries only differing in their
+// literals get the same key. Dates and data passed in spans are treated as a single literal
+Expression parameteriseExpression(Expression&& expr, boss::ExpressionArguments& parameters, std::string& shapeKey) {
+  auto addParameter = [&parameters, &shapeKey](Expression&& literal, char typeTag) -> Expression {
+    shapeKey += typeTag;
+    shapeKey += ',';
+    auto slot = static_cast<int32_t>(parameters.size());
+    parameters.emplace_back(std::move(literal));
+    return "Parameter"_(slot);
+  };
+  if (std::holds_alternative<ComplexExpression>(expr)) {
+    auto& complexExpr = std::get<ComplexExpression>(expr);
+    if (complexExpr.getHead() == "DateObject"_) {
+      return addParameter(std::move(expr), 'D');
+    }
+    if (!complexExpr.getSpanArguments().empty()) {
+      return addParameter(std::move(expr), 'S');
+    }
+    auto [head, statics, dynamics, spans] = std::move(complexExpr).decompose();
+    shapeKey += head.getName();
+    shapeKey += '(';
+    for (auto& arg : dynamics) {
+      arg = parameteriseExpression(std::move(arg), parameters, shapeKey);
+    }
+    shapeKey += ')';
+    return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  } else if (std::holds_alternative<Symbol>(expr)) {
+    shapeKey += '$';
+    shapeKey += std::get<Symbol>(expr).getName();
+    shapeKey += ',';
+    return std::move(expr);
+  } else if (std::holds_alternative<bool>(expr)) {
+    return addParameter(std::move(expr), 'b');
+  } else if (std::holds_alternative<int32_t>(expr)) {
+    return addParameter(std::move(expr), 'i');
+  } else if (std::holds_alternative<int64_t>(expr)) {
+    return addParameter(std::move(expr), 'l');
+  } else if (std::holds_alternative<float>(expr)) {
+    return addParameter(std::move(expr), 'f');
+  } else if (std::holds_alternative<double>(expr)) {
+    return addParameter(std::move(expr), 'd');
+  } else if (std::holds_alternative<std::string>(expr)) {
+    return addParameter(std::move(expr), 's');
+  }
+  // Numbers that are not treated as static by the rewrite (e.g. int8_t) stay in place and are part of the key, with
+  // their type. Any other value is moved into a parameter as the literals above
+  return std::visit(
+      [&expr, &shapeKey, &addParameter](const auto& value) -> Expression {
+        using Value = std::decay_t<decltype(value)>;
+        if constexpr (std::is_arithmetic_v<Value>) {
+          shapeKey += '#';
+          shapeKey += std::to_string(expr.index());
+          shapeKey += ':';
+          shapeKey += std::to_string(value);
+          shapeKey += ',';
+          return std::move(expr);
+        } else {
+          return addParameter(std::move(expr), '?');
+        }
+      },
+      expr);
+}
+
+// Replaces the Parameter slots of a rewritten expression with the literals of the current query. A slot can appear
+// more than once, as the rewrite may copy conditions (e.g. into every input of a Union)
+Expression bindParameters(Expression&& expr, const boss::ExpressionArguments& parameters) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::move(expr);
+  }
+  auto& complexExpr = std::get<ComplexExpression>(expr);
+  if (complexExpr.getHead() == "Parameter"_) {
+    return parameters[std::get<int32_t>(complexExpr.getDynamicArguments()[0])].clone(
+        expressions::CloneReason::EXPRESSION_WRAPPING);
+  }
+  auto [head, statics, dynamics, spans] = std::move(complexExpr).decompose();
+  for (auto& arg : dynamics) {
+    arg = bindParameters(std::move(arg), parameters);
+  }
+  return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+}
+
+// Number of Parameter slots a prepared query needs to be bound with, i.e. the highest slot plus one. Returns -1 if a
+// slot is not a non-negative int
+int32_t countParameters(const Expression& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return 0;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  if (complexExpr.getHead() == "Parameter"_) {
+    if (dynamics.size() != 1 || !std::holds_alternative<int32_t>(dynamics[0]) || std::get<int32_t>(dynamics[0]) < 0) {
+      return -1;
+    }
+    return std::get<int32_t>(dynamics[0]) + 1;
+  }
+  int32_t parameterCount = 0;
+  for (const auto& arg : dynamics) {
+    auto argParameterCount = countParameters(arg);
+    if (argParameterCount < 0) {
+      return -1;
+    }
+    parameterCount = std::max(parameterCount, argParameterCount);
+  }
+  return parameterCount;
+}
+
+// Handle of a PreparedTransformation(handle) expression. Returns nothing for any other expression
+static std::optional<int64_t> getPreparedHandle(const Expression& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return std::nullopt;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  if (complexExpr.getHead() != "PreparedTransformation"_ || dynamics.size() != 1) {
+    return std::nullopt;
+  }
+  if (std::holds_alternative<int64_t>(dynamics[0])) {
+    return std::get<int64_t>(dynamics[0]);
+  }
+  if (std::holds_alternative<int32_t>(dynamics[0])) {
+    return std::get<int32_t>(dynamics[0]);
+  }
+  return std::nullopt;
+}
+
+void Engine::clearRewriteCache() {
+  std::unique_lock lock(rewriteCacheMutex);
+  rewriteCache.clear();
+}
+
+// ---------------------------- REWRITE CACHE RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- RESULT CACHE RELATED OPERATIONS START ----------------------------
+
+static int64_t getSteadyClockTime() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+CachedTransformationResult::CachedTransformationResult(int transformationIndex, ComplexExpression&& predicate,
+                                                       const Symbol& column, Expression&& result)
+    : transformationIndex(transformationIndex),
+      predicate(std::move(predicate)),
+      column(column),
+      result(std::move(result)),
+      bytes(0),
+      lastUsed(getSteadyClockTime()) {
+  // Read from the stored predicate, so that the literals of the range stay valid as long as the result is cached
+  std::unordered_map<Symbol, utilities::ColumnRange> ranges = {};
+  utilities::addColumnRanges(this->predicate, ranges);
+  range = ranges[column];
+  for (auto& resultColumn : utilities::getOutputColumns(this->result)) {
+    resultColumns.insert(std::move(resultColumn));
+  }
+  bytes = utilities::estimateExpressionBytes(this->result);
+}
+
+static utilities::ColumnRange getRequestedRange(const std::vector<ComplexExpression>& extractedConditions,
+                                                const Symbol& column) {
+  std::unordered_map<Symbol, utilities::ColumnRange> requestedRanges = {};
+  for (const auto& condition : extractedConditions) {
+    utilities::addColumnRanges(condition, requestedRanges);
+  }
+  auto requestedRange = requestedRanges.find(column);
+  return requestedRange == requestedRanges.end() ? utilities::ColumnRange() : requestedRange->second;
+}
+
+// Picks the cached result to read the requested rows from. It must have all the output columns of the pruned
+// transformation and the columns of the conditions, and its range has to overlap the requested one. A result
+// covering the whole requested range is preferred, as the transformation doesn't have to run at all then
+const CachedTransformationResult* findCachedResult(
+    const std::vector<std::shared_ptr<const CachedTransformationResult>>& cachedResults,
+    const std::vector<ComplexExpression>& extractedConditions, const std::vector<Symbol>& outputColumns) {
+  if (outputColumns.empty()) {
+    return nullptr;
+  }
+  std::unordered_set<Symbol> conditionColumns = {};
+  for (const auto& condition : extractedConditions) {
+    for (const auto& arg : condition.getDynamicArguments()) {
+      utilities::getUsedSymbolsFromExpressions(arg, conditionColumns);
+    }
+  }
+  const CachedTransformationResult* overlappingResult = nullptr;
+  for (const auto& cachedResult : cachedResults) {
+    auto isResultColumn = [&cachedResult](const Symbol& column) {
+      return cachedResult->resultColumns.find(column) != cachedResult->resultColumns.end();
+    };
+    if (!std::all_of(outputColumns.begin(), outputColumns.end(), isResultColumn) ||
+        !std::all_of(conditionColumns.begin(), conditionColumns.end(), isResultColumn)) {
+      continue;
+    }
+    auto requestedRange = getRequestedRange(extractedConditions, cachedResult->column);
+    if (!utilities::rangesOverlap(requestedRange, cachedResult->range)) {
+      continue;
+    }
+    if (!utilities::extendsBelow(requestedRange, cachedResult->range) &&
+        !utilities::extendsAbove(requestedRange, cachedResult->range)) {
+      return cachedResult.get();
+    }
+    if (overlappingResult == nullptr) {
+      overlappingResult = cachedResult.get();
+    }
+  }
+  return overlappingResult;
+}
+
+// Condition selecting the requested rows that are outside of the range of the cached result. Empty if the cached
+// result covers all of them. The bounds are copied from the predicate of the cached result, so they keep its types
+std::vector<ComplexExpression> getUncoveredConditions(const CachedTransformationResult& cachedResult,
+                                                      const std::vector<ComplexExpression>& extractedConditions) {
+  auto requestedRange = getRequestedRange(extractedConditions, cachedResult.column);
+  const auto& cachedRange = cachedResult.range;
+  boss::ExpressionArguments uncoveredRanges = {};
+  if (utilities::extendsBelow(requestedRange, cachedRange)) {
+    uncoveredRanges.emplace_back(boss::ComplexExpression(
+        cachedRange.lowInclusive ? "Less"_ : "LessEqual"_, {},
+        boss::ExpressionArguments(cachedResult.column,
+                                  cachedRange.lowLiteral->clone(expressions::CloneReason::EXPRESSION_WRAPPING)),
+        {}));
+  }
+  if (utilities::extendsAbove(requestedRange, cachedRange)) {
+    uncoveredRanges.emplace_back(boss::ComplexExpression(
+        cachedRange.highInclusive ? "Greater"_ : "GreaterEqual"_, {},
+        boss::ExpressionArguments(cachedResult.column,
+                                  cachedRange.highLiteral->clone(expressions::CloneReason::EXPRESSION_WRAPPING)),
+        {}));
+  }
+  std::vector<ComplexExpression> uncoveredConditions = {};
+  if (uncoveredRanges.size() == 1) {
+    uncoveredConditions.emplace_back(std::get<ComplexExpression>(std::move(uncoveredRanges[0])));
+  } else if (uncoveredRanges.size() == 2) {
+    uncoveredConditions.emplace_back(boss::ComplexExpression("Or"_, {}, std::move(uncoveredRanges), {}));
+  }
+  return uncoveredConditions;
+}
+
+// Projects the rows onto the columns, unless they already have exactly these columns
+static Expression projectOutputColumns(Expression&& rows, const std::vector<Symbol>& outputColumns) {
+  if (utilities::getOutputColumns(rows) == outputColumns) {
+    return std::move(rows);
+  }
+  boss::ExpressionArguments asArguments = {};
+  for (const auto& column : outputColumns) {
+    asArguments.emplace_back(column);
+    asArguments.emplace_back(column);
+  }
+  return boss::ComplexExpression(
+      "Project"_, {},
+      boss::ExpressionArguments(std::move(rows), boss::ComplexExpression("As"_, {}, std::move(asArguments), {})), {});
+}
+
+// Reads the requested rows from the cached result: the extracted conditions are applied to it and it is projected
+// onto the output columns of the pruned transformation, so that it can be combined with the transformed rows
+Expression readCachedResult(const CachedTransformationResult& cachedResult,
+                            const std::vector<ComplexExpression>& extractedConditions,
+                            const std::vector<Symbol>& outputColumns) {
+  Expression cachedRows = cachedResult.result.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+  if (!extractedConditions.empty()) {
+    boss::ExpressionArguments conditions = {};
+    for (const auto& condition : extractedConditions) {
+      conditions.emplace_back(condition.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+    auto condition = conditions.size() == 1 ? std::get<ComplexExpression>(std::move(conditions[0]))
+                                            : boss::ComplexExpression("And"_, {}, std::move(conditions), {});
+    cachedRows = utilities::wrapOperatorWithSelect(std::move(cachedRows), std::move(condition));
+  }
+  return projectOutputColumns(std::move(cachedRows), outputColumns);
+}
+
+Expression Engine::cacheTransformationResult(ComplexExpression&& predicate, Expression&& result, int index,
+                                             const uint64_t* expectedTransformationsVersion) {
+  std::unordered_map<Symbol, utilities::ColumnRange> ranges = {};
+  if (!utilities::addColumnRanges(predicate, ranges) || ranges.size() > 1) {
+    return "Error"_("Cached results must be selected by a range of a single column"_);
+  }
+  // A predicate without ranges, i.e. And(), selects all the rows, so any column has an unbounded range
+  auto columns = ranges.empty() ? utilities::getOutputColumns(result) : std::vector<Symbol>{ranges.begin()->first};
+  if (columns.empty()) {
+    return "Error"_("Cached results must be selected by a range of a single column"_);
+  }
+  const Symbol& column = columns[0];
+  auto cachedResult =
+      std::make_shared<const CachedTransformationResult>(index, std::move(predicate), column, std::move(result));
+
+  std::shared_lock transformationsLock(transformationsMutex);
+  if (index >= transformations.size() || index < 0) {
+    return "Error"_("Transformation index out of bounds"_);
+  }
+  if (expectedTransformationsVersion != nullptr && *expectedTransformationsVersion != transformationsVersion) {
+    return "Error"_("Transformations changed while the result was computed"_);
+  }
+  std::unique_lock lock(resultCacheMutex);
+  if (cachedResult->bytes > resultCacheBudget) {
+    return "Error"_("Transformation result exceeds the result cache budget"_);
+  }
+  // Results of ranges inside of the new range are never picked over it, so they are dropped
+  for (auto it = resultCache.begin(); it != resultCache.end();) {
+    const auto& otherResult = *it;
+    if (otherResult->transformationIndex == cachedResult->transformationIndex &&
+        otherResult->column == cachedResult->column && otherResult->resultColumns == cachedResult->resultColumns &&
+        !utilities::extendsBelow(otherResult->range, cachedResult->range) &&
+        !utilities::extendsAbove(otherResult->range, cachedResult->range)) {
+      resultCacheBytes -= otherResult->bytes;
+      it = resultCache.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  resultCacheBytes += cachedResult->bytes;
+  resultCache.emplace_back(std::move(cachedResult));
+  evictCachedResults();
+  return "Transformation result cached successfully"_;
+}
+
+void Engine::evictCachedResults() {
+  while (resultCacheBytes > resultCacheBudget && !resultCache.empty()) {
+    auto leastRecentlyUsed = std::min_element(
+        resultCache.begin(), resultCache.end(),
+        [](const std::shared_ptr<const CachedTransformationResult>& first,
+           const std::shared_ptr<const CachedTransformationResult>& second) {
+          return first->lastUsed.load() < second->lastUsed.load();
+        });
+    resultCacheBytes -= (*leastRecentlyUsed)->bytes;
+    resultCache.erase(leastRecentlyUsed);
+  }
+}
+
+void Engine::clearResultCache() {
+  std::unique_lock lock(resultCacheMutex);
+  resultCache.clear();
+  resultCacheBytes = 0;
+}
+
+// ---------------------------- RESULT CACHE RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- HYBRID MATERIALISATION RELATED OPERATIONS START ----------------------------
+
+// Reads the Hybrid(List(engine libraries...)[, cpu budget]) option of AddTransformation
+static bool parseHybridOptions(const ComplexExpression& option, HybridOptions& hybridOptions) {
+  const auto& dynamics = option.getDynamicArguments();
+  if (option.getHead() != "Hybrid"_ || dynamics.empty() || dynamics.size() > 2 ||
+      !std::holds_alternative<ComplexExpression>(dynamics[0]) ||
+      std::get<ComplexExpression>(dynamics[0]).getHead() != "List"_) {
+    return false;
+  }
+  for (const auto& library : std::get<ComplexExpression>(dynamics[0]).getDynamicArguments()) {
+    if (!std::holds_alternative<std::string>(library)) {
+      return false;
+    }
+    hybridOptions.engineLibraries.emplace_back(std::get<std::string>(library));
+  }
+  if (dynamics.size() == 2 && (!utilities::getNumericLiteral(dynamics[1], hybridOptions.cpuBudget) ||
+                               hybridOptions.cpuBudget <= 0 || hybridOptions.cpuBudget > 1)) {
+    return false;
+  }
+  hybridOptions.isHybrid = true;
+  return true;
+}
+
+// Counts a request of the range selected by the conditions extracted from a query. Only conditions that select a
+// range of a single column are tracked, as only those can be cached
+void Engine::trackRequestedRange(int index, std::vector<ComplexExpression>&& requestedConditions) {
+  std::unordered_map<Symbol, utilities::ColumnRange> ranges = {};
+  for (const auto& condition : requestedConditions) {
+    if (!utilities::addColumnRanges(condition, ranges)) {
+      return;
+    }
+  }
+  if (ranges.size() != 1) {
+    return;
+  }
+  boss::ExpressionArguments conditions = {};
+  for (auto& condition : requestedConditions) {
+    conditions.emplace_back(std::move(condition));
+  }
+  Expression predicate = conditions.size() == 1 ? std::move(conditions[0])
+                                                : boss::ComplexExpression("And"_, {}, std::move(conditions), {});
+  size_t predicateHash = utilities::hashExpression(predicate);
+
+  std::lock_guard lock(trackedRangesMutex);
+  for (auto& trackedRange : trackedRanges) {
+    if (trackedRange.transformationIndex == index && trackedRange.predicateHash == predicateHash &&
+        trackedRange.predicate == predicate) {
+      trackedRange.requests++;
+      return;
+    }
+  }
+  if (trackedRanges.size() < MAX_TRACKED_RANGES) {
+    trackedRanges.emplace_back(TrackedRange{index, std::move(predicate), predicateHash, 1, false});
+  }
+}
+
+std::chrono::nanoseconds Engine::materialiseHottestRange() {
+  int index = 0;
+  std::vector<Expression> predicate = {};
+  {
+    std::lock_guard lock(trackedRangesMutex);
+    TrackedRange* hottestRange = nullptr;
+    for (auto& trackedRange : trackedRanges) {
+      if (!trackedRange.isMaterialised && trackedRange.requests >= MIN_HOT_RANGE_REQUESTS &&
+          (hottestRange == nullptr || trackedRange.requests > hottestRange->requests)) {
+        hottestRange = &trackedRange;
+      }
+    }
+    if (hottestRange == nullptr) {
+      return std::chrono::nanoseconds(0);
+    }
+    // Claimed before materialising, so that a range is only materialised once even if it fails
+    hottestRange->isMaterialised = true;
+    index = hottestRange->transformationIndex;
+    predicate.emplace_back(hottestRange->predicate.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+  }
+
+  std::shared_ptr<const TransformationPlan> plan;
+  uint64_t version = 0;
+  {
+    std::shared_lock lock(transformationsMutex);
+    if (index >= transformations.size()) {
+      return std::chrono::nanoseconds(0);
+    }
+    plan = transformations[index];
+    version = transformationsVersion;
+  }
+  // All the output columns are materialised, so that the result can serve any query on the range
+  auto outputColumns = utilities::getOutputColumns(plan->query);
+  if (outputColumns.empty()) {
+    return std::chrono::nanoseconds(0);
+  }
+  boss::ExpressionArguments asArguments = {};
+  for (const auto& column : outputColumns) {
+    asArguments.emplace_back(column);
+    asArguments.emplace_back(column);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto rangeQuery = boss::ComplexExpression(
+      "Project"_, {},
+      boss::ExpressionArguments(
+          utilities::wrapOperatorWithSelect("Transformation"_,
+                                            std::get<ComplexExpression>(
+                                                predicate[0].clone(expressions::CloneReason::EXPRESSION_WRAPPING))),
+          boss::ComplexExpression("As"_, {}, std::move(asArguments), {})),
+      {});
+  boss::ExpressionArguments engineLibraries = {};
+  for (const auto& library : plan->hybridOptions.engineLibraries) {
+    engineLibraries.emplace_back(library);
+  }
+  auto result = boss::evaluate(
+      "EvaluateInEngines"_(boss::ComplexExpression("List"_, {}, std::move(engineLibraries), {}),
+                           applyTransformation(std::move(rangeQuery), *plan)));
+  bool isError = std::holds_alternative<ComplexExpression>(result) &&
+                 std::get<ComplexExpression>(result).getHead() == "Error"_;
+  if (!isError) {
+    auto cacheResult = cacheTransformationResult(std::get<ComplexExpression>(std::move(predicate[0])),
+                                                 std::move(result), index, &version);
+    if (cacheResult == "Transformation result cached successfully"_) {
+      materialisedRanges++;
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  materialisationNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  // Pausing for (1 - budget) / budget of the time spent keeps the thread busy for the budget share of the time
+  double pauseFactor = (1 - plan->hybridOptions.cpuBudget) / plan->hybridOptions.cpuBudget;
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed * pauseFactor);
+}
+
+void Engine::runMaterialisation() {
+  std::unique_lock lock(materialisationMutex);
+  while (!stopMaterialisation) {
+    materialisationWakeUp.wait_for(lock, MATERIALISATION_IDLE_DELAY);
+    auto idleTime = std::chrono::steady_clock::duration(getSteadyClockTime() - lastApplicationTime.load());
+    if (stopMaterialisation || idleTime < MATERIALISATION_IDLE_DELAY) {
+      continue;
+    }
+    lock.unlock();
+    auto pause = materialiseHottestRange();
+    lock.lock();
+    if (pause.count() > 0) {
+      materialisationWakeUp.wait_for(lock, pause, [this]() { return stopMaterialisation; });
+    }
+  }
+}
+
+void Engine::clearTrackedRanges() {
+  std::lock_guard lock(trackedRangesMutex);
+  trackedRanges.clear();
+}
+
+Engine::~Engine() {
+  {
+    std::lock_guard lock(materialisationMutex);
+    stopMaterialisation = true;
+  }
+  materialisationWakeUp.notify_all();
+  if (materialisationThread.joinable()) {
+    materialisationThread.join();
+  }
+}
+
+// ---------------------------- HYBRID MATERIALISATION RELATED OPERATIONS END ----------------------------
+
+// ---------------------------- REWRITE STATISTICS RELATED OPERATIONS START ----------------------------
+
+// Without WITH_ITT_NOTIFY the tasks are no-ops
+static const VTuneAPIInterface vtune{"LazyTransformation"};
+
+void RewriteStatistics::reset() {
+  for (size_t phase = 0; phase < REWRITE_PHASE_COUNT; ++phase) {
+    phaseNanoseconds[phase] = 0;
+    phaseCalls[phase] = 0;
+  }
+  rewrites = 0;
+  queryNodes = 0;
+  planNodes = 0;
+  clonedNodes = 0;
+  allocatedBytes = 0;
+}
+
+namespace {
+// Adds the time until it is destroyed to a phase of the statistics, and marks it as an ITT task
+class PhaseTimer {
+ private:
+  RewriteStatistics& statistics;
+  RewritePhase phase;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  PhaseTimer(RewriteStatistics& statistics, RewritePhase phase)
+      : statistics(statistics), phase(phase), start(std::chrono::steady_clock::now()) {
+    vtune.startTask(REWRITE_PHASE_NAMES[phase]);
+  }
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  ~PhaseTimer() {
+    vtune.stopTask();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    statistics.phaseNanoseconds[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    statistics.phaseCalls[phase]++;
+  }
+};
+}  // namespace
+
+// ---------------------------- REWRITE STATISTICS RELATED OPERATIONS END ----------------------------
+
+Expression Engine::processExpression(Expression&& inputExpr, std::vector<ComplexExpression>& extractedConditions,
+                                     const ColumnDictionary& transformationColumns, ColumnSet& usedColumns) const {
+  return std::visit(
+      boss::utilities::overload(
+          [this, &extractedConditions, &transformationColumns, &usedColumns](ComplexExpression&& complexExpr) -> Expression {
+            if (complexExpr.getHead() == "Transformation"_) {
+              return boss::Expression(std::move(complexExpr));
+            } else if (complexExpr.getHead() == "Select"_) {
+              return extractOperatorsFromSelect(std::move(complexExpr), extractedConditions, transformationColumns,
+                                                usedColumns);
+            } else if (complexExpr.getHead() == "Project"_) {
+              auto [head, _, dynamics, unused] = std::move(complexExpr).decompose();
+              // Process Project's input expression
+              auto& projectionInputExpr = dynamics[0];
+              auto updatedInput = processExpression(std::move(std::move(projectionInputExpr)), extractedConditions,
+                                                    transformationColumns, usedColumns);
+
+              // Extract used symbols from the projection function
+              auto& projectionAsExpr = std::get<ComplexExpression>(dynamics[1]);
+              for (const auto& arg : projectionAsExpr.getDynamicArguments()) {
+                utilities::getUsedColumnsFromExpressions(arg, transformationColumns, usedColumns);
+              }
+              // Compose and return the original expression
+              boss::ExpressionArguments&& remainingSubconditions = {};
+              remainingSubconditions.emplace_back(std::move(updatedInput));
+              remainingSubconditions.emplace_back(boss::Expression(std::move(projectionAsExpr)));
+              ComplexExpression resultExpr = boss::ComplexExpression(head, {}, {std::move(remainingSubconditions)}, {});
+              return boss::Expression(std::move(resultExpr));
+            }
+
+            auto [head, statics, dynamics, spans] = std::move(complexExpr).decompose();
+            // Recursively process sub-expressions
+            std::transform(std::make_move_iterator(dynamics.begin()), std::make_move_iterator(dynamics.end()),
+                           dynamics.begin(), [&](auto&& subExpr) {
+                             return processExpression(std::forward<decltype(subExpr)>(subExpr), extractedConditions,
+                                                      transformationColumns, usedColumns);
+                           });
+            return boss::ComplexExpression(head, std::move(statics), std::move(dynamics), std::move(spans));
+          },
+          [&transformationColumns, &usedColumns](Symbol&& symbol) -> Expression {
+            if (symbol == "Transformation"_) {
+              return boss::Expression(std::move(symbol));
+            }
+            uint32_t id = transformationColumns.find(symbol);
+            if (id != NOT_A_COLUMN) {
+              usedColumns.insert(id);
+            }
+            return boss::Expression(std::move(symbol));
+          },
+          [](auto&& otherExpr) -> Expression { return std::forward<decltype(otherExpr)>(otherExpr); }),
+      std::move(inputExpr));
+}
+
+// Collects the conditions of every Select left in the processed query, with the reason they couldn't be extracted.
+// The same checks as extractOperatorsFromSelect are done on the processed input of each Select
+static void explainKeptConditions(const Expression& expr, const ColumnDictionary& transformationColumns,
+                                  boss::ExpressionArguments& keptConditions) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  if (complexExpr.getHead() == "Select"_ && dynamics.size() == 2 &&
+      std::holds_alternative<ComplexExpression>(dynamics[1])) {
+    auto inputAnnotation = utilities::annotateExpression(dynamics[0], transformationColumns);
+    const auto& where = std::get<ComplexExpression>(dynamics[1]);
+    const auto& condition = std::get<ComplexExpression>(where.getDynamicArguments()[0]);
+    std::vector<const ComplexExpression*> conjuncts = {};
+    if (condition.getHead() == "And"_) {
+      for (const auto& arg : condition.getDynamicArguments()) {
+        conjuncts.emplace_back(&std::get<ComplexExpression>(arg));
+      }
+    } else {
+      conjuncts.emplace_back(&condition);
+    }
+    for (const auto* conjunct : conjuncts) {
+      auto reason = utilities::explainConditionMoveability(inputAnnotation, *conjunct, transformationColumns);
+      if (reason != "Moveable"_) {
+        keptConditions.emplace_back(
+            "Condition"_(conjunct->clone(expressions::CloneReason::EXPRESSION_WRAPPING), std::move(reason)));
+      }
+    }
+  }
+  for (const auto& arg : dynamics) {
+    explainKeptConditions(arg, transformationColumns, keptConditions);
+  }
+}
+
+// Rewrites the query so that its conditions are applied inside of the transformation
+// All the state of the rewrite is local to the call, so concurrent calls only share the immutable plan
+// If one of the cached results covers some of the requested rows, they are read from it and only the others are
+// transformed, i.e. the transformation is replaced with Union(cached rows, transformed remainder)
+Expression Engine::applyTransformation(
+    ComplexExpression&& expr, const TransformationPlan& plan,
+    const std::vector<std::shared_ptr<const CachedTransformationResult>>& cachedResults,
+    std::vector<ComplexExpression>* requestedConditions, TransformationDecision* decision,
+    TransformationExplanation* explanation) const {
+  ColumnSet usedColumns(plan.columns.size());
+  // Conditions extracted from the query. They are moved into the transformation once the used columns are known,
+  // so the plan is instantiated only once
+  std::vector<ComplexExpression> extractedConditions = {};
+  rewriteStatistics.rewrites++;
+  bool countsNodes = rewriteStatistics.countsNodes.load(std::memory_order_relaxed);
+  if (countsNodes) {
+    rewriteStatistics.queryNodes += static_cast<int64_t>(utilities::countExpressionNodes(expr));
+  }
+
+  Expression result = [&]() {
+    PhaseTimer timer(rewriteStatistics, EXTRACT_CONDITIONS);
+    return processExpression(std::move(expr), extractedConditions, plan.columns, usedColumns);
+  }();
+  if (explanation != nullptr) {
+    explainKeptConditions(result, plan.columns, explanation->keptConditions);
+  }
+  ColumnSet keptColumns = [&]() {
+    PhaseTimer timer(rewriteStatistics, DEPENDENT_COLUMNS);
+    auto columns = utilities::getAllDependentColumns(plan.columnDependencyClosures, usedColumns);
+    columns |= plan.untouchableColumnSet;
+    return columns;
+  }();
+  ComplexExpression transformationQuery = [&]() {
+    PhaseTimer timer(rewriteStatistics, PRUNE_COLUMNS);
+    return instantiateTransformationPlan(plan.query, plan.columns, keptColumns);
+  }();
+  if (countsNodes) {
+    rewriteStatistics.clonedNodes += static_cast<int64_t>(utilities::countExpressionNodes(transformationQuery));
+  }
+  if (explanation != nullptr) {
+    for (uint32_t id = 0; id < plan.columns.size(); ++id) {
+      if (!keptColumns.contains(id)) {
+        explanation->droppedColumns.emplace_back(plan.columns.getSymbol(id));
+      }
+    }
+  }
+
+  if (requestedConditions != nullptr) {
+    for (const auto& condition : extractedConditions) {
+      requestedConditions->emplace_back(condition.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+  }
+
+  std::vector<Expression> cachedRows = {};
+  bool isFullyCached = false;
+  if (!cachedResults.empty()) {
+    auto outputColumns = utilities::getOutputColumns(transformationQuery);
+    const auto* cachedResult = findCachedResult(cachedResults, extractedConditions, outputColumns);
+    if (cachedResult != nullptr && !plan.sample.empty()) {
+      // Reading the cached result costs a scan of its rows, and the rows it doesn't cover still have to be
+      // transformed. Without a sample nothing is known about the rows, so the cached result is always read
+      auto uncoveredConditions = getUncoveredConditions(*cachedResult, extractedConditions);
+      std::vector<ComplexExpression> cachedConditions = {};
+      cachedConditions.emplace_back(cachedResult->predicate.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+      double selectivity = utilities::estimateSelectivity(extractedConditions, plan.sample);
+      double lazyCost = FILTER_ROW_COST + selectivity * TRANSFORM_ROW_COST;
+      double cachedCost = CACHED_SCAN_ROW_COST * utilities::estimateSelectivity(cachedConditions, plan.sample);
+      if (!uncoveredConditions.empty()) {
+        for (const auto& condition : extractedConditions) {
+          uncoveredConditions.emplace_back(condition.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+        }
+        cachedCost +=
+            FILTER_ROW_COST + utilities::estimateSelectivity(uncoveredConditions, plan.sample) * TRANSFORM_ROW_COST;
+      }
+      if (decision != nullptr) {
+        *decision = TransformationDecision{lazyCost >= cachedCost, true, selectivity, lazyCost, cachedCost};
+      }
+      if (lazyCost < cachedCost) {
+        cachedResult = nullptr;
+      }
+    } else if (cachedResult != nullptr && decision != nullptr) {
+      decision->readsCachedResult = true;
+    }
+    if (cachedResult != nullptr) {
+      resultCacheHits++;
+      cachedResult->lastUsed = getSteadyClockTime();
+      auto uncoveredConditions = getUncoveredConditions(*cachedResult, extractedConditions);
+      cachedRows.emplace_back(readCachedResult(*cachedResult, extractedConditions, outputColumns));
+      if (countsNodes) {
+        rewriteStatistics.clonedNodes += static_cast<int64_t>(utilities::countExpressionNodes(cachedRows.back()));
+      }
+      isFullyCached = uncoveredConditions.empty();
+      // The transformation only has to produce the rows outside of the cached range
+      for (auto& uncoveredCondition : uncoveredConditions) {
+        extractedConditions.emplace_back(std::move(uncoveredCondition));
+      }
+    } else {
+      resultCacheMisses++;
+    }
+  }
+  if (isFullyCached) {
+    extractedConditions.clear();
+  }
+
+  std::optional<PhaseTimer> moveTimer(std::in_place, rewriteStatistics, MOVE_CONDITIONS);
+  for (auto& extractedExpr : extractedConditions) {
+    std::unordered_set<Symbol> extractedExprSymbols = {};
+    for (const auto& arg : extractedExpr.getDynamicArguments()) {
+      utilities::getUsedSymbolsFromExpressions(arg, extractedExprSymbols);
+    }
+    if (explanation != nullptr) {
+      boss::ExpressionArguments trace = {};
+      auto condition = extractedExpr.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+      transformationQuery = moveExctractedSelectExpressionToTransformation(
+          std::move(transformationQuery), std::move(extractedExpr), extractedExprSymbols, &trace);
+      explanation->pushedConditions.emplace_back(
+          "Condition"_(std::move(condition), boss::ComplexExpression("PushedThrough"_, {}, std::move(trace), {})));
+      continue;
+    }
+    transformationQuery = moveExctractedSelectExpressionToTransformation(
+        std::move(transformationQuery), std::move(extractedExpr), extractedExprSymbols);
+  }
+
+  moveTimer.reset();
+
+  Expression transformedRows = std::move(transformationQuery);
+  if (isFullyCached) {
+    transformedRows = std::move(cachedRows[0]);
+  } else if (!cachedRows.empty()) {
+    transformedRows = boss::ComplexExpression(
+        "Union"_, {}, boss::ExpressionArguments(std::move(cachedRows[0]), std::move(transformedRows)), {});
+  }
+
+  {
+    PhaseTimer timer(rewriteStatistics, REPLACE_TRANSFORMATION);
+    result = replaceTransformSymbolsWithQuery(std::move(result), std::move(transformedRows));
+  }
+  {
+    // Once the transformation is in place, groups and projections of the query over the ones of the transformation
+    // can be collapsed as well, and limits of the query can be pushed into the transformation
+    PhaseTimer timer(rewriteStatistics, SIMPLIFY_PLAN);
+    result = pushDownLimits(fuseConsecutiveProjections(collapseStackedGroups(std::move(result))));
+  }
+  if (countsNodes) {
+    rewriteStatistics.planNodes += static_cast<int64_t>(utilities::countExpressionNodes(result));
+    rewriteStatistics.allocatedBytes += static_cast<int64_t>(utilities::estimateExpressionBytes(result));
+  }
+  return result;
+}
+
+// Conjunction of the conditions, or the condition itself if there is only one
+static ComplexExpression combineConditions(std::vector<ComplexExpression>&& conditions) {
+  if (conditions.size() == 1) {
+    return std::move(conditions[0]);
+  }
+  boss::ExpressionArguments args = {};
+  for (auto& condition : conditions) {
+    args.emplace_back(std::move(condition));
+  }
+  return boss::ComplexExpression("And"_, {}, std::move(args), {});
+}
+
+// Collects the columns computed by the As operators of the query, which are the ones instantiating the plan can drop
+static void collectProjectedColumns(const ComplexExpression& query, std::unordered_set<Symbol>& projectedColumns) {
+  const auto& dynamics = query.getDynamicArguments();
+  if (query.getHead() == "As"_) {
+    for (size_t i = 0; i + 1 < dynamics.size(); i += 2) {
+      projectedColumns.insert(std::get<Symbol>(dynamics[i]));
+    }
+    return;
+  }
+  for (const auto& arg : dynamics) {
+    if (std::holds_alternative<ComplexExpression>(arg)) {
+      collectProjectedColumns(std::get<ComplexExpression>(arg), projectedColumns);
+    }
+  }
+}
+
+// Copies the expression without copying the data of its spans. The copied spans point into the spans of the owner,
+// which is kept alive until the last of them is destroyed
+static ComplexExpression shareSpans(const ComplexExpression& expr, const std::shared_ptr<const Expression>& owner) {
+  boss::ExpressionArguments dynamics = {};
+  for (const auto& arg : expr.getDynamicArguments()) {
+    if (std::holds_alternative<ComplexExpression>(arg)) {
+      dynamics.emplace_back(shareSpans(std::get<ComplexExpression>(arg), owner));
+    } else {
+      dynamics.emplace_back(arg.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+  }
+  boss::expressions::ExpressionSpanArguments spans = {};
+  for (const auto& span : expr.getSpanArguments()) {
+    spans.emplace_back(std::visit(
+        [&owner](const auto& typedSpan) -> boss::expressions::ExpressionSpanArgument {
+          using SpanType = std::decay_t<decltype(typedSpan)>;
+          using T = std::remove_const_t<typename SpanType::element_type>;
+          if constexpr (std::is_same_v<T, bool>) {
+            return SpanType(typedSpan.begin(), typedSpan.size(), [owner]() {});
+          } else {
+            auto* ptr = const_cast<T*>(typedSpan.begin());  // NOLINT
+            return boss::Span<T>(ptr, typedSpan.size(), [owner]() {});
+          }
+        },
+        span));
+  }
+  return boss::ComplexExpression(expr.getHead(), {}, std::move(dynamics), std::move(spans));
+}
+
+Expression Engine::applyTransformationBatch(ComplexExpression&& queries, const TransformationPlan& plan,
+                                            const std::vector<std::string>& engineLibraries) const {
+  auto [head, statics, dynamics, spans] = std::move(queries).decompose();
+  boss::ExpressionArguments batchResults = {};
+  if (engineLibraries.empty()) {
+    // Without engines the shared scan can't be materialised, so every query would scan it again. Each query is
+    // rewritten on its own instead, exactly as by ApplyTransformation
+    for (auto& query : dynamics) {
+      batchResults.emplace_back(applyTransformation(std::get<ComplexExpression>(std::move(query)), plan));
+    }
+    return boss::ComplexExpression("List"_, {}, std::move(batchResults), {});
+  }
+
+  // The shared scan keeps the columns used by any of the queries and the rows selected by any of them
+  ColumnSet sharedColumns(plan.columns.size());
+  std::vector<Expression> results = {};
+  std::vector<ComplexExpression> queryConditions = {};
+  std::vector<ColumnSet> queryColumns = {};
+  bool needsAllRows = false;
+  for (auto& query : dynamics) {
+    std::vector<ComplexExpression> extractedConditions = {};
+    ColumnSet usedColumns(plan.columns.size());
+    results.emplace_back(processExpression(std::move(query), extractedConditions, plan.columns, usedColumns));
+    if (extractedConditions.empty()) {
+      needsAllRows = true;
+      queryConditions.emplace_back("And"_());
+    } else {
+      queryConditions.emplace_back(combineConditions(std::move(extractedConditions)));
+    }
+    auto keptColumns = utilities::getAllDependentColumns(plan.columnDependencyClosures, usedColumns);
+    keptColumns |= plan.untouchableColumnSet;
+    sharedColumns |= keptColumns;
+    queryColumns.emplace_back(std::move(keptColumns));
+  }
+  ComplexExpression sharedScan = instantiateTransformationPlan(plan.query, plan.columns, sharedColumns);
+  auto sharedOutputColumns = utilities::getOutputColumns(sharedScan);
+
+  if (!needsAllRows && !queryConditions.empty()) {
+    boss::ExpressionArguments disjuncts = {};
+    for (const auto& condition : queryConditions) {
+      disjuncts.emplace_back(condition.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+    }
+    auto sharedCondition = disjuncts.size() == 1 ? std::get<ComplexExpression>(std::move(disjuncts[0]))
+                                                 : boss::ComplexExpression("Or"_, {}, std::move(disjuncts), {});
+    std::unordered_set<Symbol> sharedConditionSymbols = {};
+    for (const auto& arg : sharedCondition.getDynamicArguments()) {
+      utilities::getUsedSymbolsFromExpressions(arg, sharedConditionSymbols);
+    }
+    sharedScan = moveExctractedSelectExpressionToTransformation(std::move(sharedScan), std::move(sharedCondition),
+                                                                sharedConditionSymbols);
+  }
+
+  // The shared scan is evaluated once
+  auto evaluateInEngines = [&engineLibraries](Expression&& expr) {
+    boss::ExpressionArguments libraries = {};
+    for (const auto& library : engineLibraries) {
+      libraries.emplace_back(library);
+    }
+    return boss::evaluate(
+        "EvaluateInEngines"_(boss::ComplexExpression("List"_, {}, std::move(libraries), {}), std::move(expr)));
+  };
+  auto isError = [](const Expression& expr) {
+    return std::holds_alternative<ComplexExpression>(expr) && std::get<ComplexExpression>(expr).getHead() == "Error"_;
+  };
+  Expression evaluatedSharedRows = evaluateInEngines(std::move(sharedScan));
+  if (isError(evaluatedSharedRows) || !std::holds_alternative<ComplexExpression>(evaluatedSharedRows)) {
+    return evaluatedSharedRows;
+  }
+  auto sharedRows = std::make_shared<const Expression>(std::move(evaluatedSharedRows));
+
+  // The shared result is partitioned in the engines: each query reads it without copying it, and only receives the
+  // rows it selects and the columns a single ApplyTransformation of it would produce
+  std::unordered_set<Symbol> projectedColumns = {};
+  collectProjectedColumns(plan.query, projectedColumns);
+  for (size_t i = 0; i < results.size(); ++i) {
+    std::vector<Symbol> outputColumns = {};
+    for (const auto& column : sharedOutputColumns) {
+      if (projectedColumns.find(column) == projectedColumns.end() ||
+          queryColumns[i].contains(plan.columns.find(column))) {
+        outputColumns.emplace_back(column);
+      }
+    }
+    Expression queryRows = shareSpans(std::get<ComplexExpression>(*sharedRows), sharedRows);
+    if (!queryConditions[i].getDynamicArguments().empty()) {
+      queryRows = utilities::wrapOperatorWithSelect(std::move(queryRows), std::move(queryConditions[i]));
+    }
+    queryRows = evaluateInEngines(projectOutputColumns(std::move(queryRows), outputColumns));
+    if (isError(queryRows)) {
+      return queryRows;
+    }
+    batchResults.emplace_back(pushDownLimits(fuseConsecutiveProjections(
+        collapseStackedGroups(replaceTransformSymbolsWithQuery(std::move(results[i]), std::move(queryRows))))));
+  }
+  return boss::ComplexExpression("List"_, {}, std::move(batchResults), {});
+}
+
+Expression Engine::evaluate(Expression&& expr) {
+  return std::visit(
+      boss::utilities::overload(
+          [this](ComplexExpression&& infoExpr) -> Expression {
+            auto [head, statics, dynamics, spans] = std::move(infoExpr).decompose();
+            if (head == "ApplyTransformation"_) {
+              // ApplyTransformation(query[, index], Explain) also returns how the rows of the transformation are read
+              bool explain = !dynamics.empty() && std::holds_alternative<Symbol>(dynamics.back()) &&
+                             std::get<Symbol>(dynamics.back()) == "Explain"_;
+              if (explain) {
+                dynamics.pop_back();
+              }
+              int index = 0;
+              std::shared_ptr<const TransformationPlan> plan;
+              uint64_t version = 0;
+              std::vector<std::shared_ptr<const CachedTransformationResult>> cachedResults = {};
+              {
+                std::shared_lock lock(transformationsMutex);
+                if (transformations.size() == 0) {
+                  return "Error"_("No transformations added");
+                }
+                if (dynamics.size() == 2) {
+                  index = std::get<int>(std::move(dynamics[1]));
+                  if (index >= transformations.size() || index < 0) {
+                    return "Error"_("Transformation index out of bounds"_);
+                  }
+                }
+                // Holding the plan keeps it alive even if the transformation is removed while being applied
+                plan = transformations[index];
+                version = transformationsVersion;
+                std::shared_lock resultCacheLock(resultCacheMutex);
+                for (const auto& cachedResult : resultCache) {
+                  if (cachedResult->transformationIndex == index) {
+                    cachedResults.emplace_back(cachedResult);
+                  }
+                }
+              }
+              lastApplicationTime = getSteadyClockTime();
+              if (explain) {
+                TransformationDecision decision = {};
+                auto result = applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan,
+                                                  cachedResults, nullptr, &decision);
+                auto estimate = [&decision](double value) -> Expression {
+                  return decision.hasEstimate ? Expression(value) : Expression("Unknown"_);
+                };
+                return "List"_(std::move(result),
+                               "Decision"_("Strategy"_(decision.readsCachedResult ? "Cached"_ : "Lazy"_),
+                                           "Selectivity"_(estimate(decision.selectivity)),
+                                           "LazyCost"_(estimate(decision.lazyCost)),
+                                           "CachedCost"_(estimate(decision.cachedCost))));
+              }
+              if (plan->hybridOptions.isHybrid) {
+                // The requested ranges are only known after extracting the conditions, so the rewrite is not cached
+                std::vector<ComplexExpression> requestedConditions = {};
+                auto result = applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan,
+                                                  cachedResults, &requestedConditions);
+                trackRequestedRange(index, std::move(requestedConditions));
+                return result;
+              }
+              if (!cachedResults.empty()) {
+                // Which rows are read from the cached results depends on the literals, so the rewrite is not cached
+                return applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan, cachedResults);
+              }
+
+              if (countParameters(dynamics[0]) != 0) {
+                // Parameter slots of the query would be parameterised and bound like the cache's own slots, so
+                // such queries are not cached
+                return applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan);
+              }
+
+              boss::ExpressionArguments parameters = {};
+              std::string shapeKey = std::to_string(version) + ':' + std::to_string(index) + ':';
+              Expression parameterisedExpr = parameteriseExpression(std::move(dynamics[0]), parameters, shapeKey);
+
+              {
+                std::shared_lock lock(rewriteCacheMutex);
+                auto cached = rewriteCache.find(shapeKey);
+                if (cached != rewriteCache.end()) {
+                  rewriteCacheHits++;
+                  auto cachedResult = cached->second.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+                  lock.unlock();
+                  return bindParameters(std::move(cachedResult), parameters);
+                }
+              }
+              rewriteCacheMisses++;
+
+              Expression result =
+                  applyTransformation(std::get<ComplexExpression>(std::move(parameterisedExpr)), *plan);
+              {
+                // If the transformations changed in the meantime, the entry has an outdated version and is never hit
+                std::unique_lock lock(rewriteCacheMutex);
+                if (rewriteCache.size() < MAX_REWRITE_CACHE_ENTRIES) {
+                  rewriteCache.try_emplace(std::move(shapeKey),
+                                           result.clone(expressions::CloneReason::EXPRESSION_WRAPPING));
+                }
+              }
+              return bindParameters(std::move(result), parameters);
+            } else if (head == "ExplainTransformation"_) {
+              // ExplainTransformation(query[, index]) reports which conditions were extracted and how far they were
+              // pushed into the transformation, which were kept and why, and which columns were pruned
+              int index = 0;
+              std::shared_ptr<const TransformationPlan> plan;
+              std::vector<std::shared_ptr<const CachedTransformationResult>> cachedResults = {};
+              {
+                std::shared_lock lock(transformationsMutex);
+                if (transformations.size() == 0) {
+                  return "Error"_("No transformations added");
+                }
+                if (dynamics.size() == 2) {
+                  index = std::get<int>(std::move(dynamics[1]));
+                  if (index >= transformations.size() || index < 0) {
+                    return "Error"_("Transformation index out of bounds"_);
+                  }
+                }
+                plan = transformations[index];
+                std::shared_lock resultCacheLock(resultCacheMutex);
+                for (const auto& cachedResult : resultCache) {
+                  if (cachedResult->transformationIndex == index) {
+                    cachedResults.emplace_back(cachedResult);
+                  }
+                }
+              }
+              std::vector<ComplexExpression> extractedConditions = {};
+              TransformationDecision decision = {};
+              TransformationExplanation explanation = {};
+              auto result = applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan,
+                                                cachedResults, &extractedConditions, &decision, &explanation);
+              // Shares of the transformation input that are not computed, as far as they can be estimated
+              double droppedColumnShare = plan->columns.size() == 0 ? 0.0
+                                                                    : static_cast<double>(explanation.droppedColumns.size()) /
+                                                                          static_cast<double>(plan->columns.size());
+              Expression filteredRowShare = "Unknown"_;
+              if (!plan->sample.empty()) {
+                filteredRowShare = 1.0 - utilities::estimateSelectivity(extractedConditions, plan->sample);
+              }
+              return "List"_(
+                  boss::ComplexExpression("ExtractedConditions"_, {}, std::move(explanation.pushedConditions), {}),
+                  boss::ComplexExpression("KeptConditions"_, {}, std::move(explanation.keptConditions), {}),
+                  boss::ComplexExpression("DroppedColumns"_, {}, std::move(explanation.droppedColumns), {}),
+                  "EstimatedSavings"_("DroppedColumns"_(droppedColumnShare),
+                                      "FilteredRows"_(std::move(filteredRowShare))),
+                  "Strategy"_(decision.readsCachedResult ? "Cached"_ : "Lazy"_), "Plan"_(std::move(result)));
+            } else if (head == "PrepareTransformation"_) {
+              // PrepareTransformation(query[, index]), where the literals to bind later are Parameter(slot)
+              auto parameterCount = countParameters(dynamics[0]);
+              if (parameterCount < 0) {
+                return "Error"_("Parameter slots must be non-negative ints"_);
+              }
+              int index = 0;
+              std::shared_ptr<const TransformationPlan> plan;
+              uint64_t version = 0;
+              {
+                std::shared_lock lock(transformationsMutex);
+                if (transformations.size() == 0) {
+                  return "Error"_("No transformations added");
+                }
+                if (dynamics.size() == 2) {
+                  index = std::get<int>(std::move(dynamics[1]));
+                  if (index >= transformations.size() || index < 0) {
+                    return "Error"_("Transformation index out of bounds"_);
+                  }
+                }
+                plan = transformations[index];
+                version = transformationsVersion;
+              }
+              // Cached results depend on the bound literals, so prepared queries are always rewritten lazily
+              auto rewrittenQuery = applyTransformation(std::get<ComplexExpression>(std::move(dynamics[0])), *plan);
+              std::unique_lock lock(preparedTransformationsMutex);
+              auto handle = nextPreparedHandle++;
+              preparedTransformations.try_emplace(
+                  handle, PreparedTransformation{version, parameterCount, std::move(rewrittenQuery)});
+              return "PreparedTransformation"_(handle);
+            } else if (head == "ExecutePrepared"_) {
+              // ExecutePrepared(PreparedTransformation(handle), List(parameters...))
+              auto handle = dynamics.size() == 2 ? getPreparedHandle(dynamics[0]) : std::nullopt;
+              if (!handle || !std::holds_alternative<ComplexExpression>(dynamics[1])) {
+                return "Error"_("Prepared transformations are executed with a handle and a List of parameters"_);
+              }
+              auto [listHead, listStatics, parameters, listSpans] =
+                  std::get<ComplexExpression>(std::move(dynamics[1])).decompose();
+              Expression rewrittenQuery = "Error"_("Unknown prepared transformation"_);
+              {
+                std::shared_lock lock(preparedTransformationsMutex);
+                auto prepared = preparedTransformations.find(*handle);
+                if (prepared == preparedTransformations.end()) {
+                  return rewrittenQuery;
+                }
+                {
+                  std::shared_lock transformationsLock(transformationsMutex);
+                  if (prepared->second.transformationsVersion != transformationsVersion) {
+                    return "Error"_("Prepared transformation is outdated"_);
+                  }
+                }
+                if (parameters.size() != prepared->second.parameterCount) {
+                  return "Error"_("Wrong number of parameters"_);
+                }
+                rewrittenQuery = prepared->second.rewrittenQuery.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+              }
+              lastApplicationTime = getSteadyClockTime();
+              return bindParameters(std::move(rewrittenQuery), parameters);
+            } else if (head == "ReleasePreparedTransformation"_) {
+              auto handle = dynamics.size() == 1 ? getPreparedHandle(dynamics[0]) : std::nullopt;
+              if (!handle) {
+                return "Error"_("Prepared transformations are released with a handle"_);
+              }
+              {
+                std::unique_lock lock(preparedTransformationsMutex);
+                preparedTransformations.erase(*handle);
+              }
+              return "Prepared transformation released successfully"_;
+            } else if (head == "ApplyTransformationBatch"_) {
+              // ApplyTransformationBatch(List(queries...)[, index][, List(engine libraries...)])
+              // Without engine libraries, the queries are rewritten one by one and the scan is not shared
+              if (dynamics.empty() || !std::holds_alternative<ComplexExpression>(dynamics[0]) ||
+                  std::get<ComplexExpression>(dynamics[0]).getHead() != "List"_) {
+                return "Error"_("Batches must be a List of queries"_);
+              }
+              std::vector<std::string> engineLibraries = {};
+              if (dynamics.size() > 1 && std::holds_alternative<ComplexExpression>(dynamics.back())) {
+                for (const auto& library : std::get<ComplexExpression>(dynamics.back()).getDynamicArguments()) {
+                  if (!std::holds_alternative<std::string>(library)) {
+                    return "Error"_("Engine libraries must be strings"_);
+                  }
+                  engineLibraries.emplace_back(std::get<std::string>(library));
+                }
+                dynamics.pop_back();
+              }
+              int index = 0;
+              std::shared_ptr<const TransformationPlan> plan;
+              {
+                std::shared_lock lock(transformationsMutex);
+                if (transformations.size() == 0) {
+                  return "Error"_("No transformations added");
+                }
+                if (dynamics.size() == 2) {
+                  index = std::get<int>(std::move(dynamics[1]));
+                  if (index >= transformations.size() || index < 0) {
+                    return "Error"_("Transformation index out of bounds"_);
+                  }
+                }
+                plan = transformations[index];
+              }
+              lastApplicationTime = getSteadyClockTime();
+              return applyTransformationBatch(std::get<ComplexExpression>(std::move(dynamics[0])), *plan,
+                                              engineLibraries);
+            } else if (head == "AddTransformation"_) {
+              // AddTransformation(query[, Hybrid(...)][, Sample(Table(...))])
+              HybridOptions hybridOptions = {};
+              utilities::ColumnSample sample = {};
+              for (auto i = 1; i < dynamics.size(); i++) {
+                if (!std::holds_alternative<ComplexExpression>(dynamics[i])) {
+                  return "Error"_("Unknown transformation options"_);
+                }
+                const auto& option = std::get<ComplexExpression>(dynamics[i]);
+                bool isSample = option.getHead() == "Sample"_ && option.getDynamicArguments().size() == 1 &&
+                                std::holds_alternative<ComplexExpression>(option.getDynamicArguments()[0]);
+                if (isSample ? !utilities::readColumnSample(
+                                   std::get<ComplexExpression>(option.getDynamicArguments()[0]), sample)
+                             : !parseHybridOptions(option, hybridOptions)) {
+                  return "Error"_("Unknown transformation options"_);
+                }
+              }
+              bool isHybrid = hybridOptions.isHybrid;
+              ComplexExpression transformationQuery = std::get<ComplexExpression>(std::move(dynamics[0]));
+              // Compiled before taking the lock, so that rewrites are not blocked by it
+              auto plan = compileTransformationPlan(std::move(transformationQuery), std::move(hybridOptions),
+                                                    std::move(sample));
+              {
+                std::unique_lock lock(transformationsMutex);
+                transformations.emplace_back(std::move(plan));
+                transformationsVersion++;
+              }
+              if (isHybrid) {
+                std::lock_guard lock(materialisationMutex);
+                if (!materialisationThread.joinable()) {
+                  materialisationThread = std::thread([this]() { runMaterialisation(); });
+                }
+              }
+              // Cached rewrites are keyed by the transformation index
+              clearRewriteCache();
+
+              return "Transformation added successfully"_;
+            } else if (head == "GetTransformation"_) {
+              std::shared_lock lock(transformationsMutex);
+              if (transformations.size() == 0) {
+                return "Error"_("No transformations added"_);
+              }
+              int index = 0;
+              if (dynamics.size() == 1) {
+                index = std::get<int>(std::move(dynamics[0]));
+                if (index >= transformations.size()) {
+                  return "Error"_("Transformation index out of bounds"_);
+                }
+              }
+              return transformations[index]->originalQuery.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+            } else if (head == "RemoveTransformation"_) {
+              {
+                std::unique_lock lock(transformationsMutex);
+                if (transformations.size() == 0) {
+                  return "Transformation removed successfully"_;
+                }
+                int index = 0;
+                if (dynamics.size() == 1) {
+                  index = std::get<int>(std::move(dynamics[0]));
+                  if (index >= transformations.size()) {
+                    return "Error"_("Transformation index out of bounds"_);
+                  }
+                }
+
+                if (index >= transformations.size() || index < 0) {
+                  return "Error"_("Transformation index out of bounds"_);
+                }
+                transformations.erase(transformations.begin() + index);
+                transformationsVersion++;
+                // Cached results are keyed by the transformation index, so they are dropped before it is reused
+                clearResultCache();
+                clearTrackedRanges();
+              }
+              clearRewriteCache();
+
+              return "Transformation removed successfully"_;
+            } else if (head == "RemoveAllTransformations"_) {
+              {
+                std::unique_lock lock(transformationsMutex);
+                transformations.clear();
+                transformationsVersion++;
+                clearResultCache();
+                clearTrackedRanges();
+              }
+              clearRewriteCache();
+
+              return "All transformations removed successfully"_;
+            } else if (head == "GetLazyTransformationEngineCapabilities"_) {
+              return "List"_("ApplyTransformation"_, "ApplyTransformationBatch"_, "ExplainTransformation"_,
+                             "PrepareTransformation"_, "ExecutePrepared"_, "ReleasePreparedTransformation"_,
+                             "AddTransformation"_, "GetTransformation"_, "RemoveTransformation"_,
+                             "RemoveAllTransformations"_, "GetLazyTransformationEngineStats"_,
+                             "SetLazyTransformationEngineNodeStats"_, "ResetLazyTransformationEngineStats"_,
+                             "GetLazyTransformationEngineCacheStats"_,
+                             "CacheTransformationResult"_, "SetTransformationResultCacheBudget"_,
+                             "ClearTransformationResultCache"_, "GetLazyTransformationEngineResultCacheStats"_,
+                             "GetLazyTransformationEngineMaterialisationStats"_,
+                             "CacheMaterialisedTransformation"_);
+            } else if (head == "GetLazyTransformationEngineStats"_) {
+              boss::ExpressionArguments phases = {};
+              for (size_t phase = 0; phase < REWRITE_PHASE_COUNT; ++phase) {
+                phases.emplace_back(boss::ComplexExpression(
+                    Symbol(REWRITE_PHASE_NAMES[phase]), {},
+                    boss::ExpressionArguments("Nanoseconds"_(rewriteStatistics.phaseNanoseconds[phase].load()),
+                                              "Calls"_(rewriteStatistics.phaseCalls[phase].load())),
+                    {}));
+              }
+              boss::ExpressionArguments stats = {};
+              stats.emplace_back(boss::ComplexExpression("Phases"_, {}, std::move(phases), {}));
+              stats.emplace_back("Rewrites"_(rewriteStatistics.rewrites.load()));
+              // Nodes and bytes are only reported while they are counted, as they would otherwise read as zeros
+              if (rewriteStatistics.countsNodes) {
+                stats.emplace_back("QueryNodes"_(rewriteStatistics.queryNodes.load()));
+                stats.emplace_back("PlanNodes"_(rewriteStatistics.planNodes.load()));
+                stats.emplace_back("ClonedNodes"_(rewriteStatistics.clonedNodes.load()));
+                stats.emplace_back("AllocatedBytes"_(rewriteStatistics.allocatedBytes.load()));
+              }
+              return boss::ComplexExpression("List"_, {}, std::move(stats), {});
+            } else if (head == "SetLazyTransformationEngineNodeStats"_) {
+              // SetLazyTransformationEngineNodeStats(bool)
+              if (dynamics.size() != 1 || !std::holds_alternative<bool>(dynamics[0])) {
+                return "Error"_("Node stats must be enabled with a bool"_);
+              }
+              rewriteStatistics.countsNodes = std::get<bool>(dynamics[0]);
+              return "Node stats set successfully"_;
+            } else if (head == "ResetLazyTransformationEngineStats"_) {
+              rewriteStatistics.reset();
+              return "Stats reset successfully"_;
+            } else if (head == "GetLazyTransformationEngineCacheStats"_) {
+              std::shared_lock lock(rewriteCacheMutex);
+              return "List"_("Hits"_(rewriteCacheHits.load()), "Misses"_(rewriteCacheMisses.load()),
+                             "Entries"_(static_cast<int64_t>(rewriteCache.size())));
+            } else if (head == "CacheTransformationResult"_) {
+              // CacheTransformationResult(predicate, result[, index])
+              if (dynamics.size() < 2 || dynamics.size() > 3 || !std::holds_alternative<ComplexExpression>(dynamics[0]) ||
+                  (dynamics.size() == 3 && !std::holds_alternative<int32_t>(dynamics[2]))) {
+                return "Error"_("Results are cached with a predicate, the result and an optional transformation index"_);
+              }
+              int index = 0;
+              if (dynamics.size() == 3) {
+                index = std::get<int>(std::move(dynamics[2]));
+              }
+              return cacheTransformationResult(std::get<ComplexExpression>(std::move(dynamics[0])),
+                                               std::move(dynamics[1]), index);
+            } else if (head == "CacheMaterialisedTransformation"_) {
+              // The whole output of the transformation, selected by an empty condition
+              if (dynamics.empty() || dynamics.size() > 2 ||
+                  (dynamics.size() == 2 && !std::holds_alternative<int32_t>(dynamics[1]))) {
+                return "Error"_("Results are cached with the result and an optional transformation index"_);
+              }
+              int index = 0;
+              if (dynamics.size() == 2) {
+                index = std::get<int>(std::move(dynamics[1]));
+              }
+              return cacheTransformationResult("And"_(), std::move(dynamics[0]), index);
+            } else if (head == "SetTransformationResultCacheBudget"_) {
+              if (dynamics.size() != 1 ||
+                  (!std::holds_alternative<int64_t>(dynamics[0]) && !std::holds_alternative<int32_t>(dynamics[0]))) {
+                return "Error"_("Result cache budget must be an int"_);
+              }
+              int64_t budget = std::holds_alternative<int64_t>(dynamics[0]) ? std::get<int64_t>(dynamics[0])
+                                                                            : std::get<int32_t>(dynamics[0]);
+              if (budget < 0) {
+                return "Error"_("Result cache budget must not be negative"_);
+              }
+              std::unique_lock lock(resultCacheMutex);
+              resultCacheBudget = budget;
+              evictCachedResults();
+              return "Result cache budget set successfully"_;
+            } else if (head == "ClearTransformationResultCache"_) {
+              clearResultCache();
+              return "Result cache cleared successfully"_;
+            } else if (head == "GetLazyTransformationEngineResultCacheStats"_) {
+              std::shared_lock lock(resultCacheMutex);
+              return "List"_("Hits"_(resultCacheHits.load()), "Misses"_(resultCacheMisses.load()),
+                             "Entries"_(static_cast<int64_t>(resultCache.size())),
+                             "Bytes"_(static_cast<int64_t>(resultCacheBytes)),
+                             "Budget"_(static_cast<int64_t>(resultCacheBudget)));
+            } else if (head == "GetLazyTransformationEngineMaterialisationStats"_) {
+              std::lock_guard lock(trackedRangesMutex);
+              return "List"_("TrackedRanges"_(static_cast<int64_t>(trackedRanges.size())),
+                             "MaterialisedRanges"_(materialisedRanges.load()),
+                             "MaterialisationNanoseconds"_(materialisationNanoseconds.load()));
+            }
+            std::transform(std::make_move_iterator(dynamics.begin()), std::make_move_iterator(dynamics.end()),
+                           dynamics.begin(), [this](auto&& arg) { return evaluate(std::forward<decltype(arg)>(arg)); });
+            return boss::ComplexExpression(std::move(head), {}, std::move(dynamics), std::move(spans));
+          },
+          [this](Symbol&& symbol) -> Expression { return std::move(symbol); },
+          [](auto&& otherExpr) -> Expression { return std::forward<decltype(otherExpr)>(otherExpr); }),
+      std::move(expr));
+}
+}  // namespace boss::engines::LazyTransformation
+
+// Every evaluation holds its own reference to the engine, so reset only destroys it once the running evaluations
+// finished. The mutex only guards taking and dropping the reference, the engine synchronises the evaluations itself
+static std::shared_ptr<boss::engines::LazyTransformation::Engine> enginePtr(bool initialise = true,
+                                                                            bool release = false) {
+  static auto engine = std::shared_ptr<boss::engines::LazyTransformation::Engine>();
+  static std::mutex m;
+  std::lock_guard lock(m);
+  if (release) {
+    return std::move(engine);
+  }
+  if (!engine && initialise) {
+    engine = std::make_shared<boss::engines::LazyTransformation::Engine>();
+  }
+  return engine;
+}
+
+extern "C" BOSSExpression* evaluate(BOSSExpression* e) {
+  auto engine = enginePtr();
+  auto* r = new BOSSExpression{engine->evaluate(std::move(e->delegate))};
   return r;
 };
 
-extern "C" void reset() { enginePtr(false).reset(nullptr); }
+// The released engine is destroyed outside of the lock, once the last running evaluation dropped it
+extern "C" void reset() { enginePtr(false, true); }
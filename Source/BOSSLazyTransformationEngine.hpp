@@ -2,12 +2,25 @@
 #include <Engine.hpp>
 #include <Expression.hpp>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "ColumnSet.hpp"
+#include "Utilities.hpp"
+
 using std::string_literals::operator""s;
 using boss::ComplexExpression;
 using boss::Span;
@@ -18,13 +31,173 @@ using boss::Expression;  // NOLINT(misc-unused-using-decls)
 namespace boss::engines::LazyTransformation {
 
 static const Symbol UNEXCTRACTABLE = Symbol("UNEXCTRACTABLE");
-static ComplexExpression UNEXCTRACTABLE_EXPRESSION = ComplexExpression(UNEXCTRACTABLE, {}, {}, {});
+
+// Once the rewrite cache is full, new query shapes are rewritten without being cached
+static constexpr size_t MAX_REWRITE_CACHE_ENTRIES = 1024;
+
+// Memory budget of the transformation result cache, unless set with SetTransformationResultCacheBudget
+static constexpr size_t DEFAULT_RESULT_CACHE_BUDGET_BYTES = 256 * 1024 * 1024;
+
+// Ranges of hybrid transformations are materialised once they were requested this often
+static constexpr int64_t MIN_HOT_RANGE_REQUESTS = 2;
+
+// Once this many ranges are tracked, new ranges are not tracked anymore
+static constexpr size_t MAX_TRACKED_RANGES = 1024;
+
+// Share of a core the background materialisation may use, unless set in the Hybrid option of AddTransformation
+static constexpr double DEFAULT_MATERIALISATION_CPU_BUDGET = 0.1;
+
+// The engine counts as idle once no transformation was applied for this long
+static constexpr std::chrono::milliseconds MATERIALISATION_IDLE_DELAY{100};
+
+// Options of AddTransformation(query, Hybrid(List(engine libraries...)[, cpu budget])). Queries of a hybrid
+// transformation are still rewritten lazily, but the ranges they request are tracked, and the hot ones are
+// materialised in the background with the given engines once the engine is idle
+struct HybridOptions {
+  bool isHybrid = false;
+  std::vector<std::string> engineLibraries;
+  double cpuBudget = DEFAULT_MATERIALISATION_CPU_BUDGET;
+};
+
+// Phases of a rewrite, timed separately by applyTransformation and reported by GetLazyTransformationEngineStats
+enum RewritePhase {
+  EXTRACT_CONDITIONS = 0,
+  DEPENDENT_COLUMNS,
+  PRUNE_COLUMNS,
+  MOVE_CONDITIONS,
+  REPLACE_TRANSFORMATION,
+  SIMPLIFY_PLAN,
+  REWRITE_PHASE_COUNT
+};
+
+static constexpr std::array<const char *, REWRITE_PHASE_COUNT> REWRITE_PHASE_NAMES = {
+    "ExtractConditions", "DependentColumns", "PruneColumns", "MoveConditions", "ReplaceTransformation", "SimplifyPlan"};
+
+// Phase timers and counters are always collected. Node and byte counts traverse the queries, so they are only
+// collected once enabled by SetLazyTransformationEngineNodeStats(true), or by default when built with
+// WITH_ITT_NOTIFY. Reset by ResetLazyTransformationEngineStats
+struct RewriteStatistics {
+  std::array<std::atomic<int64_t>, REWRITE_PHASE_COUNT> phaseNanoseconds = {};
+  std::array<std::atomic<int64_t>, REWRITE_PHASE_COUNT> phaseCalls = {};
+  std::atomic<int64_t> rewrites = 0;
+  // Expressions of the queries passed to applyTransformation and of the rewritten queries
+  std::atomic<int64_t> queryNodes = 0;
+  std::atomic<int64_t> planNodes = 0;
+  // Expressions copied from the transformation plan and from cached results into the rewritten queries
+  std::atomic<int64_t> clonedNodes = 0;
+  // Estimated size of the rewritten queries, which are allocated anew by every rewrite
+  std::atomic<int64_t> allocatedBytes = 0;
+#ifdef WITH_ITT_NOTIFY
+  std::atomic<bool> countsNodes = true;
+#else
+  std::atomic<bool> countsNodes = false;
+#endif
+
+  void reset();
+};
+
+// Costs per row of the transformation input, relative to transforming the row. They are used to choose between
+// the lazy rewrite and reading a cached result, once the selectivity of a query is estimated from the sample given
+// in the Sample option of AddTransformation
+static constexpr double TRANSFORM_ROW_COST = 1.0;
+// Evaluating the pushed down conditions on every input row
+static constexpr double FILTER_ROW_COST = 0.1;
+// Reading and filtering a row of a cached result
+static constexpr double CACHED_SCAN_ROW_COST = 0.3;
+
+// How ApplyTransformation produced the rows of the transformation, returned with ApplyTransformation(..., Explain)
+struct TransformationDecision {
+  bool readsCachedResult = false;
+  // Whether the costs below were estimated, which needs both a cached result and a sample
+  bool hasEstimate = false;
+  double selectivity = 1.0;
+  double lazyCost = 0;
+  double cachedCost = 0;
+};
+
+// What applyTransformation did to the transformation, returned by ExplainTransformation
+struct TransformationExplanation {
+  // Every extracted condition with the operators of the transformation it was pushed through, and where it stopped
+  boss::ExpressionArguments pushedConditions;
+  // Columns of the transformation that were pruned, as the query doesn't use them
+  boss::ExpressionArguments droppedColumns;
+  // Conditions that stayed in the query, with the reason they couldn't be extracted
+  boss::ExpressionArguments keptConditions;
+};
+
+// Query rewritten once by PrepareTransformation, with Parameter slots bound by every ExecutePrepared
+struct PreparedTransformation {
+  // The rewrite is only valid as long as the transformations don't change
+  uint64_t transformationsVersion;
+  int32_t parameterCount;
+  Expression rewrittenQuery;
+};
+
+// Range of a hybrid transformation requested by queries, as the condition selecting it
+struct TrackedRange {
+  int transformationIndex;
+  Expression predicate;
+  size_t predicateHash;
+  int64_t requests;
+  bool isMaterialised;
+};
+
+// Materialised output of a transformation for a range of one of its columns, stored by CacheTransformationResult.
+// ApplyTransformation reads the rows of the range from it and only transforms the rest of the requested rows
+struct CachedTransformationResult {
+  // Reads the range of the column from the predicate and the columns and size of the result
+  CachedTransformationResult(int transformationIndex, ComplexExpression &&predicate, const Symbol &column,
+                             Expression &&result);
+
+  int transformationIndex;
+  // Condition that selected the rows. The literals of the range point into it
+  ComplexExpression predicate;
+  Symbol column;
+  utilities::ColumnRange range;
+  Expression result;
+  std::unordered_set<Symbol> resultColumns;
+  size_t bytes;
+  // Steady clock time of the last use, so that the least recently used results are evicted first
+  mutable std::atomic<int64_t> lastUsed;
+};
+
+// Compiled form of a registered transformation. It is built once by AddTransformation and never modified
+// afterwards, so every ApplyTransformation shares it instead of copying the query and its column metadata.
+struct TransformationPlan {
+  // The query after projection fusion and common subexpression elimination, which queries are rewritten against
+  ComplexExpression query;
+  // The query as it was registered, which is what GetTransformation returns
+  ComplexExpression originalQuery;
+  std::unordered_set<Symbol> untouchableColumns;
+  std::unordered_map<Symbol, std::unordered_set<Symbol>> columnDependencies;
+  // Dense ids of the transformation columns, used by all the column sets below
+  ColumnDictionary columns;
+  ColumnSet untouchableColumnSet;
+  // Indexed by column id: the column itself and all the columns it transitively depends on
+  std::vector<ColumnSet> columnDependencyClosures;
+  HybridOptions hybridOptions;
+  utilities::ColumnSample sample;
+};
+
+std::shared_ptr<const TransformationPlan> compileTransformationPlan(ComplexExpression &&transformationQuery,
+                                                                   HybridOptions &&hybridOptions = {},
+                                                                   utilities::ColumnSample &&sample = {});
+
+ComplexExpression instantiateTransformationPlan(const ComplexExpression &planQuery, const ColumnDictionary &columns,
+                                                const ColumnSet &keptColumns);
+
+Expression parameteriseExpression(Expression &&expr, boss::ExpressionArguments &parameters, std::string &shapeKey);
+
+Expression bindParameters(Expression &&expr, const boss::ExpressionArguments &parameters);
+
+int32_t countParameters(const Expression &expr);
 
 Expression wrapNestedSetOperatorsWithSelect(Expression &&expr, ComplexExpression &&condition);
 
 ComplexExpression moveExctractedSelectExpressionToTransformation(Expression &&transformingExpression,
                                                                  ComplexExpression &&extractedExpressions,
-                                                                 const std::unordered_set<Symbol> &usedSymbols);
+                                                                 const std::unordered_set<Symbol> &usedSymbols,
+                                                                 boss::ExpressionArguments *trace = nullptr);
 
 ComplexExpression removeUnusedTransformationColumns(ComplexExpression &&transformationQuery,
                                                     const std::unordered_set<Symbol> &usedSymbols,
@@ -32,13 +205,92 @@ ComplexExpression removeUnusedTransformationColumns(ComplexExpression &&transfor
 
 Expression replaceTransformSymbolsWithQuery(Expression &&expr, Expression &&transformationQuery);
 
+Expression collapseStackedGroups(Expression &&expr);
+
+Expression fuseConsecutiveProjections(Expression &&expr);
+
+Expression eliminateCommonSubexpressions(Expression &&expr);
+
+Expression pushDownLimits(Expression &&expr);
+
+const CachedTransformationResult *findCachedResult(
+    const std::vector<std::shared_ptr<const CachedTransformationResult>> &cachedResults,
+    const std::vector<ComplexExpression> &extractedConditions, const std::vector<Symbol> &outputColumns);
+
+std::vector<ComplexExpression> getUncoveredConditions(const CachedTransformationResult &cachedResult,
+                                                      const std::vector<ComplexExpression> &extractedConditions);
+
+Expression readCachedResult(const CachedTransformationResult &cachedResult,
+                            const std::vector<ComplexExpression> &extractedConditions,
+                            const std::vector<Symbol> &outputColumns);
+
 class Engine {
  private:
-  std::vector<ComplexExpression> transformationQueries;
-  std::vector<std::unordered_set<Symbol>> transformationsUntouchableColumns;
-  std::vector<std::unordered_map<Symbol, std::unordered_set<Symbol>>> transformationsColumnDependencies;
+  // Registered transformations. ApplyTransformation only holds the shared lock while taking a snapshot of the plan
+  // it applies, so rewrites run in parallel and only Add/RemoveTransformation wait for each other
+  std::vector<std::shared_ptr<const TransformationPlan>> transformations;
+  // Incremented on every change of the registered transformations
+  uint64_t transformationsVersion = 0;
+  mutable std::shared_mutex transformationsMutex;
+
+  // Rewrite results of already seen query shapes, keyed by the transformations version and index and the query
+  // shape. The literals of the stored results are replaced by Parameter slots, so they can be replayed with new
+  // literals
+  std::unordered_map<std::string, Expression> rewriteCache;
+  mutable std::shared_mutex rewriteCacheMutex;
+  std::atomic<int64_t> rewriteCacheHits = 0;
+  std::atomic<int64_t> rewriteCacheMisses = 0;
 
-  ComplexExpression currentTransformationQuery = UNEXCTRACTABLE_EXPRESSION.clone();
+  void clearRewriteCache();
+
+  // Queries prepared by PrepareTransformation, keyed by the handle returned to the client
+  std::unordered_map<int64_t, PreparedTransformation> preparedTransformations;
+  int64_t nextPreparedHandle = 0;
+  mutable std::shared_mutex preparedTransformationsMutex;
+
+  // Materialised transformation results, read by ApplyTransformation instead of transforming the rows they cover.
+  // Their total size is kept within the budget by evicting the least recently used ones
+  std::vector<std::shared_ptr<const CachedTransformationResult>> resultCache;
+  size_t resultCacheBytes = 0;
+  size_t resultCacheBudget = DEFAULT_RESULT_CACHE_BUDGET_BYTES;
+  mutable std::shared_mutex resultCacheMutex;
+  // Counted by the const applyTransformation, as only it knows whether a cached result could be used
+  mutable std::atomic<int64_t> resultCacheHits = 0;
+  mutable std::atomic<int64_t> resultCacheMisses = 0;
+
+  // Results computed for an older version of the transformations are not stored, as the index may have changed
+  Expression cacheTransformationResult(ComplexExpression &&predicate, Expression &&result, int index,
+                                       const uint64_t *expectedTransformationsVersion = nullptr);
+
+  // Evicts the least recently used results until the cache fits into its budget. Expects the lock to be held
+  void evictCachedResults();
+
+  void clearResultCache();
+
+  // Ranges requested from hybrid transformations, materialised by the background thread once they are hot
+  std::vector<TrackedRange> trackedRanges;
+  std::mutex trackedRangesMutex;
+  std::atomic<int64_t> lastApplicationTime = 0;
+  std::atomic<int64_t> materialisedRanges = 0;
+  std::atomic<int64_t> materialisationNanoseconds = 0;
+  // Started by the first hybrid transformation and stopped by the destructor
+  std::thread materialisationThread;
+  bool stopMaterialisation = false;
+  std::mutex materialisationMutex;
+  std::condition_variable materialisationWakeUp;
+
+  void trackRequestedRange(int index, std::vector<ComplexExpression> &&requestedConditions);
+
+  void runMaterialisation();
+
+  // Materialises the most requested range that is not materialised yet. Returns how long to pause afterwards to
+  // stay within the CPU budget of its transformation
+  std::chrono::nanoseconds materialiseHottestRange();
+
+  void clearTrackedRanges();
+
+  // Counted by the const applyTransformation
+  mutable RewriteStatistics rewriteStatistics;
 
  public:
   // Engien is not copyable
@@ -47,8 +299,8 @@ class Engine {
   // Engine is not copyable
   Engine &operator=(Engine &) = delete;
 
-  // Engine is movable
-  Engine(Engine &&) = default;
+  // Engine is not movable as it owns the locks of the transformations and the rewrite cache
+  Engine(Engine &&) = delete;
 
   // Engine is not copyable
   Engine &operator=(Engine &&) = delete;
@@ -56,20 +308,31 @@ class Engine {
   // Default constructor
   Engine() = default;
 
-  // Default destructor
-  ~Engine() = default;
+  // Stops the background materialisation
+  ~Engine();
 
-  Expression extractOperatorsFromSelect(
-      ComplexExpression &&expr, std::vector<ComplexExpression> &conditionsToMove,
-      std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumnsDependencies,
-      std::unordered_set<Symbol> &usedSymbols);
+  Expression extractOperatorsFromSelect(ComplexExpression &&expr, std::vector<ComplexExpression> &conditionsToMove,
+                                        const ColumnDictionary &transformationColumns, ColumnSet &usedColumns) const;
 
   void getUsedSymbolsFromExpressions(const Expression &expr, std::unordered_set<Symbol> &usedSymbols,
                                      bool addAll = false);
 
-  Expression processExpression(
-      Expression &&inputExpr, std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumnsDependencies,
-      std::unordered_set<Symbol> &usedSymbols);
+  Expression processExpression(Expression &&inputExpr, std::vector<ComplexExpression> &extractedConditions,
+                               const ColumnDictionary &transformationColumns, ColumnSet &usedColumns) const;
+
+  Expression applyTransformation(
+      ComplexExpression &&expr, const TransformationPlan &plan,
+      const std::vector<std::shared_ptr<const CachedTransformationResult>> &cachedResults = {},
+      std::vector<ComplexExpression> *requestedConditions = nullptr, TransformationDecision *decision = nullptr,
+      TransformationExplanation *explanation = nullptr) const;
+
+  // Rewrites all the queries over one shared scan of the transformation, filtered by the disjunction of their
+  // conditions. The shared scan is evaluated once with the engine libraries, and each query receives the rows it
+  // selects from it, evaluated in the same engines. Without engine libraries nothing is shared: the batch returns
+  // each query rewritten as by ApplyTransformation, as an unevaluated shared scan would be scanned again by every
+  // query
+  Expression applyTransformationBatch(ComplexExpression &&queries, const TransformationPlan &plan,
+                                      const std::vector<std::string> &engineLibraries = {}) const;
 
   boss::Expression evaluate(boss::Expression &&e);
 };
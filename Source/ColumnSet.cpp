@@ -0,0 +1,70 @@
+#include "ColumnSet.hpp"
+
+#include <algorithm>
+
+namespace boss::engines::LazyTransformation {
+
+uint32_t ColumnDictionary::intern(const Symbol& column) {
+  auto [it, inserted] = ids.try_emplace(column, static_cast<uint32_t>(symbols.size()));
+  if (inserted) {
+    symbols.push_back(column);
+  }
+  return it->second;
+}
+
+uint32_t ColumnDictionary::find(const Symbol& column) const {
+  auto it = ids.find(column);
+  return it == ids.end() ? NOT_A_COLUMN : it->second;
+}
+
+ColumnSet& ColumnSet::operator|=(const ColumnSet& other) {
+  if (other.words.size() > words.size()) {
+    words.resize(other.words.size(), 0);
+  }
+  for (size_t i = 0; i < other.words.size(); ++i) {
+    words[i] |= other.words[i];
+  }
+  return *this;
+}
+
+bool ColumnSet::intersects(const ColumnSet& other) const {
+  size_t commonSize = std::min(words.size(), other.words.size());
+  for (size_t i = 0; i < commonSize; ++i) {
+    if ((words[i] & other.words[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ColumnSet::isSubsetOf(const ColumnSet& other) const {
+  for (size_t i = 0; i < words.size(); ++i) {
+    uint64_t otherWord = i < other.words.size() ? other.words[i] : 0;
+    if ((words[i] & ~otherWord) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ColumnSet::empty() const {
+  return std::all_of(words.begin(), words.end(), [](uint64_t word) { return word == 0; });
+}
+
+size_t ColumnSet::count() const {
+  size_t result = 0;
+  for (uint64_t word : words) {
+#ifdef _MSC_VER
+    result += __popcnt64(word);
+#else
+    result += __builtin_popcountll(word);
+#endif
+  }
+  return result;
+}
+
+// Sets of different capacity are equal when they hold the same ids
+bool ColumnSet::operator==(const ColumnSet& other) const {
+  return isSubsetOf(other) && other.isSubsetOf(*this);
+}
+}  // namespace boss::engines::LazyTransformation
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Expression.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using boss::Symbol;
+
+namespace boss::engines::LazyTransformation {
+
+// Returned by ColumnDictionary::find for symbols that are not columns of the transformation
+static constexpr uint32_t NOT_A_COLUMN = std::numeric_limits<uint32_t>::max();
+
+// Maps every column of a transformation to a dense id, so that sets of columns can be stored as bitsets.
+// Built once per transformation plan and only read afterwards
+class ColumnDictionary {
+ private:
+  std::unordered_map<Symbol, uint32_t> ids;
+  std::vector<Symbol> symbols;
+
+ public:
+  uint32_t intern(const Symbol &column);
+
+  uint32_t find(const Symbol &column) const;
+
+  const Symbol &getSymbol(uint32_t id) const { return symbols[id]; }
+
+  size_t size() const { return symbols.size(); }
+};
+
+// Set of column ids of a single ColumnDictionary. Unions, intersections and membership tests work a word at a time
+class ColumnSet {
+ private:
+  static constexpr size_t WORD_BITS = 64;
+  std::vector<uint64_t> words;
+
+  // Index of the lowest set bit of a word that is not 0
+  static uint32_t lowestBitIndex(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward64(&index, word);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+  }
+
+ public:
+  ColumnSet() = default;
+
+  explicit ColumnSet(size_t columnCount) : words((columnCount + WORD_BITS - 1) / WORD_BITS, 0) {}
+
+  // NOT_A_COLUMN is ignored, as the set would otherwise grow to 2^32 bits
+  void insert(uint32_t id) {
+    if (id == NOT_A_COLUMN) {
+      return;
+    }
+    if (id / WORD_BITS >= words.size()) {
+      words.resize(id / WORD_BITS + 1, 0);
+    }
+    words[id / WORD_BITS] |= uint64_t(1) << (id % WORD_BITS);
+  }
+
+  bool contains(uint32_t id) const {
+    return id / WORD_BITS < words.size() && (words[id / WORD_BITS] & (uint64_t(1) << (id % WORD_BITS))) != 0;
+  }
+
+  void clear() { std::fill(words.begin(), words.end(), 0); }
+
+  ColumnSet &operator|=(const ColumnSet &other);
+
+  bool intersects(const ColumnSet &other) const;
+
+  bool isSubsetOf(const ColumnSet &other) const;
+
+  bool empty() const;
+
+  size_t count() const;
+
+  bool operator==(const ColumnSet &other) const;
+
+  template <typename Function> void forEach(Function &&function) const {
+    for (size_t wordIndex = 0; wordIndex < words.size(); ++wordIndex) {
+      uint64_t word = words[wordIndex];
+      while (word != 0) {
+        function(static_cast<uint32_t>(wordIndex * WORD_BITS + lowestBitIndex(word)));
+        word &= word - 1;
+      }
+    }
+  }
+};
+}  // namespace boss::engines::LazyTransformation
@@ -5,8 +5,10 @@
 #include <Expression.hpp>
 #include <ExpressionUtilities.hpp>
 #include <Utilities.hpp>
+#include <algorithm>
 #include <iostream>
 #include <mutex>
+#include <type_traits>
 #include <typeinfo>
 #include <unordered_set>
 #include <variant>
@@ -30,12 +32,21 @@ bool isCardinalityReducingOperator(const Symbol& op) {
   return cardinalityReducingOps.find(op) != cardinalityReducingOps.end();
 }
 
+// Predicates on (expressions of) columns and static values, which keep the same result when evaluated earlier
+bool isPushablePredicate(const Symbol& op) {
+  static const std::unordered_set<Symbol> pushablePredicates = {
+      "Equal"_, "NotEqual"_, "Greater"_, "Less"_, "GreaterEqual"_, "LessEqual"_, "In"_, "Between"_,
+  };
+  return pushablePredicates.find(op) != pushablePredicates.end();
+}
+
 bool supportedOperator(const Symbol& op) {
   static const std::unordered_set<Symbol> supportedOps = {
       "Select"_,       "Where"_,     "Project"_, "Join"_,  "Union"_,   "Except"_,  "Intersect"_,
       "Difference"_,   "Sort"_,      "SortBy"_,  "Group"_, "GroupBy"_, "Order"_,   "OrderBy"_,
       "Table"_,        "And"_,       "Or"_,      "Not"_,   "Equal"_,   "Greater"_, "Less"_,
       "GreaterEqual"_, "LessEqual"_, "Column"_,  "List"_,  "By"_,      "Top"_,     "Limit"_,
+      "NotEqual"_,     "In"_,        "Between"_,
   };
   return supportedOps.find(op) != supportedOps.end();
 }
@@ -45,7 +56,25 @@ bool isStaticValue(const Expression& expr) {
          std::holds_alternative<float>(expr) || std::holds_alternative<double>(expr) ||
          std::holds_alternative<bool>(expr) || std::holds_alternative<std::string>(expr) ||
          (std::holds_alternative<ComplexExpression>(expr) &&
-          std::get<ComplexExpression>(expr).getHead() == "DateObject"_);
+          (std::get<ComplexExpression>(expr).getHead() == "DateObject"_ ||
+           std::get<ComplexExpression>(expr).getHead() == "Parameter"_));
+}
+
+// Structural hash: equal expressions have equal hashes. Literals only contribute their type, equality is left to
+// the comparison of the expressions
+size_t hashExpression(const Expression& expr) {
+  size_t hash = expr.index();
+  auto combine = [&hash](size_t value) { hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2); };
+  if (std::holds_alternative<Symbol>(expr)) {
+    combine(std::hash<std::string>{}(std::get<Symbol>(expr).getName()));
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    const auto& complexExpr = std::get<ComplexExpression>(expr);
+    combine(std::hash<std::string>{}(complexExpr.getHead().getName()));
+    for (const auto& arg : complexExpr.getDynamicArguments()) {
+      combine(hashExpression(arg));
+    }
+  }
+  return hash;
 }
 
 bool isInTransformationColumns(const std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns,
@@ -56,7 +85,7 @@ bool isInTransformationColumns(const std::unordered_map<Symbol, std::unordered_s
 // Places two bools in the result: one to show if extraction is possible.
 // Another to signify if need to propagate to union, except, intersect
 void verifyConditionExtraction(const Expression& inputExpression, const std::unordered_set<Symbol>& conditionColumns,
-                               std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns,
+                               const std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns,
                                std::vector<bool>& result) {
   if (std::holds_alternative<ComplexExpression>(inputExpression)) {
     const auto& inputComplexExpression = std::get<ComplexExpression>(inputExpression);
@@ -81,6 +110,10 @@ void verifyConditionExtraction(const Expression& inputExpression, const std::uno
       for (const auto& arg : inputComplexExpression.getDynamicArguments()) {
         verifyConditionExtraction(arg, conditionColumns, transformationColumns, result);
       }
+    } else if (inputComplexExpression.getHead() == "Top"_ || inputComplexExpression.getHead() == "Limit"_) {
+      // Filtering before a limit changes which rows are kept
+      result[0] = false;
+      return;
     } else if (supportedOperator(inputComplexExpression.getHead())) {
       for (const auto& arg : inputComplexExpression.getDynamicArguments()) {
         verifyConditionExtraction(arg, conditionColumns, transformationColumns, result);
@@ -99,43 +132,166 @@ void verifyConditionExtraction(const Expression& inputExpression, const std::uno
   }
 }
 
+// Adds the columns of the expression subtree to the annotation. All the properties are unions over the children,
+// so the whole subtree is accumulated into the same annotation
+static void annotateExpression(const Expression& expr, const ColumnDictionary& transformationColumns,
+                               ExpressionAnnotation& annotation) {
+  if (std::holds_alternative<ComplexExpression>(expr)) {
+    const auto& complexExpr = std::get<ComplexExpression>(expr);
+    const auto& head = complexExpr.getHead();
+    const auto& dynamics = complexExpr.getDynamicArguments();
+    if (head == "As"_) {
+      for (size_t i = 0; i + 1 < dynamics.size(); i += 2) {
+        // Only a modified column can have complexexpression
+        if (std::holds_alternative<ComplexExpression>(dynamics[i + 1])) {
+          getUsedColumnsFromExpressions(dynamics[i + 1], transformationColumns, annotation.modifiedColumns);
+        }
+      }
+    } else if (supportedOperator(head)) {
+      if (head == "Union"_ || head == "Except"_ || head == "Intersect"_ || head == "Difference"_) {
+        annotation.containsSetOperator = true;
+      } else if (head == "Top"_ || head == "Limit"_) {
+        annotation.containsLimit = true;
+      }
+      for (const auto& arg : dynamics) {
+        annotateExpression(arg, transformationColumns, annotation);
+      }
+    } else {
+      // Used in some unknown function. So extraction of any of its columns is not possible
+      getUsedColumnsFromExpressions(expr, transformationColumns, annotation.modifiedColumns);
+    }
+  }
+}
+
+// Bottom-up equivalent of verifyConditionExtraction: collects every column that would block an extraction
+// in a single traversal, instead of walking the input again for each condition
+ExpressionAnnotation annotateExpression(const Expression& expr, const ColumnDictionary& transformationColumns) {
+  ExpressionAnnotation annotation = {ColumnSet(transformationColumns.size()), false, false};
+  annotateExpression(expr, transformationColumns, annotation);
+  return annotation;
+}
+
 // Checks if the condition can be moved to the transformation query by
 // checking if the columns in the condition are in the transformation query
 // result set or are static values. Returns false if only static values are present
 std::vector<bool> isConditionMoveable(const Expression& inputExpression, const ComplexExpression& condition,
-                                      std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns,
+                                      const std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns,
                                       std::unordered_set<Symbol>& usedSymbols) {
-  if (condition.getHead() == "Greater"_ || condition.getHead() == "Equal"_) {
-    auto firstColumns = getUsedTransformationColumns(condition.getDynamicArguments()[0], transformationColumns);
-    auto secondColumns = getUsedTransformationColumns(condition.getDynamicArguments()[1], transformationColumns);
+  if (isPushablePredicate(condition.getHead())) {
+    // In and Between have more than two operands, so all of them are checked
+    std::unordered_set<Symbol> conditionColumns = {};
+    for (const auto& arg : condition.getDynamicArguments()) {
+      auto argColumns = getUsedTransformationColumns(arg, transformationColumns);
+      conditionColumns.insert(std::make_move_iterator(argColumns.begin()), std::make_move_iterator(argColumns.end()));
+    }
     // First value is whether extractable, second is whether inner Union, Except, Intersect are present
     std::vector<bool> result = {true, false};
-    if (firstColumns.find(UNEXCTRACTABLE) != firstColumns.end() ||
-        secondColumns.find(UNEXCTRACTABLE) != secondColumns.end() ||
-        (firstColumns.size() == 0 && secondColumns.size() == 0)) {
+    if (conditionColumns.find(UNEXCTRACTABLE) != conditionColumns.end() || conditionColumns.size() == 0) {
       result[0] = false;
     }
     if (!result[0]) {
       return result;
     }
-    firstColumns.insert(std::make_move_iterator(secondColumns.begin()), std::make_move_iterator(secondColumns.end()));
     // Condition might be moveable. Now have to validate by processing input
     // expression, see if it was not modified inside.
-    verifyConditionExtraction(inputExpression, firstColumns, transformationColumns, result);
+    verifyConditionExtraction(inputExpression, conditionColumns, transformationColumns, result);
     if (!result[0]) {
       return result;
     }
-    usedSymbols.insert(std::make_move_iterator(firstColumns.begin()), std::make_move_iterator(firstColumns.end()));
-    usedSymbols.insert(std::make_move_iterator(secondColumns.begin()), std::make_move_iterator(secondColumns.end()));
-    usedSymbols.erase(UNEXCTRACTABLE);
+    usedSymbols.insert(std::make_move_iterator(conditionColumns.begin()),
+                       std::make_move_iterator(conditionColumns.end()));
     return result;
   }
   return {false, false};
 }
 
+// Same as above, but checks the condition against the annotation of the already processed input expression
+std::vector<bool> isConditionMoveable(const ExpressionAnnotation& inputAnnotation, const ComplexExpression& condition,
+                                      const ColumnDictionary& transformationColumns, ColumnSet& usedColumns) {
+  if (isPushablePredicate(condition.getHead()) && !inputAnnotation.containsLimit) {
+    // First value is whether extractable, second is whether inner Union, Except, Intersect are present
+    std::vector<bool> result = {true, false};
+    ColumnSet conditionColumns(transformationColumns.size());
+    // In and Between have more than two operands, so all of them are checked
+    for (const auto& arg : condition.getDynamicArguments()) {
+      if (!getUsedTransformationColumns(arg, transformationColumns, conditionColumns)) {
+        result[0] = false;
+        return result;
+      }
+    }
+    if (conditionColumns.empty()) {
+      result[0] = false;
+      return result;
+    }
+    // Condition might be moveable if none of its columns were modified inside the input expression
+    if (conditionColumns.intersects(inputAnnotation.modifiedColumns)) {
+      result[0] = false;
+      return result;
+    }
+    result[1] = inputAnnotation.containsSetOperator;
+    usedColumns |= conditionColumns;
+    return result;
+  }
+  return {false, false};
+}
+
+// Why isConditionMoveable rejects the condition, or Moveable if it doesn't. Checks the same properties in the same
+// order, without adding to the used columns
+Symbol explainConditionMoveability(const ExpressionAnnotation& inputAnnotation, const ComplexExpression& condition,
+                                   const ColumnDictionary& transformationColumns) {
+  if (condition.getHead() == "Or"_ && !condition.getDynamicArguments().empty()) {
+    // An OR operator is only moved as a whole, so it is kept for the reason of the first predicate that can't be moved.
+    // Its branches are predicates or AND operators of predicates
+    for (const auto& branch : condition.getDynamicArguments()) {
+      if (!std::holds_alternative<ComplexExpression>(branch)) {
+        return "NotAPushablePredicate"_;
+      }
+      const auto& branchExpr = std::get<ComplexExpression>(branch);
+      std::vector<const Expression*> predicates = {&branch};
+      if (branchExpr.getHead() == "And"_) {
+        predicates.clear();
+        for (const auto& predicate : branchExpr.getDynamicArguments()) {
+          predicates.push_back(&predicate);
+        }
+      }
+      for (const auto* predicate : predicates) {
+        if (!std::holds_alternative<ComplexExpression>(*predicate) ||
+            !isPushablePredicate(std::get<ComplexExpression>(*predicate).getHead())) {
+          return "NotAPushablePredicate"_;
+        }
+        auto reason =
+            explainConditionMoveability(inputAnnotation, std::get<ComplexExpression>(*predicate), transformationColumns);
+        if (reason != "Moveable"_) {
+          return reason;
+        }
+      }
+    }
+    return "Moveable"_;
+  }
+  if (!isPushablePredicate(condition.getHead())) {
+    return "NotAPushablePredicate"_;
+  }
+  if (inputAnnotation.containsLimit) {
+    return "InputContainsLimit"_;
+  }
+  ColumnSet conditionColumns(transformationColumns.size());
+  for (const auto& arg : condition.getDynamicArguments()) {
+    if (!getUsedTransformationColumns(arg, transformationColumns, conditionColumns)) {
+      return "ConditionOnNonTransformationColumns"_;
+    }
+  }
+  if (conditionColumns.empty()) {
+    return "NoTransformationColumns"_;
+  }
+  if (conditionColumns.intersects(inputAnnotation.modifiedColumns)) {
+    return "ConditionOnModifiedColumns"_;
+  }
+  return "Moveable"_;
+}
+
 // Extracts used symbols from the expression
 void getUsedSymbolsFromExpressions(const Expression& expr, std::unordered_set<Symbol>& usedSymbols) {
-  std::unordered_map<Symbol, std::unordered_set<Symbol>> unused = {};
+  static const std::unordered_map<Symbol, std::unordered_set<Symbol>> unused = {};
   getUsedSymbolsFromExpressions(expr, usedSymbols, unused);
 }
 
@@ -144,7 +300,7 @@ void getUsedSymbolsFromExpressions(const Expression& expr, std::unordered_set<Sy
 // If transformationColumns are not empty, then only the symbols that are in the
 // transformationColumns are added
 void getUsedSymbolsFromExpressions(const Expression& expr, std::unordered_set<Symbol>& usedSymbols,
-                                   std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns) {
+                                   const std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumns) {
   if (std::holds_alternative<Symbol>(expr)) {
     Symbol symbol = std::get<Symbol>(expr);
     if (transformationColumns.size() == 0 || utilities::isInTransformationColumns(transformationColumns, symbol)) {
@@ -158,6 +314,21 @@ void getUsedSymbolsFromExpressions(const Expression& expr, std::unordered_set<Sy
   }
 }
 
+// Adds the ids of the transformation columns used in the expression. Other symbols are ignored
+void getUsedColumnsFromExpressions(const Expression& expr, const ColumnDictionary& transformationColumns,
+                                  ColumnSet& usedColumns) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    uint32_t id = transformationColumns.find(std::get<Symbol>(expr));
+    if (id != NOT_A_COLUMN) {
+      usedColumns.insert(id);
+    }
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    for (const auto& arg : std::get<ComplexExpression>(expr).getDynamicArguments()) {
+      getUsedColumnsFromExpressions(arg, transformationColumns, usedColumns);
+    }
+  }
+}
+
 // Returns a set of transformation columns that are present in the expression
 // Adds UNEXCTRACTABLE to the set if the expression contains a column that is not in the
 // transformation columns
@@ -183,6 +354,28 @@ std::unordered_set<Symbol> getUsedTransformationColumns(
   return {UNEXCTRACTABLE};
 }
 
+// Adds the ids of the transformation columns present in the expression to usedColumns
+// Returns false if the expression contains a column that is not in the transformation columns
+bool getUsedTransformationColumns(const Expression& expr, const ColumnDictionary& transformationColumns,
+                                  ColumnSet& usedColumns) {
+  if (std::holds_alternative<ComplexExpression>(expr)) {
+    for (const auto& arg : std::get<ComplexExpression>(expr).getDynamicArguments()) {
+      if (!getUsedTransformationColumns(arg, transformationColumns, usedColumns)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (std::holds_alternative<Symbol>(expr)) {
+    uint32_t id = transformationColumns.find(std::get<Symbol>(expr));
+    if (id == NOT_A_COLUMN) {
+      return false;
+    }
+    usedColumns.insert(id);
+    return true;
+  }
+  return utilities::isStaticValue(expr);
+}
+
 std::unordered_set<Symbol> getAllDependentSymbols(
     const std::unordered_map<Symbol, std::unordered_set<Symbol>>& transformationColumnsDependencies,
     const std::unordered_set<Symbol>& usedSymbols) {
@@ -193,7 +386,8 @@ std::unordered_set<Symbol> getAllDependentSymbols(
 
     std::vector<Symbol> toProcess = {symbol};
     while (!toProcess.empty()) {
-      Symbol& current = toProcess.back();
+      // Copied, as pop_back destroys the element
+      Symbol current = std::move(toProcess.back());
       toProcess.pop_back();
 
       auto it = transformationColumnsDependencies.find(current);
@@ -210,6 +404,83 @@ std::unordered_set<Symbol> getAllDependentSymbols(
   return std::move(dependentSymbols);
 }
 
+// Merges the precomputed dependency closures of the used columns
+ColumnSet getAllDependentColumns(const std::vector<ColumnSet>& columnDependencyClosures, const ColumnSet& usedColumns) {
+  ColumnSet dependentColumns(columnDependencyClosures.size());
+  usedColumns.forEach([&](uint32_t id) { dependentColumns |= columnDependencyClosures[id]; });
+  return dependentColumns;
+}
+
+static bool containsSymbols(const Expression& expr) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    return true;
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    const auto& dynamics = std::get<ComplexExpression>(expr).getDynamicArguments();
+    return std::any_of(dynamics.begin(), dynamics.end(), [](const Expression& arg) { return containsSymbols(arg); });
+  }
+  return false;
+}
+
+// Only literals are used as factors, as the sign of the factor decides the direction of inequalities
+bool getNumericLiteral(const Expression& expr, double& value) {
+  if (std::holds_alternative<int32_t>(expr)) {
+    value = std::get<int32_t>(expr);
+  } else if (std::holds_alternative<int64_t>(expr)) {
+    value = static_cast<double>(std::get<int64_t>(expr));
+  } else if (std::holds_alternative<float>(expr)) {
+    value = std::get<float>(expr);
+  } else if (std::holds_alternative<double>(expr)) {
+    value = std::get<double>(expr);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Checks if the operation is reversible, i.e. it is a column or a function of a single column that can be inverted:
+// Plus and Minus with a static value, and Times by a non-zero numeric literal
+bool isOperationReversible(const Expression& expr) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    return true;
+  }
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return false;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  if (dynamics.size() != 2 || containsSymbols(dynamics[0]) == containsSymbols(dynamics[1])) {
+    return false;
+  }
+  size_t columnIndex = containsSymbols(dynamics[0]) ? 0 : 1;
+  if (complexExpr.getHead() == "Times"_) {
+    double factor = 0;
+    if (!getNumericLiteral(dynamics[1 - columnIndex], factor) || factor == 0) {
+      return false;
+    }
+  } else if (complexExpr.getHead() != "Plus"_ && complexExpr.getHead() != "Minus"_) {
+    return false;
+  }
+  return isOperationReversible(dynamics[columnIndex]);
+}
+
+// Checks if the operation is inverted without rounding, i.e. it only adds or subtracts integer literals. Predicates
+// are only inverted through these, as e.g. Times(A, 1.1) >= 1.045 and A >= 1.045 / 1.1 differ in rounding
+static bool isOperationExactlyReversible(const Expression& expr) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    return true;
+  }
+  if (!std::holds_alternative<ComplexExpression>(expr) || !isOperationReversible(expr)) {
+    return false;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  size_t columnIndex = containsSymbols(dynamics[0]) ? 0 : 1;
+  const auto& operand = dynamics[1 - columnIndex];
+  return complexExpr.getHead() != "Times"_ &&
+         (std::holds_alternative<int32_t>(operand) || std::holds_alternative<int64_t>(operand)) &&
+         isOperationExactlyReversible(dynamics[columnIndex]);
+}
+
 bool canMoveConditionThroughProjection(const ComplexExpression& projectionOperator,
                                        const ComplexExpression& extractedCondition) {
   std::unordered_set<Symbol> extractedConditionSymbols = {};
@@ -219,55 +490,243 @@ bool canMoveConditionThroughProjection(const ComplexExpression& projectionOperat
   return canMoveConditionThroughProjection(projectionOperator, extractedCondition, extractedConditionSymbols);
 }
 
+// A Project computes every row independently, so filtering its input gives the same rows as filtering its output,
+// as long as the condition can be expressed on the input columns. That is the case when every output column used
+// by the condition is a renamed column or a function of a single column that is inverted exactly
 bool canMoveConditionThroughProjection(const ComplexExpression& projectionOperator,
-                                       const ComplexExpression& extractedCondition,
+                                       const ComplexExpression& /*extractedCondition*/,
                                        const std::unordered_set<Symbol>& extractedConditionSymbols) {
   const auto& projectionDynamics = projectionOperator.getDynamicArguments();
   const auto& projectionAsFunction = std::get<ComplexExpression>(projectionDynamics[1]);
-  bool resultColumn = true;  // Result column is every the output name column
-  bool isSymbolUsedInCondition = false;
-  Symbol currentSymbol = Symbol("Symbol");
-  for (const auto& arg : projectionAsFunction.getDynamicArguments()) {
-    if (resultColumn) {
-      currentSymbol = std::get<Symbol>(arg);
-      if (extractedConditionSymbols.find(currentSymbol) != extractedConditionSymbols.end()) {
-        isSymbolUsedInCondition = true;
+  const auto& asDynamics = projectionAsFunction.getDynamicArguments();
+  for (size_t i = 0; i + 1 < asDynamics.size(); i += 2) {
+    const auto& resultColumn = std::get<Symbol>(asDynamics[i]);
+    if (extractedConditionSymbols.find(resultColumn) != extractedConditionSymbols.end() &&
+        !isOperationExactlyReversible(asDynamics[i + 1])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Moves the outermost operation of the column side of a predicate to its static side, by applying the inverse
+// operation to every static value. Sets flipsOrder if the operation is decreasing, so inequalities have to be flipped
+static bool invertOutermostOperation(Expression& columnSide, std::vector<Expression>& staticValues, bool& flipsOrder) {
+  if (!std::holds_alternative<Symbol>(columnSide) && isOperationExactlyReversible(columnSide)) {
+    auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(columnSide)).decompose();
+    size_t columnIndex = containsSymbols(dynamics[0]) ? 0 : 1;
+    auto& operand = dynamics[1 - columnIndex];
+    for (auto& value : staticValues) {
+      auto operandCopy = operand.clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+      if (head == "Plus"_) {
+        // x + c > v  <=>  x > v - c
+        value = boss::ComplexExpression("Minus"_, {}, boss::ExpressionArguments(std::move(value), std::move(operandCopy)),
+                                        {});
+      } else if (columnIndex == 0) {
+        // x - c > v  <=>  x > v + c
+        value = boss::ComplexExpression("Plus"_, {}, boss::ExpressionArguments(std::move(value), std::move(operandCopy)),
+                                        {});
       } else {
-        isSymbolUsedInCondition = false;
+        // c - x > v  <=>  x < c - v
+        value = boss::ComplexExpression("Minus"_, {}, boss::ExpressionArguments(std::move(operandCopy), std::move(value)),
+                                        {});
       }
-      resultColumn = false;
-    } else {
-      if (!std::holds_alternative<Symbol>(arg)) {
-        std::unordered_set<Symbol> usedSymbols = {};
-        utilities::getUsedSymbolsFromExpressions(arg, usedSymbols);
-        for (const auto& symbol : extractedConditionSymbols) {
-          if (usedSymbols.find(symbol) != usedSymbols.end()) {
-            // The logic is the following: If the extracted condition symbol is used to generate some results, then
-            // altering (filtering) the symbol  will alter the results. Therefore, can't be moved
-            return false;
-          }
+    }
+    if (head == "Minus"_ && columnIndex == 1) {
+      flipsOrder = !flipsOrder;
+    }
+    columnSide = std::move(dynamics[columnIndex]);
+    return true;
+  }
+  return false;
+}
+
+// Rewrites a predicate on exactly invertible functions of a column into a predicate on the column itself
+// e.g. Greater(Plus(A, 2), 10) -> Greater(A, Minus(10, 2)). And, Or and Not are rewritten recursively.
+// Predicates that cannot be inverted exactly, e.g. through Times, are returned unchanged
+ComplexExpression invertArithmeticPredicate(ComplexExpression&& condition) {
+  static const std::unordered_map<Symbol, Symbol> flippedComparisons = {
+      {"Equal"_, "Equal"_},        {"NotEqual"_, "NotEqual"_},        {"Greater"_, "Less"_},
+      {"Less"_, "Greater"_},       {"GreaterEqual"_, "LessEqual"_},   {"LessEqual"_, "GreaterEqual"_},
+  };
+  auto [head, statics, dynamics, spans] = std::move(condition).decompose();
+  if (head == "And"_ || head == "Or"_ || head == "Not"_) {
+    for (auto& arg : dynamics) {
+      if (std::holds_alternative<ComplexExpression>(arg)) {
+        arg = invertArithmeticPredicate(std::get<ComplexExpression>(std::move(arg)));
+      }
+    }
+    return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  }
+
+  auto comparison = flippedComparisons.find(head);
+  bool isComparison = comparison != flippedComparisons.end() && dynamics.size() == 2;
+  bool isBetween = head == "Between"_ && dynamics.size() == 3;
+  bool isIn = head == "In"_ && dynamics.size() == 2 && std::holds_alternative<ComplexExpression>(dynamics[1]) &&
+              std::get<ComplexExpression>(dynamics[1]).getHead() == "List"_;
+  // Comparisons can have the column side on the right, e.g. Greater(1, A), which is mirrored to Less(A, 1)
+  size_t columnIndex = isComparison && !containsSymbols(dynamics[0]) ? 1 : 0;
+  bool isInvertible = (isComparison || isBetween || isIn) && !std::holds_alternative<Symbol>(dynamics[columnIndex]) &&
+                      isOperationExactlyReversible(dynamics[columnIndex]);
+  for (size_t i = 0; i < dynamics.size() && isInvertible; ++i) {
+    // Only predicates between a single column and static values can be inverted
+    isInvertible = i == columnIndex || !containsSymbols(dynamics[i]);
+  }
+  if (!isInvertible) {
+    return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  }
+
+  Expression columnSide = std::move(dynamics[columnIndex]);
+  std::vector<Expression> staticValues = {};
+  Symbol listHead = "List"_;
+  if (isIn) {
+    auto [inListHead, unused1, listDynamics, unused2] = std::get<ComplexExpression>(std::move(dynamics[1])).decompose();
+    listHead = std::move(inListHead);
+    for (auto& value : listDynamics) {
+      staticValues.emplace_back(std::move(value));
+    }
+  } else {
+    for (size_t i = 0; i < dynamics.size(); ++i) {
+      if (i != columnIndex) {
+        staticValues.emplace_back(std::move(dynamics[i]));
+      }
+    }
+  }
+  bool flipsOrder = isComparison && columnIndex == 1;
+  while (invertOutermostOperation(columnSide, staticValues, flipsOrder)) {
+  }
+
+  boss::ExpressionArguments newArguments = {};
+  newArguments.emplace_back(std::move(columnSide));
+  if (isIn) {
+    boss::ExpressionArguments listArguments = {};
+    for (auto& value : staticValues) {
+      listArguments.emplace_back(std::move(value));
+    }
+    newArguments.emplace_back(boss::ComplexExpression(std::move(listHead), {}, std::move(listArguments), {}));
+  } else if (isBetween && flipsOrder) {
+    newArguments.emplace_back(std::move(staticValues[1]));
+    newArguments.emplace_back(std::move(staticValues[0]));
+  } else {
+    for (auto& value : staticValues) {
+      newArguments.emplace_back(std::move(value));
+    }
+  }
+  if (isComparison && flipsOrder) {
+    head = comparison->second;
+  }
+  return boss::ComplexExpression(std::move(head), std::move(statics), std::move(newArguments), std::move(spans));
+}
+
+// Maps the output columns of an As operator to their definitions. Columns that are passed through under the same
+// name are left out, as conditions on them don't need to be rewritten
+std::unordered_map<Symbol, const Expression*> getColumnDefinitions(const ComplexExpression& asExpression) {
+  const auto& asDynamics = asExpression.getDynamicArguments();
+  std::unordered_map<Symbol, const Expression*> definitions = {};
+  for (size_t i = 0; i + 1 < asDynamics.size(); i += 2) {
+    const auto& resultColumn = std::get<Symbol>(asDynamics[i]);
+    if (!std::holds_alternative<Symbol>(asDynamics[i + 1]) || std::get<Symbol>(asDynamics[i + 1]) != resultColumn) {
+      definitions.emplace(resultColumn, &asDynamics[i + 1]);
+    }
+  }
+  return definitions;
+}
+
+static Expression replaceColumnsWithDefinitions(Expression&& expr,
+                                                const std::unordered_map<Symbol, const Expression*>& definitions) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    auto definition = definitions.find(std::get<Symbol>(expr));
+    if (definition != definitions.end()) {
+      return definition->second->clone(expressions::CloneReason::EXPRESSION_WRAPPING);
+    }
+    return std::move(expr);
+  } else if (std::holds_alternative<ComplexExpression>(expr)) {
+    auto [head, statics, dynamics, spans] = std::get<ComplexExpression>(std::move(expr)).decompose();
+    for (auto& arg : dynamics) {
+      arg = replaceColumnsWithDefinitions(std::move(arg), definitions);
+    }
+    return boss::ComplexExpression(std::move(head), std::move(statics), std::move(dynamics), std::move(spans));
+  }
+  return std::move(expr);
+}
+
+// Replaces the output columns used in the condition with their definitions. All the columns are replaced at once,
+// so swapped names, e.g. As(A, B, B, A), are handled correctly
+ComplexExpression substituteColumnDefinitions(ComplexExpression&& condition,
+                                              const std::unordered_map<Symbol, const Expression*>& definitions) {
+  if (definitions.empty()) {
+    return std::move(condition);
+  }
+  return std::get<ComplexExpression>(replaceColumnsWithDefinitions(std::move(condition), definitions));
+}
+
+// Groups the columns compared with Equal in the join condition into classes of equal columns. Every column of a class
+// that has a member among targetColumns is mapped to that member. Only equalities under And are used, as the ones
+// under Or or Not don't have to hold for every joined row
+std::unordered_map<Symbol, const Expression*> getEquivalentJoinColumns(const ComplexExpression& joinWhere,
+                                                                       const std::unordered_set<Symbol>& targetColumns) {
+  std::vector<const ComplexExpression*> toProcess = {};
+  for (const auto& arg : joinWhere.getDynamicArguments()) {
+    if (std::holds_alternative<ComplexExpression>(arg)) {
+      toProcess.push_back(&std::get<ComplexExpression>(arg));
+    }
+  }
+  std::unordered_map<Symbol, size_t> columnClasses = {};
+  std::vector<std::vector<const Expression*>> classes = {};
+  while (!toProcess.empty()) {
+    const auto* condition = toProcess.back();
+    toProcess.pop_back();
+    const auto& dynamics = condition->getDynamicArguments();
+    if (condition->getHead() == "And"_) {
+      for (const auto& arg : dynamics) {
+        if (std::holds_alternative<ComplexExpression>(arg)) {
+          toProcess.push_back(&std::get<ComplexExpression>(arg));
         }
       }
-      if (isSymbolUsedInCondition) {
-        if (!utilities::isOperationReversible(arg)) {
-          return false;
+    } else if (condition->getHead() == "Equal"_ && dynamics.size() == 2 && std::holds_alternative<Symbol>(dynamics[0]) &&
+               std::holds_alternative<Symbol>(dynamics[1])) {
+      auto first = columnClasses.try_emplace(std::get<Symbol>(dynamics[0]), classes.size());
+      if (first.second) {
+        classes.push_back({&dynamics[0]});
+      }
+      auto second = columnClasses.try_emplace(std::get<Symbol>(dynamics[1]), first.first->second);
+      if (second.second) {
+        classes[first.first->second].push_back(&dynamics[1]);
+      } else if (second.first->second != first.first->second) {
+        // Merge the class of the second column into the class of the first one
+        size_t mergedClass = second.first->second;
+        for (const auto* column : classes[mergedClass]) {
+          columnClasses[std::get<Symbol>(*column)] = first.first->second;
+          classes[first.first->second].push_back(column);
         }
+        classes[mergedClass].clear();
       }
-      resultColumn = true;
     }
   }
-  return true;
+
+  std::unordered_map<Symbol, const Expression*> equivalentColumns = {};
+  for (const auto& [column, columnClass] : columnClasses) {
+    for (const auto* equivalentColumn : classes[columnClass]) {
+      if (targetColumns.find(std::get<Symbol>(*equivalentColumn)) != targetColumns.end()) {
+        equivalentColumns.emplace(column, equivalentColumn);
+        break;
+      }
+    }
+  }
+  return equivalentColumns;
 }
 
-// Part of future work: Extend with reversing the condition when propagate through simple transformations
-// E.g. when go through "Plus"(1, "A"), update the condition to subtract 1 from "A"
-// Checks if the operation is reversible
-bool isOperationReversible(const Expression& expr) {
-  if (std::holds_alternative<Symbol>(expr)) {
-    return true;
-  } else {
-    return false;
+// Rewrites a condition on the output columns of the projection into a condition on its input columns, by replacing
+// renamed columns with their input names and computed columns with their definitions, and inverting the arithmetic
+// on them. e.g. As(B, Plus(A, 1)) and Greater(B, 5) -> Greater(A, Minus(5, 1))
+ComplexExpression rewriteConditionThroughProjection(const ComplexExpression& projectionOperator,
+                                                    ComplexExpression&& extractedCondition) {
+  const auto& projectionAsFunction = std::get<ComplexExpression>(projectionOperator.getDynamicArguments()[1]);
+  auto definitions = getColumnDefinitions(projectionAsFunction);
+  if (definitions.empty()) {
+    return std::move(extractedCondition);
   }
+  return invertArithmeticPredicate(substituteColumnDefinitions(std::move(extractedCondition), definitions));
 }
 
 void buildColumnDependencies(const ComplexExpression& expr,
@@ -288,6 +747,10 @@ void buildColumnDependencies(const ComplexExpression& expr,
           } else {
             std::unordered_set<Symbol> dependentOnSymbols = {};
             utilities::getUsedSymbolsFromExpressions(arg, dependentOnSymbols);
+            // Once projections are fused, input columns may only appear inside definitions, so they are added here
+            for (const auto& symbol : dependentOnSymbols) {
+              transformationColumnsDependencies.try_emplace(symbol);
+            }
             transformationColumnsDependencies[currentSymbol].insert(std::make_move_iterator(dependentOnSymbols.begin()),
                                                                     std::make_move_iterator(dependentOnSymbols.end()));
           }
@@ -385,4 +848,325 @@ ComplexExpression addConditionToWhereOperator(ComplexExpression&& whereOperator,
     }
   }
 }
+
+// Names of the columns produced by the expression, in order. Empty if they can't be known, e.g. for a table symbol
+std::vector<Symbol> getOutputColumns(const Expression& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return {};
+  }
+  return getOutputColumns(std::get<ComplexExpression>(expr));
+}
+
+std::vector<Symbol> getOutputColumns(const ComplexExpression& complexExpr) {
+  std::vector<Symbol> outputColumns = {};
+  const auto& head = complexExpr.getHead();
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  if (head == "Table"_) {
+    for (const auto& column : dynamics) {
+      if (std::holds_alternative<ComplexExpression>(column) &&
+          std::get<ComplexExpression>(column).getHead() == "Column"_) {
+        outputColumns.emplace_back(std::get<Symbol>(std::get<ComplexExpression>(column).getDynamicArguments()[0]));
+      }
+    }
+  } else if (head == "Project"_ || head == "Group"_) {
+    for (const auto& arg : dynamics) {
+      if (!std::holds_alternative<ComplexExpression>(arg)) {
+        continue;
+      }
+      const auto& argExpr = std::get<ComplexExpression>(arg);
+      if (argExpr.getHead() == "By"_) {
+        for (const auto& key : argExpr.getDynamicArguments()) {
+          outputColumns.emplace_back(std::get<Symbol>(key));
+        }
+      } else if (argExpr.getHead() == "As"_) {
+        const auto& asDynamics = argExpr.getDynamicArguments();
+        for (size_t i = 0; i + 1 < asDynamics.size(); i += 2) {
+          outputColumns.emplace_back(std::get<Symbol>(asDynamics[i]));
+        }
+      }
+    }
+  } else if (head == "Join"_) {
+    for (size_t i = 0; i < 2 && i < dynamics.size(); i++) {
+      auto inputColumns = getOutputColumns(dynamics[i]);
+      outputColumns.insert(outputColumns.end(), inputColumns.begin(), inputColumns.end());
+    }
+  } else if (!dynamics.empty()) {
+    // Select, Top, Sort and the set operators keep the columns of their (first) input
+    return getOutputColumns(dynamics[0]);
+  }
+  return outputColumns;
+}
+
+template <typename T> static size_t getSpanBytes(const boss::Span<T>& span) { return span.size() * sizeof(T); }
+
+// Rough size of the data held by the expression, used to keep cached results within a memory budget
+size_t estimateExpressionBytes(const Expression& expr) {
+  return std::visit(boss::utilities::overload(
+                        [](const ComplexExpression& complexExpr) -> size_t {
+                          size_t bytes = sizeof(ComplexExpression);
+                          for (const auto& arg : complexExpr.getDynamicArguments()) {
+                            bytes += estimateExpressionBytes(arg);
+                          }
+                          for (const auto& span : complexExpr.getSpanArguments()) {
+                            bytes += std::visit([](const auto& typedSpan) { return getSpanBytes(typedSpan); }, span);
+                          }
+                          return bytes;
+                        },
+                        [](const std::string& str) -> size_t { return sizeof(Expression) + str.size(); },
+                        [](const auto& /*atom*/) -> size_t { return sizeof(Expression); }),
+                    expr);
+}
+
+// Number of expressions in the tree, counting every argument as a node
+size_t countExpressionNodes(const Expression& expr) {
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return 1;
+  }
+  return countExpressionNodes(std::get<ComplexExpression>(expr));
+}
+
+size_t countExpressionNodes(const ComplexExpression& complexExpr) {
+  size_t nodes = 1;
+  for (const auto& arg : complexExpr.getDynamicArguments()) {
+    nodes += countExpressionNodes(arg);
+  }
+  return nodes;
+}
+
+static void narrowLowerBound(ColumnRange& range, double value, bool inclusive, const Expression* literal) {
+  if (value > range.low || (value == range.low && range.lowInclusive && !inclusive)) {
+    range.low = value;
+    range.lowInclusive = inclusive;
+    range.lowLiteral = literal;
+  }
+}
+
+static void narrowUpperBound(ColumnRange& range, double value, bool inclusive, const Expression* literal) {
+  if (value < range.high || (value == range.high && range.highInclusive && !inclusive)) {
+    range.high = value;
+    range.highInclusive = inclusive;
+    range.highLiteral = literal;
+  }
+}
+
+// Narrows the ranges of the columns compared with numeric literals in the condition, going through And recursively.
+// Returns false if a part of the condition is not such a comparison, i.e. the ranges select more than the condition
+bool addColumnRanges(const ComplexExpression& condition, std::unordered_map<Symbol, ColumnRange>& ranges) {
+  const auto& head = condition.getHead();
+  const auto& dynamics = condition.getDynamicArguments();
+  if (head == "And"_) {
+    bool isExact = true;
+    for (const auto& arg : dynamics) {
+      isExact = std::holds_alternative<ComplexExpression>(arg) &&
+                addColumnRanges(std::get<ComplexExpression>(arg), ranges) && isExact;
+    }
+    return isExact;
+  }
+  double value = 0;
+  double secondValue = 0;
+  if (head == "Between"_ && dynamics.size() == 3 && std::holds_alternative<Symbol>(dynamics[0]) &&
+      getNumericLiteral(dynamics[1], value) && getNumericLiteral(dynamics[2], secondValue)) {
+    auto& range = ranges[std::get<Symbol>(dynamics[0])];
+    narrowLowerBound(range, value, true, &dynamics[1]);
+    narrowUpperBound(range, secondValue, true, &dynamics[2]);
+    return true;
+  }
+  if (dynamics.size() != 2) {
+    return false;
+  }
+  // Comparisons can have the column on the right, e.g. Greater(1, A), which is read as Less(A, 1)
+  bool isMirrored = std::holds_alternative<Symbol>(dynamics[1]);
+  const auto& column = dynamics[isMirrored ? 1 : 0];
+  const auto& literal = dynamics[isMirrored ? 0 : 1];
+  if (!std::holds_alternative<Symbol>(column) || !getNumericLiteral(literal, value)) {
+    return false;
+  }
+  auto& range = ranges[std::get<Symbol>(column)];
+  bool isLowerBound = (head == "Greater"_ || head == "GreaterEqual"_) != isMirrored;
+  bool isInclusive = head == "GreaterEqual"_ || head == "LessEqual"_;
+  if (head == "Equal"_) {
+    narrowLowerBound(range, value, true, &literal);
+    narrowUpperBound(range, value, true, &literal);
+  } else if (head == "Greater"_ || head == "GreaterEqual"_ || head == "Less"_ || head == "LessEqual"_) {
+    if (isLowerBound) {
+      narrowLowerBound(range, value, isInclusive, &literal);
+    } else {
+      narrowUpperBound(range, value, isInclusive, &literal);
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool rangesOverlap(const ColumnRange& first, const ColumnRange& second) {
+  double low = std::max(first.low, second.low);
+  double high = std::min(first.high, second.high);
+  bool lowInclusive = (first.low != low || first.lowInclusive) && (second.low != low || second.lowInclusive);
+  bool highInclusive = (first.high != high || first.highInclusive) && (second.high != high || second.highInclusive);
+  return low < high || (low == high && lowInclusive && highInclusive);
+}
+
+// Whether the range has values below the ones of the covered range
+bool extendsBelow(const ColumnRange& range, const ColumnRange& coveredRange) {
+  return range.low < coveredRange.low ||
+         (range.low == coveredRange.low && range.lowInclusive && !coveredRange.lowInclusive);
+}
+
+// Whether the range has values above the ones of the covered range
+bool extendsAbove(const ColumnRange& range, const ColumnRange& coveredRange) {
+  return range.high > coveredRange.high ||
+         (range.high == coveredRange.high && range.highInclusive && !coveredRange.highInclusive);
+}
+
+// Reads the numeric columns of a Table(Column(name, List(values...)), ...) expression. The values of a List can be
+// given as arguments or in spans. Returns false if the columns have different lengths
+bool readColumnSample(const ComplexExpression& table, ColumnSample& sample) {
+  if (table.getHead() != "Table"_) {
+    return false;
+  }
+  for (const auto& column : table.getDynamicArguments()) {
+    if (!std::holds_alternative<ComplexExpression>(column)) {
+      return false;
+    }
+    const auto& columnDynamics = std::get<ComplexExpression>(column).getDynamicArguments();
+    if (columnDynamics.size() != 2 || !std::holds_alternative<Symbol>(columnDynamics[0]) ||
+        !std::holds_alternative<ComplexExpression>(columnDynamics[1])) {
+      return false;
+    }
+    const auto& list = std::get<ComplexExpression>(columnDynamics[1]);
+    std::vector<double> values = {};
+    for (const auto& value : list.getDynamicArguments()) {
+      double numericValue = 0;
+      if (!getNumericLiteral(value, numericValue)) {
+        values.clear();
+        break;
+      }
+      values.emplace_back(numericValue);
+    }
+    for (const auto& span : list.getSpanArguments()) {
+      std::visit(
+          [&values](const auto& typedSpan) {
+            using Element = std::decay_t<decltype(*typedSpan.begin())>;
+            if constexpr (std::is_arithmetic_v<Element>) {
+              for (const auto& value : typedSpan) {
+                values.emplace_back(static_cast<double>(value));
+              }
+            }
+          },
+          span);
+    }
+    // Columns that are not numeric are left out, conditions on them are not estimated
+    if (!values.empty()) {
+      if (!sample.empty() && sample.begin()->second.size() != values.size()) {
+        return false;
+      }
+      sample[std::get<Symbol>(columnDynamics[0])] = std::move(values);
+    }
+  }
+  return true;
+}
+
+static bool evaluateOnSampleRow(const Expression& expr, const ColumnSample& sample, size_t row, double& value) {
+  if (std::holds_alternative<Symbol>(expr)) {
+    auto column = sample.find(std::get<Symbol>(expr));
+    if (column == sample.end()) {
+      return false;
+    }
+    value = column->second[row];
+    return true;
+  }
+  if (getNumericLiteral(expr, value)) {
+    return true;
+  }
+  if (!std::holds_alternative<ComplexExpression>(expr)) {
+    return false;
+  }
+  const auto& complexExpr = std::get<ComplexExpression>(expr);
+  const auto& dynamics = complexExpr.getDynamicArguments();
+  double first = 0;
+  double second = 0;
+  if (dynamics.size() != 2 || !evaluateOnSampleRow(dynamics[0], sample, row, first) ||
+      !evaluateOnSampleRow(dynamics[1], sample, row, second)) {
+    return false;
+  }
+  if (complexExpr.getHead() == "Plus"_) {
+    value = first + second;
+  } else if (complexExpr.getHead() == "Minus"_) {
+    value = first - second;
+  } else if (complexExpr.getHead() == "Times"_) {
+    value = first * second;
+  } else if (complexExpr.getHead() == "Divide"_ && second != 0) {
+    value = first / second;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Whether the row of the sample satisfies the condition. Parts of the condition that can't be evaluated on the
+// sample, e.g. on columns that were not sampled, count as satisfied, so the selectivity is never underestimated
+static bool satisfiesSampleRow(const ComplexExpression& condition, const ColumnSample& sample, size_t row) {
+  const auto& head = condition.getHead();
+  const auto& dynamics = condition.getDynamicArguments();
+  auto satisfiesArgument = [&sample, row](const Expression& arg) {
+    return !std::holds_alternative<ComplexExpression>(arg) ||
+           satisfiesSampleRow(std::get<ComplexExpression>(arg), sample, row);
+  };
+  if (head == "And"_) {
+    return std::all_of(dynamics.begin(), dynamics.end(), satisfiesArgument);
+  }
+  if (head == "Or"_) {
+    return dynamics.empty() || std::any_of(dynamics.begin(), dynamics.end(), satisfiesArgument);
+  }
+  std::vector<double> values(dynamics.size());
+  for (size_t i = 0; i < dynamics.size(); ++i) {
+    bool isInList = head == "In"_ && i == 1;
+    if (!isInList && !evaluateOnSampleRow(dynamics[i], sample, row, values[i])) {
+      return true;
+    }
+  }
+  if (head == "Equal"_ && dynamics.size() == 2) {
+    return values[0] == values[1];
+  } else if (head == "NotEqual"_ && dynamics.size() == 2) {
+    return values[0] != values[1];
+  } else if (head == "Greater"_ && dynamics.size() == 2) {
+    return values[0] > values[1];
+  } else if (head == "GreaterEqual"_ && dynamics.size() == 2) {
+    return values[0] >= values[1];
+  } else if (head == "Less"_ && dynamics.size() == 2) {
+    return values[0] < values[1];
+  } else if (head == "LessEqual"_ && dynamics.size() == 2) {
+    return values[0] <= values[1];
+  } else if (head == "Between"_ && dynamics.size() == 3) {
+    return values[0] >= values[1] && values[0] <= values[2];
+  } else if (head == "In"_ && dynamics.size() == 2 && std::holds_alternative<ComplexExpression>(dynamics[1])) {
+    for (const auto& listValue : std::get<ComplexExpression>(dynamics[1]).getDynamicArguments()) {
+      double value = 0;
+      if (!evaluateOnSampleRow(listValue, sample, row, value) || value == values[0]) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+
+// Share of the sampled rows that satisfy all the conditions. Without a sample every row is assumed to satisfy them
+double estimateSelectivity(const std::vector<ComplexExpression>& conditions, const ColumnSample& sample) {
+  if (sample.empty() || sample.begin()->second.empty()) {
+    return 1.0;
+  }
+  size_t rows = sample.begin()->second.size();
+  size_t satisfyingRows = 0;
+  for (size_t row = 0; row < rows; ++row) {
+    if (std::all_of(conditions.begin(), conditions.end(), [&sample, row](const ComplexExpression& condition) {
+          return satisfiesSampleRow(condition, sample, row);
+        })) {
+      satisfyingRows++;
+    }
+  }
+  return static_cast<double>(satisfyingRows) / static_cast<double>(rows);
+}
+
 }  // namespace boss::engines::LazyTransformation::utilities
@@ -1,46 +1,99 @@
+#pragma once
+
 #include <BOSS.hpp>
 #include <Engine.hpp>
 #include <Expression.hpp>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "ColumnSet.hpp"
+
 using boss::ComplexExpression;
 using boss::Expression;
 using boss::Symbol;
 
 namespace boss::engines::LazyTransformation::utilities {
 
+// Summary of an expression subtree, computed once so that checking a condition against it is a lookup
+struct ExpressionAnnotation {
+  // Columns used to compute other columns or passed to unsupported functions. Conditions on them can't be extracted
+  ColumnSet modifiedColumns;
+  // Whether a Union, Except, Intersect or Difference operator is reachable through supported operators
+  bool containsSetOperator = false;
+  // Whether a Top or Limit operator is reachable. Filtering before them changes which rows they keep
+  bool containsLimit = false;
+};
+
+// Values of a single column selected by comparisons with numeric literals. Unbounded ends are infinite.
+// The literals point into the condition the range was read from, so they are only valid as long as it is
+struct ColumnRange {
+  double low = -std::numeric_limits<double>::infinity();
+  double high = std::numeric_limits<double>::infinity();
+  bool lowInclusive = false;
+  bool highInclusive = false;
+  const Expression *lowLiteral = nullptr;
+  const Expression *highLiteral = nullptr;
+};
+
+// Sampled values of the output columns of a transformation, used to estimate the selectivity of conditions.
+// All the columns have the same number of rows
+using ColumnSample = std::unordered_map<Symbol, std::vector<double>>;
+
 bool isCardinalityReducingOperator(const Symbol &op);
 
+bool isPushablePredicate(const Symbol &op);
+
 bool isStaticValue(const Expression &expr);
 
+bool getNumericLiteral(const Expression &expr, double &value);
+
+size_t hashExpression(const Expression &expr);
+
 bool isInTransformationColumns(const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns,
                                const Symbol &symbol);
 
-void verifyConditionExtraction(const Expression &inputExpression, const ComplexExpression &condition,
-                               std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns,
+void verifyConditionExtraction(const Expression &inputExpression, const std::unordered_set<Symbol> &conditionColumns,
+                               const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns,
                                std::vector<bool> &result);
 
+ExpressionAnnotation annotateExpression(const Expression &expr, const ColumnDictionary &transformationColumns);
+
 std::vector<bool> isConditionMoveable(const Expression &inputExpression, const ComplexExpression &condition,
-                                      std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns,
+                                      const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns,
                                       std::unordered_set<Symbol> &usedSymbols);
 
+std::vector<bool> isConditionMoveable(const ExpressionAnnotation &inputAnnotation, const ComplexExpression &condition,
+                                      const ColumnDictionary &transformationColumns, ColumnSet &usedColumns);
+
+Symbol explainConditionMoveability(const ExpressionAnnotation &inputAnnotation, const ComplexExpression &condition,
+                                   const ColumnDictionary &transformationColumns);
+
 void getUsedSymbolsFromExpressions(const Expression &expr, std::unordered_set<Symbol> &usedSymbols);
 
 void getUsedSymbolsFromExpressions(const Expression &expr, std::unordered_set<Symbol> &usedSymbols,
-                                   std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns);
+                                   const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns);
+
+void getUsedColumnsFromExpressions(const Expression &expr, const ColumnDictionary &transformationColumns,
+                                  ColumnSet &usedColumns);
 
 std::unordered_set<Symbol> getUsedTransformationColumns(
     const Expression &expr, const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumns);
 
+bool getUsedTransformationColumns(const Expression &expr, const ColumnDictionary &transformationColumns,
+                                  ColumnSet &usedColumns);
+
 std::unordered_set<Symbol> getAllDependentSymbols(
     const std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumnsDependencies,
     const std::unordered_set<Symbol> &usedSymbols);
 
+ColumnSet getAllDependentColumns(const std::vector<ColumnSet> &columnDependencyClosures, const ColumnSet &usedColumns);
+
 bool canMoveConditionThroughProjection(const ComplexExpression &projectionOperator,
                                        const ComplexExpression &extractedCondition);
 
@@ -50,6 +103,19 @@ bool canMoveConditionThroughProjection(const ComplexExpression &projectionOperat
 
 bool isOperationReversible(const Expression &expr);
 
+ComplexExpression invertArithmeticPredicate(ComplexExpression &&condition);
+
+std::unordered_map<Symbol, const Expression *> getColumnDefinitions(const ComplexExpression &asExpression);
+
+ComplexExpression substituteColumnDefinitions(ComplexExpression &&condition,
+                                              const std::unordered_map<Symbol, const Expression *> &definitions);
+
+std::unordered_map<Symbol, const Expression *> getEquivalentJoinColumns(const ComplexExpression &joinWhere,
+                                                                        const std::unordered_set<Symbol> &targetColumns);
+
+ComplexExpression rewriteConditionThroughProjection(const ComplexExpression &projectionOperator,
+                                                    ComplexExpression &&extractedCondition);
+
 void buildColumnDependencies(const ComplexExpression &expr,
                              std::unordered_map<Symbol, std::unordered_set<Symbol>> &transformationColumnsDependencies,
                              std::unordered_set<Symbol> &untouchableColumns);
@@ -59,4 +125,26 @@ Expression wrapOperatorWithSelect(Expression &&expr, ComplexExpression &&conditi
 ComplexExpression mergeConsecutiveSelectOperators(ComplexExpression &&outerSelect);
 
 ComplexExpression addConditionToWhereOperator(ComplexExpression &&whereOperator, ComplexExpression &&condition);
+
+std::vector<Symbol> getOutputColumns(const Expression &expr);
+
+std::vector<Symbol> getOutputColumns(const ComplexExpression &complexExpr);
+
+size_t estimateExpressionBytes(const Expression &expr);
+
+size_t countExpressionNodes(const Expression &expr);
+
+size_t countExpressionNodes(const ComplexExpression &complexExpr);
+
+bool addColumnRanges(const ComplexExpression &condition, std::unordered_map<Symbol, ColumnRange> &ranges);
+
+bool rangesOverlap(const ColumnRange &first, const ColumnRange &second);
+
+bool extendsBelow(const ColumnRange &range, const ColumnRange &coveredRange);
+
+bool extendsAbove(const ColumnRange &range, const ColumnRange &coveredRange);
+
+bool readColumnSample(const ComplexExpression &table, ColumnSample &sample);
+
+double estimateSelectivity(const std::vector<ComplexExpression> &conditions, const ColumnSample &sample);
 }  // namespace boss::engines::LazyTransformation::utilities
@@ -2,10 +2,15 @@
 #define CATCH_CONFIG_RUNNER
 #include <ExpressionUtilities.hpp>
 #include <array>
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <limits>
+#include <memory>
 #include <numeric>
 #include <string_view>
+#include <thread>
 #include <typeinfo>
+#include <unordered_map>
 #include <unordered_set>
 #include <variant>
 #include <vector>
@@ -24,20 +29,43 @@ using Catch::Generators::take;
 using Catch::Generators::values;
 using std::vector;
 using namespace Catch::Matchers;
+using boss::engines::LazyTransformation::ColumnDictionary;
+using boss::engines::LazyTransformation::ColumnSet;
+using boss::engines::LazyTransformation::collapseStackedGroups;
+using boss::engines::LazyTransformation::compileTransformationPlan;
+using boss::engines::LazyTransformation::eliminateCommonSubexpressions;
+using boss::engines::LazyTransformation::fuseConsecutiveProjections;
+using boss::engines::LazyTransformation::bindParameters;
+using boss::engines::LazyTransformation::instantiateTransformationPlan;
 using boss::engines::LazyTransformation::moveExctractedSelectExpressionToTransformation;
 using boss::engines::LazyTransformation::removeUnusedTransformationColumns;
+using boss::engines::LazyTransformation::NOT_A_COLUMN;
+using boss::engines::LazyTransformation::parameteriseExpression;
+using boss::engines::LazyTransformation::pushDownLimits;
 using boss::engines::LazyTransformation::replaceTransformSymbolsWithQuery;
+using boss::engines::LazyTransformation::utilities::addColumnRanges;
+using boss::engines::LazyTransformation::utilities::annotateExpression;
 using boss::engines::LazyTransformation::utilities::buildColumnDependencies;
+using boss::engines::LazyTransformation::utilities::ColumnRange;
+using boss::engines::LazyTransformation::utilities::ColumnSample;
 using boss::engines::LazyTransformation::utilities::canMoveConditionThroughProjection;
+using boss::engines::LazyTransformation::utilities::estimateSelectivity;
+using boss::engines::LazyTransformation::utilities::getAllDependentColumns;
 using boss::engines::LazyTransformation::utilities::getAllDependentSymbols;
+using boss::engines::LazyTransformation::utilities::getEquivalentJoinColumns;
 using boss::engines::LazyTransformation::utilities::getUsedSymbolsFromExpressions;
 using boss::engines::LazyTransformation::utilities::getUsedTransformationColumns;
+using boss::engines::LazyTransformation::utilities::invertArithmeticPredicate;
 using boss::engines::LazyTransformation::utilities::isCardinalityReducingOperator;
 using boss::engines::LazyTransformation::utilities::isConditionMoveable;
 using boss::engines::LazyTransformation::utilities::isInTransformationColumns;
 using boss::engines::LazyTransformation::utilities::isOperationReversible;
+using boss::engines::LazyTransformation::utilities::isPushablePredicate;
 using boss::engines::LazyTransformation::utilities::isStaticValue;
+using boss::engines::LazyTransformation::utilities::readColumnSample;
 using boss::engines::LazyTransformation::utilities::mergeConsecutiveSelectOperators;
+using boss::engines::LazyTransformation::utilities::rangesOverlap;
+using boss::engines::LazyTransformation::utilities::rewriteConditionThroughProjection;
 using boss::expressions::CloneReason;
 using boss::expressions::ComplexExpression;
 using boss::expressions::generic::get;
@@ -62,6 +90,16 @@ TEST_CASE("IsCardinalityReducingOperator works correcty", "[utilities]") {
   CHECK(isCardinalityReducingOperator(boss::Symbol("Table")) == false);
 }
 
+TEST_CASE("IsPushablePredicate works correctly", "[utilities]") {
+  for (const auto& predicate : {"Equal"_, "NotEqual"_, "Greater"_, "Less"_, "GreaterEqual"_, "LessEqual"_, "In"_,
+                                "Between"_}) {
+    CHECK(isPushablePredicate(predicate) == true);
+  }
+  CHECK(isPushablePredicate("And"_) == false);
+  CHECK(isPushablePredicate("Or"_) == false);
+  CHECK(isPushablePredicate("Plus"_) == false);
+}
+
 TEST_CASE("IsStaticValue works correcty", "[utilities]") {
   CHECK(isStaticValue(boss::Expression(1)) == true);
   CHECK(isStaticValue(boss::Expression(1.0)) == true);
@@ -94,6 +132,57 @@ TEST_CASE("IsConditionMoveable works corretly", "utilities") {
   CHECK(isConditionMoveable(inputExpression, "Greater"_("A"_, 1), transformationColumns, usedSymbols)[0] == true);
   CHECK(isConditionMoveable(inputExpression, "Equal"_("D"_, 1), transformationColumns, usedSymbols)[0] == false);
   CHECK(isConditionMoveable(inputExpression, "Equal"_("A"_, "D"_), transformationColumns, usedSymbols)[0] == false);
+  CHECK(isConditionMoveable(inputExpression, "LessEqual"_("B"_, 1), transformationColumns, usedSymbols)[0] == true);
+  CHECK(isConditionMoveable(inputExpression, "In"_("C"_, "List"_(1, 2)), transformationColumns, usedSymbols)[0] ==
+        true);
+  CHECK(isConditionMoveable(inputExpression, "Between"_("A"_, 1, "D"_), transformationColumns, usedSymbols)[0] ==
+        false);
+  CHECK(usedSymbols == std::unordered_set<boss::Symbol>{"A"_, "B"_, "C"_});
+}
+
+TEST_CASE("AnnotateExpression works correctly", "[utilities]") {
+  ColumnDictionary columns;
+  for (const auto& column : {"A"_, "B"_, "C"_, "D"_}) {
+    columns.intern(column);
+  }
+  auto columnSet = [&columns](std::vector<boss::Symbol> const& symbols) {
+    ColumnSet result(columns.size());
+    for (const auto& symbol : symbols) {
+      result.insert(columns.find(symbol));
+    }
+    return result;
+  };
+
+  SECTION("Project modifies the columns used in computations") {
+    auto annotation = annotateExpression(
+        "Project"_("Transformation"_, "As"_("D"_, "Times"_("A"_, "B"_), "C"_, "C"_)), columns);
+    CHECK(annotation.modifiedColumns == columnSet({"A"_, "B"_}));
+    CHECK_FALSE(annotation.containsSetOperator);
+  }
+
+  SECTION("Columns defined by the query are not transformation columns") {
+    auto annotation = annotateExpression(
+        "Project"_("Transformation"_, "As"_("X"_, "Plus"_("A"_, 1), "Y"_, "Column"_("Z"_, "List"_(1)))), columns);
+    CHECK(annotation.modifiedColumns == columnSet({"A"_}));
+  }
+
+  SECTION("Unknown functions modify all their columns") {
+    auto annotation = annotateExpression("Union"_("Transformation"_, "Unknown"_("A"_, 1)), columns);
+    CHECK(annotation.modifiedColumns == columnSet({"A"_}));
+    CHECK(annotation.containsSetOperator);
+  }
+
+  SECTION("Conditions are checked against the annotation") {
+    auto annotation = annotateExpression(
+        "Union"_("Transformation"_, "Project"_("Transformation"_, "As"_("D"_, "Plus"_("A"_, 1)))), columns);
+    ColumnSet usedColumns(columns.size());
+    auto result = isConditionMoveable(annotation, "Equal"_("B"_, 1), columns, usedColumns);
+    CHECK(result == std::vector<bool>{true, true});
+    CHECK(usedColumns == columnSet({"B"_}));
+    CHECK(isConditionMoveable(annotation, "Greater"_("A"_, 1), columns, usedColumns)[0] == false);
+    CHECK(isConditionMoveable(annotation, "Equal"_("E"_, 1), columns, usedColumns)[0] == false);
+    CHECK(usedColumns == columnSet({"B"_}));
+  }
 }
 
 TEST_CASE("GetUsedSymbolsFromExpressions works correctly", "[utilities]") {
@@ -172,6 +261,65 @@ TEST_CASE("GetAllDependentSymbols works correctly", "[utilities]") {
   CHECK(dependentSymbols == std::unordered_set<boss::Symbol>{"A"_, "B"_, "C"_, "D"_, "E"_, "F"_});
 }
 
+TEST_CASE("ColumnSet works correctly", "[utilities]") {
+  ColumnDictionary columns;
+  CHECK(columns.intern("A"_) == 0);
+  CHECK(columns.intern("B"_) == 1);
+  CHECK(columns.intern("A"_) == 0);
+  CHECK(columns.find("B"_) == 1);
+  CHECK(columns.find("C"_) == NOT_A_COLUMN);
+  CHECK(columns.getSymbol(1) == "B"_);
+
+  ColumnSet first(columns.size());
+  ColumnSet second(columns.size());
+  CHECK(first.empty());
+  first.insert(0);
+  second.insert(1);
+  // Ids beyond the initial capacity grow the set
+  second.insert(130);
+  // Symbols that are not columns are ignored instead of growing the set to 2^32 bits
+  second.insert(NOT_A_COLUMN);
+  CHECK(first.contains(0));
+  CHECK_FALSE(first.contains(1));
+  CHECK_FALSE(first.contains(NOT_A_COLUMN));
+  CHECK_FALSE(first.intersects(second));
+  CHECK(second.count() == 2);
+
+  first |= second;
+  CHECK(first.count() == 3);
+  CHECK(first.intersects(second));
+  CHECK(second.isSubsetOf(first));
+  CHECK_FALSE(first.isSubsetOf(second));
+
+  std::vector<uint32_t> ids = {};
+  first.forEach([&ids](uint32_t id) { ids.push_back(id); });
+  CHECK(ids == std::vector<uint32_t>{0, 1, 130});
+
+  first.clear();
+  CHECK(first.empty());
+  CHECK(first == ColumnSet());
+}
+
+TEST_CASE("GetAllDependentColumns works correctly", "[utilities]") {
+  // A depends on B, B depends on C
+  std::vector<ColumnSet> closures(4, ColumnSet(4));
+  closures[0].insert(0);
+  closures[0].insert(1);
+  closures[0].insert(2);
+  closures[1].insert(1);
+  closures[1].insert(2);
+  closures[2].insert(2);
+  closures[3].insert(3);
+  ColumnSet usedColumns(4);
+  usedColumns.insert(1);
+  usedColumns.insert(3);
+  ColumnSet expected(4);
+  expected.insert(1);
+  expected.insert(2);
+  expected.insert(3);
+  CHECK(getAllDependentColumns(closures, usedColumns) == expected);
+}
+
 TEST_CASE("CanMoveConditionThroughProjection works correctly", "[utilities]") {
   ComplexExpression projectionOperator = "Project"_(
       "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
@@ -181,9 +329,118 @@ TEST_CASE("CanMoveConditionThroughProjection works correctly", "[utilities]") {
   CHECK(canMoveConditionThroughProjection(projectionOperator, "Equal"_("D"_, 1)) == true);
   CHECK(canMoveConditionThroughProjection(projectionOperator, "Equal"_("A"_, "D"_)) == true);
   CHECK(canMoveConditionThroughProjection(projectionOperator, "Equal"_("X"_, 1)) == true);
+
+  ComplexExpression arithmeticProjectionOperator = "Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+      "As"_("D"_, "Times"_("A"_, 1.1), "E"_, "Times"_("A"_, "B"_), "A"_, "A"_, "B"_, "B"_));
+
+  // Times by a float factor rounds, so not even range predicates are moved through it
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator, "Greater"_("D"_, 1)) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator, "Greater"_("A"_, 1)) == true);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator, "Greater"_("E"_, 1)) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator, "Equal"_("D"_, 1)) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator, "In"_("D"_, "List"_(1, 2))) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator,
+                                          "And"_("Greater"_("D"_, 1), "NotEqual"_("D"_, 2))) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator,
+                                          "And"_("Greater"_("D"_, 1), "Equal"_("A"_, 2))) == false);
+  CHECK(canMoveConditionThroughProjection(arithmeticProjectionOperator,
+                                          "And"_("Greater"_("B"_, 1), "Equal"_("A"_, 2))) == true);
+
+  ComplexExpression integerProjectionOperator =
+      "Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3))), "As"_("D"_, "Plus"_("A"_, 1), "E"_, "Plus"_("A"_, 0.5)));
+
+  CHECK(canMoveConditionThroughProjection(integerProjectionOperator, "Equal"_("D"_, 1)) == true);
+  CHECK(canMoveConditionThroughProjection(integerProjectionOperator, "Equal"_("E"_, 1)) == false);
+}
+
+TEST_CASE("IsOperationReversible works correctly", "[utilities]") {
+  CHECK(true == isOperationReversible("A"_));
+  CHECK(true == isOperationReversible("Plus"_("A"_, 1)));
+  CHECK(true == isOperationReversible("Minus"_(1, "A"_)));
+  CHECK(true == isOperationReversible("Times"_("Plus"_("A"_, 1), -2.5)));
+  CHECK(false == isOperationReversible("Times"_("A"_, 0)));
+  CHECK(false == isOperationReversible("Times"_("A"_, "B"_)));
+  CHECK(false == isOperationReversible("Plus"_("A"_, "B"_)));
+  CHECK(false == isOperationReversible("Sum"_("A"_)));
+  CHECK(false == isOperationReversible(1));
 }
 
-TEST_CASE("IsOperationReversible works correctly", "[utilities]") { CHECK(true == isOperationReversible("A"_)); }
+TEST_CASE("InvertArithmeticPredicate works correctly", "[utilities]") {
+  SECTION("Predicates on columns are unchanged") {
+    CHECK(invertArithmeticPredicate("Greater"_(1, "A"_)) == "Greater"_(1, "A"_));
+    CHECK(invertArithmeticPredicate("Greater"_("Times"_("A"_, "B"_), 1)) == "Greater"_("Times"_("A"_, "B"_), 1));
+  }
+
+  SECTION("Plus and Minus") {
+    CHECK(invertArithmeticPredicate("Greater"_("Plus"_("A"_, 1), 5)) == "Greater"_("A"_, "Minus"_(5, 1)));
+    CHECK(invertArithmeticPredicate("Equal"_("Minus"_("A"_, 1), 5)) == "Equal"_("A"_, "Plus"_(5, 1)));
+    CHECK(invertArithmeticPredicate("Greater"_("Minus"_(10, "A"_), 5)) == "Less"_("A"_, "Minus"_(10, 5)));
+  }
+
+  SECTION("Predicates are only inverted through integer Plus and Minus") {
+    CHECK(invertArithmeticPredicate("Equal"_("Times"_("A"_, 0.1), 0.3)) == "Equal"_("Times"_("A"_, 0.1), 0.3));
+    CHECK(invertArithmeticPredicate("NotEqual"_("Plus"_("A"_, 0.5), 1)) == "NotEqual"_("Plus"_("A"_, 0.5), 1));
+    CHECK(invertArithmeticPredicate("Equal"_("Plus"_("Times"_("A"_, 2), 1), 7)) ==
+          "Equal"_("Plus"_("Times"_("A"_, 2), 1), 7));
+  }
+
+  SECTION("Ordering predicates are not inverted through Times") {
+    // For A = 0.95, Times(A, 1.1) >= 1.045 holds but A >= 1.045 / 1.1 does not
+    CHECK(invertArithmeticPredicate("GreaterEqual"_("Times"_("A"_, 1.1), 1.045)) ==
+          "GreaterEqual"_("Times"_("A"_, 1.1), 1.045));
+    CHECK(invertArithmeticPredicate("GreaterEqual"_("Times"_(-2, "A"_), 5)) == "GreaterEqual"_("Times"_(-2, "A"_), 5));
+    CHECK(invertArithmeticPredicate("Less"_("Plus"_("A"_, 0.1), 0.3)) == "Less"_("Plus"_("A"_, 0.1), 0.3));
+  }
+
+  SECTION("Column side on the right is mirrored") {
+    CHECK(invertArithmeticPredicate("Greater"_(5, "Plus"_("A"_, 1))) == "Less"_("A"_, "Minus"_(5, 1)));
+  }
+
+  SECTION("Nested operations, In and Between") {
+    CHECK(invertArithmeticPredicate("Less"_("Plus"_("Minus"_("A"_, 2), 1), 7)) ==
+          "Less"_("A"_, "Plus"_("Minus"_(7, 1), 2)));
+    CHECK(invertArithmeticPredicate("In"_("Plus"_("A"_, 1), "List"_(2, 3))) ==
+          "In"_("A"_, "List"_("Minus"_(2, 1), "Minus"_(3, 1))));
+    CHECK(invertArithmeticPredicate("In"_("Times"_("A"_, 2), "List"_(2, 3))) == "In"_("Times"_("A"_, 2), "List"_(2, 3)));
+    CHECK(invertArithmeticPredicate("Between"_("Minus"_(5, "A"_), 2, 3)) ==
+          "Between"_("A"_, "Minus"_(5, 3), "Minus"_(5, 2)));
+    CHECK(invertArithmeticPredicate("Between"_("Times"_("A"_, -1), 2, 3)) == "Between"_("Times"_("A"_, -1), 2, 3));
+    CHECK(invertArithmeticPredicate("And"_("Greater"_("Plus"_("A"_, 1), 5), "Equal"_("B"_, 1))) ==
+          "And"_("Greater"_("A"_, "Minus"_(5, 1)), "Equal"_("B"_, 1)));
+  }
+}
+
+TEST_CASE("GetEquivalentJoinColumns works correctly", "[utilities]") {
+  ComplexExpression joinWhere =
+      "Where"_("And"_("Equal"_("A"_, "D"_), "Equal"_("E"_, "B"_), "Equal"_("D"_, "G"_), "Greater"_("C"_, "F"_)));
+
+  auto equivalentColumns = getEquivalentJoinColumns(joinWhere, {"D"_, "E"_, "F"_});
+  CHECK(equivalentColumns.size() == 5);
+  CHECK(*equivalentColumns["A"_] == "D"_);
+  CHECK(*equivalentColumns["G"_] == "D"_);
+  CHECK(*equivalentColumns["B"_] == "E"_);
+  CHECK(equivalentColumns.find("C"_) == equivalentColumns.end());
+
+  ComplexExpression orJoinWhere = "Where"_("Or"_("Equal"_("A"_, "D"_), "Equal"_("B"_, "E"_)));
+  CHECK(getEquivalentJoinColumns(orJoinWhere, {"D"_, "E"_}).empty());
+}
+
+TEST_CASE("RewriteConditionThroughProjection works correctly", "[utilities]") {
+  ComplexExpression projectionOperator =
+      "Project"_("Transformation"_, "As"_("D"_, "Times"_("A"_, 1.1), "E"_, "Plus"_("D"_, 1), "B"_, "B"_));
+
+  CHECK(rewriteConditionThroughProjection(projectionOperator, "Greater"_("D"_, 110)) ==
+        "Greater"_("Times"_("A"_, 1.1), 110));
+  CHECK(rewriteConditionThroughProjection("Project"_("Transformation"_, "As"_("D"_, "Minus"_("A"_, 10))),
+                                          "Greater"_("D"_, 110)) == "Greater"_("A"_, "Plus"_(110, 10)));
+  CHECK(rewriteConditionThroughProjection("Project"_("Transformation"_, "As"_("X"_, "A"_, "A"_, "B"_, "B"_, "A"_)),
+                                          "And"_("Greater"_("X"_, 5), "Greater"_("A"_, "B"_))) ==
+        "And"_("Greater"_("A"_, 5), "Greater"_("B"_, "A"_)));
+  // E is computed from the input column D, not from the output column D
+  CHECK(rewriteConditionThroughProjection(projectionOperator, "And"_("Less"_("E"_, 3), "Equal"_("B"_, 1))) ==
+        "And"_("Less"_("D"_, "Minus"_(3, 1)), "Equal"_("B"_, 1)));
+}
 
 TEST_CASE("BuildColumnDependencies works correctly", "[utilities]") {
   ComplexExpression transformationExpression = "Project"_(
@@ -233,6 +490,17 @@ TEST_CASE("BuildColumnDependencies works correctly", "[utilities]") {
   CHECK(transformationColumns == std::unordered_map<boss::Symbol, std::unordered_set<boss::Symbol>>{
                                      {"D"_, {"A"_, "B"_}}, {"P"_, {"B"_, "C"_}}, {"A"_, {}}, {"B"_, {}}, {"C"_, {}}});
   CHECK(untouchableColumns == std::unordered_set<boss::Symbol>{"A"_});
+
+  // After fusing projections, input columns of a named table may only be used inside definitions
+  ComplexExpression fusedTransformation = "Project"_("TABLE"_, "As"_("D"_, "Times"_("A"_, 2), "B"_, "B"_));
+
+  transformationColumns.clear();
+  untouchableColumns.clear();
+
+  buildColumnDependencies(fusedTransformation, transformationColumns, untouchableColumns);
+
+  CHECK(transformationColumns == std::unordered_map<boss::Symbol, std::unordered_set<boss::Symbol>>{
+                                     {"TABLE"_, {}}, {"D"_, {"A"_}}, {"A"_, {}}, {"B"_, {}}});
 }
 
 TEST_CASE("MergeConsecutiveSelectOperators works correctly", "[utilities]") {
@@ -329,10 +597,16 @@ TEST_CASE("Extract operators from select works correctly") {
   auto engine = boss::engines::LazyTransformation::Engine();
 
   std::vector<ComplexExpression> conditionsToMove = {};
-  std::unordered_map<boss::Symbol, std::unordered_set<boss::Symbol>> dependencyColumns = {};
-  std::unordered_set<boss::Symbol> usedColumns = {};
-  std::unordered_set<boss::Symbol> untouchableColumns = {};
-  buildColumnDependencies(transformationExpression, dependencyColumns, untouchableColumns);
+  auto plan = compileTransformationPlan(std::move(transformationExpression));
+  const ColumnDictionary& dependencyColumns = plan->columns;
+  ColumnSet usedColumns(dependencyColumns.size());
+  auto columnSet = [&dependencyColumns](std::vector<boss::Symbol> const& symbols) {
+    ColumnSet result(dependencyColumns.size());
+    for (const auto& symbol : symbols) {
+      result.insert(dependencyColumns.find(symbol));
+    }
+    return result;
+  };
 
   SECTION("Simple case") {
     ComplexExpression simpleSelectExpression = "Select"_("Table"_(), "Where"_("Equal"_("A"_, 1)));
@@ -342,7 +616,7 @@ TEST_CASE("Extract operators from select works correctly") {
     CHECK(conditionsToMove.size() == 1);
     CHECK(conditionsToMove[0] == "Equal"_("A"_, 1));
     CHECK(updatedExpression == "Table"_());
-    CHECK(usedColumns == std::unordered_set<boss::Symbol>{"A"_});
+    CHECK(usedColumns == columnSet({"A"_}));
   }
 
   SECTION("Complex case with And removal") {
@@ -359,7 +633,7 @@ TEST_CASE("Extract operators from select works correctly") {
     CHECK(updatedExpression ==
           "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))),
                     "Where"_("Greater"_("A"_, "D"_))));
-    CHECK(usedColumns == std::unordered_set<boss::Symbol>{"A"_, "B"_, "C"_});
+    CHECK(usedColumns == columnSet({"A"_, "B"_, "C"_}));
   }
 
   SECTION("Complex case with And remain") {
@@ -375,7 +649,7 @@ TEST_CASE("Extract operators from select works correctly") {
     CHECK(updatedExpression ==
           "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))),
                     "Where"_("And"_("Equal"_("D"_, 9), "Greater"_("A"_, "D"_)))));
-    CHECK(usedColumns == std::unordered_set<boss::Symbol>{"A"_, "B"_, "C"_});
+    CHECK(usedColumns == columnSet({"A"_, "B"_, "C"_}));
   }
 
   SECTION("Complex case with Or removal") {
@@ -391,18 +665,124 @@ TEST_CASE("Extract operators from select works correctly") {
           "Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))));
   }
 
-  SECTION("Complex case with Or remain") {
-    ComplexExpression complexSelectExpressionWithAndRemain =
+  SECTION("Complex case with Or of And branches") {
+    ComplexExpression complexSelectExpressionWithAnd =
         "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))),
                   "Where"_("Or"_("And"_("Equal"_("A"_, 1), "Greater"_("C"_, 6)), "Greater"_("A"_, 2))));
 
-    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpressionWithAndRemain),
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpressionWithAnd),
                                                                      conditionsToMove, dependencyColumns, usedColumns);
     CHECK(conditionsToMove.size() == 1);
-    CHECK(conditionsToMove[0] == "Or"_("Equal"_("A"_, 1), "Greater"_("A"_, 2)));
+    CHECK(conditionsToMove[0] == "Or"_("And"_("Equal"_("A"_, 1), "Greater"_("C"_, 6)), "Greater"_("A"_, 2)));
     CHECK(updatedExpression ==
-          "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))),
-                    "Where"_("Greater"_("C"_, 6))));
+          "Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("C"_, "List"_(3))));
+  }
+
+  SECTION("Complex case with Or remain") {
+    // Only one branch uses a column that is not part of the transformation, so the whole Or has to stay
+    ComplexExpression complexSelectExpressionWithOrRemain =
+        "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("D"_, "List"_(3))),
+                  "Where"_("Or"_("And"_("Equal"_("A"_, 1), "Greater"_("D"_, 6)), "Greater"_("A"_, 2))));
+
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpressionWithOrRemain),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+    CHECK(conditionsToMove.empty());
+    CHECK(updatedExpression ==
+          "Select"_("Table"_("Column"_("A"_, "List"_(1)), "Column"_("B"_, "List"_(2)), "Column"_("D"_, "List"_(3))),
+                    "Where"_("Or"_("And"_("Equal"_("A"_, 1), "Greater"_("D"_, 6)), "Greater"_("A"_, 2)))));
+  }
+
+  SECTION("Complex case with Or remain on a modified column") {
+    // Only one branch uses a column computed by the input, so the whole Or has to stay
+    ComplexExpression complexSelectExpressionWithOrRemain =
+        "Select"_("Project"_("Table"_(), "As"_("A"_, "Plus"_("B"_, 1), "B"_, "B"_)),
+                  "Where"_("Or"_("Equal"_("B"_, 1), "Greater"_("A"_, 2))));
+
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpressionWithOrRemain),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+    CHECK(conditionsToMove.empty());
+    CHECK(updatedExpression == "Select"_("Project"_("Table"_(), "As"_("A"_, "Plus"_("B"_, 1), "B"_, "B"_)),
+                                         "Where"_("Or"_("Equal"_("B"_, 1), "Greater"_("A"_, 2)))));
+  }
+
+  SECTION("Complex case with Or inside And") {
+    ComplexExpression complexSelectExpressionWithOrInAnd =
+        "Select"_("Table"_(), "Where"_("And"_("Or"_("Equal"_("A"_, 1), "Greater"_("D"_, 2)),
+                                              "Or"_("Equal"_("B"_, 1), "Greater"_("C"_, 2)))));
+
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpressionWithOrInAnd),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+    CHECK(conditionsToMove.size() == 1);
+    CHECK(conditionsToMove[0] == "Or"_("Equal"_("B"_, 1), "Greater"_("C"_, 2)));
+    CHECK(updatedExpression == "Select"_("Table"_(), "Where"_("Or"_("Equal"_("A"_, 1), "Greater"_("D"_, 2)))));
+  }
+
+  SECTION("Simple case with LessEqual") {
+    ComplexExpression simpleSelectExpression =
+        "Select"_("Table"_(), "Where"_("LessEqual"_("B"_, "DateObject"_("1998-09-02"))));
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(simpleSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+
+    CHECK(conditionsToMove.size() == 1);
+    CHECK(conditionsToMove[0] == "LessEqual"_("B"_, "DateObject"_("1998-09-02")));
+    CHECK(updatedExpression == "Table"_());
+    CHECK(usedColumns == columnSet({"B"_}));
+  }
+
+  SECTION("Simple case with In") {
+    ComplexExpression simpleSelectExpression = "Select"_("Table"_(), "Where"_("In"_("C"_, "List"_(7, 9))));
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(simpleSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+
+    CHECK(conditionsToMove.size() == 1);
+    CHECK(conditionsToMove[0] == "In"_("C"_, "List"_(7, 9)));
+    CHECK(updatedExpression == "Table"_());
+    CHECK(usedColumns == columnSet({"C"_}));
+  }
+
+  SECTION("Simple case with Between") {
+    ComplexExpression simpleSelectExpression = "Select"_("Table"_(), "Where"_("Between"_("A"_, 1, "B"_)));
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(simpleSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+
+    CHECK(conditionsToMove.size() == 1);
+    CHECK(conditionsToMove[0] == "Between"_("A"_, 1, "B"_));
+    CHECK(updatedExpression == "Table"_());
+    CHECK(usedColumns == columnSet({"A"_, "B"_}));
+  }
+
+  SECTION("Between with a non transformation bound remains") {
+    ComplexExpression simpleSelectExpression = "Select"_("Table"_(), "Where"_("Between"_("A"_, 1, "D"_)));
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(simpleSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+
+    CHECK(conditionsToMove.size() == 0);
+    CHECK(updatedExpression == "Select"_("Table"_(), "Where"_("Between"_("A"_, 1, "D"_))));
+  }
+
+  SECTION("Complex case with And of comparisons") {
+    ComplexExpression complexSelectExpression =
+        "Select"_("Table"_(), "Where"_("And"_("NotEqual"_("A"_, 1), "GreaterEqual"_("B"_, 2), "Less"_("C"_, "D"_))));
+
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+    CHECK(conditionsToMove.size() == 2);
+    CHECK(conditionsToMove[0] == "NotEqual"_("A"_, 1));
+    CHECK(conditionsToMove[1] == "GreaterEqual"_("B"_, 2));
+    CHECK(updatedExpression == "Select"_("Table"_(), "Where"_("Less"_("C"_, "D"_))));
+    // The remaining condition still reads C
+    CHECK(usedColumns == columnSet({"A"_, "B"_, "C"_}));
+  }
+
+  SECTION("Complex case with Or of ranges") {
+    ComplexExpression complexSelectExpression =
+        "Select"_("Table"_(), "Where"_("Or"_("LessEqual"_("A"_, 1), "In"_("A"_, "List"_(5, 6)))));
+
+    Expression updatedExpression = engine.extractOperatorsFromSelect(std::move(complexSelectExpression),
+                                                                     conditionsToMove, dependencyColumns, usedColumns);
+    CHECK(conditionsToMove.size() == 1);
+    CHECK(conditionsToMove[0] == "Or"_("LessEqual"_("A"_, 1), "In"_("A"_, "List"_(5, 6))));
+    CHECK(updatedExpression == "Table"_());
   }
 
   SECTION("Extract with Union inside") {
@@ -439,6 +819,40 @@ TEST_CASE("MoveExctractedSelectExpressionToTransformation works correctly") {
                      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_)));
   }
 
+  SECTION("Propagate through invertible projections") {
+    ComplexExpression projectTransformationExpression = "Project"_(
+        "Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                   "As"_("P"_, "Minus"_("A"_, 1), "B"_, "B"_)),
+        "As"_("Q"_, "Plus"_("P"_, 10), "B"_, "B"_));
+
+    ComplexExpression rangeExpression = "Greater"_("Q"_, 120);
+    std::unordered_set<boss::Symbol> usedColumns = {"Q"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(projectTransformationExpression), std::move(rangeExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Project"_("Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                                          "Where"_("Greater"_("A"_, "Plus"_("Minus"_(120, 10), 1)))),
+                                "As"_("P"_, "Minus"_("A"_, 1), "B"_, "B"_)),
+                     "As"_("Q"_, "Plus"_("P"_, 10), "B"_, "B"_)));
+  }
+
+  SECTION("Doesn't propagate through non invertible projections") {
+    ComplexExpression projectTransformationExpression =
+        "Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                   "As"_("P"_, "Times"_("A"_, "B"_), "B"_, "B"_));
+
+    ComplexExpression rangeExpression = "Greater"_("P"_, 12);
+    std::unordered_set<boss::Symbol> usedColumns = {"P"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(projectTransformationExpression), std::move(rangeExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Select"_("Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                               "As"_("P"_, "Times"_("A"_, "B"_), "B"_, "B"_)),
+                    "Where"_("Greater"_("P"_, 12))));
+  }
+
   SECTION("Propagate through Grouped case") {
     ComplexExpression groupedTransformationExpression = "Group"_(
         "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
@@ -456,6 +870,70 @@ TEST_CASE("MoveExctractedSelectExpressionToTransformation works correctly") {
                    "By"_("A"_, "B"_, "C"_), "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_)));
   }
 
+  SECTION("Propagate range predicates through Grouped case") {
+    ComplexExpression groupedTransformationExpression = "Group"_(
+        "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+        "By"_("A"_, "B"_), "As"_("C"_, "Sum"_("C"_)));
+
+    ComplexExpression rangeExpression = "And"_("Between"_("A"_, 1, 2), "In"_("B"_, "List"_(4, 6)));
+    std::unordered_set<boss::Symbol> usedColumns = {"A"_, "B"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(groupedTransformationExpression), std::move(rangeExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Group"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                             "Where"_("And"_("Between"_("A"_, 1, 2), "In"_("B"_, "List"_(4, 6))))),
+                   "By"_("A"_, "B"_), "As"_("C"_, "Sum"_("C"_))));
+  }
+
+  SECTION("Propagate through renaming projections") {
+    ComplexExpression projectTransformationExpression =
+        "Project"_("Project"_("Table"_("Column"_("b"_, "List"_(1, 2, 3))), "As"_("c"_, "b"_)), "As"_("a"_, "c"_));
+
+    ComplexExpression greaterExpression = "Greater"_("a"_, 5);
+    std::unordered_set<boss::Symbol> usedColumns = {"a"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(projectTransformationExpression), std::move(greaterExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Project"_("Project"_("Select"_("Table"_("Column"_("b"_, "List"_(1, 2, 3))), "Where"_("Greater"_("b"_, 5))),
+                                "As"_("c"_, "b"_)),
+                     "As"_("a"_, "c"_)));
+  }
+
+  SECTION("Propagate through renamed grouping columns") {
+    ComplexExpression groupedTransformationExpression =
+        "Group"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))), "By"_("A"_),
+                 "As"_("K"_, "A"_, "S"_, "Sum"_("B"_)));
+
+    ComplexExpression equalExpression = "Equal"_("K"_, 1);
+    std::unordered_set<boss::Symbol> usedColumns = {"K"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(groupedTransformationExpression), std::move(equalExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Group"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                             "Where"_("Equal"_("A"_, 1))),
+                   "By"_("A"_), "As"_("K"_, "A"_, "S"_, "Sum"_("B"_))));
+  }
+
+  SECTION("Doesn't propagate through aggregates named as grouping columns") {
+    ComplexExpression groupedTransformationExpression =
+        "Group"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))), "By"_("A"_, "B"_),
+                 "As"_("B"_, "Sum"_("A"_)));
+
+    ComplexExpression equalExpression = "Equal"_("B"_, 1);
+    std::unordered_set<boss::Symbol> usedColumns = {"B"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(groupedTransformationExpression), std::move(equalExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Select"_("Group"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                             "By"_("A"_, "B"_), "As"_("B"_, "Sum"_("A"_))),
+                    "Where"_("Equal"_("B"_, 1))));
+  }
+
   SECTION("Doesn't propagate through Grouped case") {
     ComplexExpression groupedTransformationExpression = "Group"_(
         "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("D"_, "List"_(7, 8, 9))),
@@ -493,6 +971,27 @@ TEST_CASE("MoveExctractedSelectExpressionToTransformation works correctly") {
                   "Where"_("Equal"_("A"_, "D"_))));
   }
 
+  SECTION("Propagate through Join to both inputs") {
+    ComplexExpression joinTransformationExpression = "Join"_(
+        "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+        "Table"_("Column"_("D"_, "List"_(1, 2, 3)), "Column"_("E"_, "List"_(4, 5, 6)), "Column"_("F"_, "List"_(7, 8, 9))),
+        "Where"_("And"_("Equal"_("A"_, "D"_), "Equal"_("B"_, "E"_))));
+
+    ComplexExpression complexEqualExpression = "Or"_("Equal"_("D"_, 1), "Greater"_("E"_, 5));
+    std::unordered_set<boss::Symbol> usedColumns = {"D"_, "E"_};
+
+    ComplexExpression updatedTransformationExpression = moveExctractedSelectExpressionToTransformation(
+        std::move(joinTransformationExpression), std::move(complexEqualExpression), usedColumns);
+    CHECK(updatedTransformationExpression ==
+          "Join"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                     "Column"_("C"_, "List"_(7, 8, 9))),
+                            "Where"_("Or"_("Equal"_("A"_, 1), "Greater"_("B"_, 5)))),
+                  "Select"_("Table"_("Column"_("D"_, "List"_(1, 2, 3)), "Column"_("E"_, "List"_(4, 5, 6)),
+                                     "Column"_("F"_, "List"_(7, 8, 9))),
+                            "Where"_("Or"_("Equal"_("D"_, 1), "Greater"_("E"_, 5)))),
+                  "Where"_("And"_("Equal"_("A"_, "D"_), "Equal"_("B"_, "E"_)))));
+  }
+
   SECTION("Propagate through Join second input") {
     ComplexExpression joinTransformationExpression = "Join"_(
         "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
@@ -568,6 +1067,310 @@ TEST_CASE("RemoveUnusedTransformationColumns works correctly") {
                    "As"_("A"_, "A"_, "B"_, "B"_)));
 };
 
+TEST_CASE("CompileTransformationPlan works correctly") {
+  auto plan = compileTransformationPlan("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("D"_, "Times"_("A"_, "B"_), "A"_, "A"_, "B"_, "B"_, "C"_, "C"_)));
+
+  CHECK(plan->columnDependencies == std::unordered_map<boss::Symbol, std::unordered_set<boss::Symbol>>{
+                                        {"D"_, {"A"_, "B"_}}, {"A"_, {}}, {"B"_, {}}, {"C"_, {}}});
+  REQUIRE(plan->columns.size() == 4);
+  auto columnSet = [&plan](std::vector<boss::Symbol> const& symbols) {
+    ColumnSet result(plan->columns.size());
+    for (const auto& symbol : symbols) {
+      result.insert(plan->columns.find(symbol));
+    }
+    return result;
+  };
+  CHECK(plan->columnDependencyClosures[plan->columns.find("D"_)] == columnSet({"D"_, "A"_, "B"_}));
+  CHECK(plan->columnDependencyClosures[plan->columns.find("C"_)] == columnSet({"C"_}));
+  CHECK(plan->untouchableColumns.empty());
+  CHECK(plan->untouchableColumnSet.empty());
+
+  // Dependencies that are not interned are left out of the closures instead of growing them to NOT_A_COLUMN
+  auto tablePlan = compileTransformationPlan(
+      "Select"_("Project"_("TABLE"_, "As"_("D"_, "Times"_("A"_, 2), "B"_, "B"_)), "Where"_("Greater"_("B"_, 1))));
+  for (const auto& closure : tablePlan->columnDependencyClosures) {
+    CHECK_FALSE(closure.contains(NOT_A_COLUMN));
+  }
+  CHECK_FALSE(tablePlan->untouchableColumnSet.contains(NOT_A_COLUMN));
+
+  // The fused projection only reads A inside the definition of D, which still has to be part of its closure
+  auto fusedPlan = compileTransformationPlan(
+      "Project"_("Project"_("TABLE"_, "As"_("X"_, "A"_, "B"_, "B"_)), "As"_("D"_, "Times"_("X"_, 2), "B"_, "B"_)));
+  REQUIRE(fusedPlan->columns.find("A"_) != NOT_A_COLUMN);
+  CHECK(fusedPlan->columnDependencyClosures[fusedPlan->columns.find("D"_)].contains(fusedPlan->columns.find("A"_)));
+}
+
+TEST_CASE("InstantiateTransformationPlan works correctly") {
+  ComplexExpression transformationExpression = "Select"_(
+      "Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                          "Column"_("C"_, "List"_(7, 8, 9))),
+                 "As"_("D"_, "Times"_("A"_, "B"_), "A"_, "A"_, "B"_, "B"_, "C"_, "C"_)),
+      "Where"_("Equal"_("C"_, 7)));
+
+  ColumnDictionary columns;
+  for (const auto& column : {"A"_, "B"_, "C"_, "D"_}) {
+    columns.intern(column);
+  }
+  ColumnSet keptColumns(columns.size());
+  for (const auto& column : {"D"_, "A"_, "B"_, "C"_}) {
+    keptColumns.insert(columns.find(column));
+  }
+  ComplexExpression instantiatedExpression =
+      instantiateTransformationPlan(transformationExpression, columns, keptColumns);
+  CHECK(instantiatedExpression ==
+        "Select"_("Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                             "As"_("D"_, "Times"_("A"_, "B"_), "A"_, "A"_, "B"_, "B"_, "C"_, "C"_)),
+                  "Where"_("Equal"_("C"_, 7))));
+
+  keptColumns = ColumnSet(columns.size());
+  keptColumns.insert(columns.find("A"_));
+  instantiatedExpression = instantiateTransformationPlan(transformationExpression, columns, keptColumns);
+  CHECK(instantiatedExpression ==
+        "Select"_("Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                             "As"_("A"_, "A"_)),
+                  "Where"_("Equal"_("C"_, 7))));
+  // The plan itself is left untouched
+  CHECK(transformationExpression ==
+        "Select"_("Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                             "As"_("D"_, "Times"_("A"_, "B"_), "A"_, "A"_, "B"_, "B"_, "C"_, "C"_)),
+                  "Where"_("Equal"_("C"_, 7))));
+}
+
+TEST_CASE("CollapseStackedGroups works correctly") {
+  SECTION("Decomposable aggregates are collapsed") {
+    Expression stackedGroups =
+        "Group"_("Select"_("Group"_("Table"_(), "By"_("A"_, "B"_),
+                                    "As"_("sum_c"_, "Sum"_("Times"_("C"_, 2)), "count_c"_, "Count"_("C"_), "max_c"_,
+                                          "Max"_("C"_), "min_c"_, "Min"_("C"_))),
+                           "Where"_("Greater"_("B"_, 1))),
+                 "By"_("A"_),
+                 "As"_("sum_sum_c"_, "Sum"_("sum_c"_), "sum_count_c"_, "Sum"_("count_c"_), "max_max_c"_, "Max"_("max_c"_),
+                       "min_min_c"_, "Min"_("min_c"_), "max_b"_, "Max"_("B"_)));
+    CHECK(collapseStackedGroups(std::move(stackedGroups)) ==
+          "Group"_("Select"_("Table"_(), "Where"_("Greater"_("B"_, 1))), "By"_("A"_),
+                   "As"_("sum_sum_c"_, "Sum"_("Times"_("C"_, 2)), "sum_count_c"_, "Count"_("C"_), "max_max_c"_,
+                         "Max"_("C"_), "min_min_c"_, "Min"_("C"_), "max_b"_, "Max"_("B"_))));
+  }
+
+  SECTION("Three stacked groups are collapsed into one") {
+    Expression stackedGroups =
+        "Group"_("Group"_("Group"_("Table"_(), "By"_("A"_, "B"_, "C"_), "As"_("s1"_, "Sum"_("D"_))), "By"_("A"_, "B"_),
+                          "As"_("s2"_, "Sum"_("s1"_))),
+                 "As"_("s3"_, "Sum"_("s2"_)));
+    CHECK(collapseStackedGroups(std::move(stackedGroups)) == "Group"_("Table"_(), "As"_("s3"_, "Sum"_("D"_))));
+  }
+
+  SECTION("Non decomposable aggregates are not collapsed") {
+    auto stackedGroups = [](Expression&& outerAggregate) {
+      return "Group"_("Group"_("Table"_(), "By"_("A"_, "B"_), "As"_("avg_c"_, "Avg"_("C"_), "sum_c"_, "Sum"_("C"_))),
+                      "By"_("A"_), "As"_("result"_, std::move(outerAggregate)));
+    };
+    CHECK(collapseStackedGroups(stackedGroups("Sum"_("avg_c"_))) == stackedGroups("Sum"_("avg_c"_)));
+    CHECK(collapseStackedGroups(stackedGroups("Max"_("sum_c"_))) == stackedGroups("Max"_("sum_c"_)));
+    CHECK(collapseStackedGroups(stackedGroups("Sum"_("B"_))) == stackedGroups("Sum"_("B"_)));
+  }
+
+  SECTION("Outer keys that are not inner keys are not collapsed") {
+    Expression stackedGroups =
+        "Group"_("Group"_("Table"_(), "By"_("A"_), "As"_("sum_c"_, "Sum"_("C"_))), "By"_("sum_c"_), "As"_("n"_, "Sum"_("sum_c"_)));
+    Expression expected =
+        "Group"_("Group"_("Table"_(), "By"_("A"_), "As"_("sum_c"_, "Sum"_("C"_))), "By"_("sum_c"_), "As"_("n"_, "Sum"_("sum_c"_)));
+    CHECK(collapseStackedGroups(std::move(stackedGroups)) == expected);
+  }
+
+  SECTION("Filters on aggregates between the groups are not collapsed") {
+    Expression stackedGroups = "Group"_("Select"_("Group"_("Table"_(), "By"_("A"_, "B"_), "As"_("sum_c"_, "Sum"_("C"_))),
+                                                  "Where"_("Greater"_("sum_c"_, 1))),
+                                        "By"_("A"_), "As"_("n"_, "Sum"_("sum_c"_)));
+    Expression expected = "Group"_("Select"_("Group"_("Table"_(), "By"_("A"_, "B"_), "As"_("sum_c"_, "Sum"_("C"_))),
+                                             "Where"_("Greater"_("sum_c"_, 1))),
+                                   "By"_("A"_), "As"_("n"_, "Sum"_("sum_c"_)));
+    CHECK(collapseStackedGroups(std::move(stackedGroups)) == expected);
+  }
+}
+
+TEST_CASE("FuseConsecutiveProjections works correctly") {
+  SECTION("Inner definitions are substituted into the outer ones") {
+    Expression projections = "Project"_(
+        "Project"_("LINEITEM"_, "As"_("l_newcurrencyextendedprice"_, "Times"_("l_extendedprice"_, 1.1), "l_tax"_, "l_tax"_,
+                                      "l_discount"_, "l_discount"_, "l_partkey"_, "l_partkey"_)),
+        "As"_("profit"_, "Times"_("l_newcurrencyextendedprice"_, "Minus"_(1.0, "Plus"_("l_tax"_, "l_discount"_))),
+              "l_partkey"_, "l_partkey"_, "tax"_, "l_tax"_));
+    CHECK(fuseConsecutiveProjections(std::move(projections)) ==
+          "Project"_("LINEITEM"_,
+                     "As"_("profit"_,
+                           "Times"_("Times"_("l_extendedprice"_, 1.1), "Minus"_(1.0, "Plus"_("l_tax"_, "l_discount"_))),
+                           "l_partkey"_, "l_partkey"_, "tax"_, "l_tax"_)));
+  }
+
+  SECTION("Chains of projections are fused into one") {
+    Expression projections = "Project"_("Project"_("Project"_("Table"_(), "As"_("B"_, "A"_)), "As"_("C"_, "Plus"_("B"_, 1))),
+                                        "As"_("D"_, "C"_));
+    CHECK(fuseConsecutiveProjections(std::move(projections)) == "Project"_("Table"_(), "As"_("D"_, "Plus"_("A"_, 1))));
+  }
+
+  SECTION("Computed columns used more than once are not fused") {
+    Expression projections =
+        "Project"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2))), "As"_("C"_, "B"_, "D"_, "Plus"_("B"_, 1)));
+    Expression expected =
+        "Project"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2))), "As"_("C"_, "B"_, "D"_, "Plus"_("B"_, 1)));
+    CHECK(fuseConsecutiveProjections(std::move(projections)) == expected);
+  }
+
+  SECTION("Columns that are not produced by the inner projection are not fused") {
+    Expression projections = "Project"_("Project"_("Table"_(), "As"_("B"_, "A"_)), "As"_("C"_, "Plus"_("B"_, "X"_)));
+    Expression expected = "Project"_("Project"_("Table"_(), "As"_("B"_, "A"_)), "As"_("C"_, "Plus"_("B"_, "X"_)));
+    CHECK(fuseConsecutiveProjections(std::move(projections)) == expected);
+  }
+}
+
+TEST_CASE("EliminateCommonSubexpressions works correctly") {
+  SECTION("Shared subexpressions are computed once") {
+    Expression projection = "Project"_(
+        "LINEITEM"_, "As"_("revenue"_, "Times"_("Times"_("l_extendedprice"_, 1.1), "Minus"_(1.0, "l_discount"_)), "profit"_,
+                           "Minus"_("Times"_("l_extendedprice"_, 1.1), "l_tax"_), "price"_,
+                           "Times"_("l_extendedprice"_, 1.1), "tax"_, "l_tax"_));
+    CHECK(eliminateCommonSubexpressions(std::move(projection)) ==
+          "Project"_("Project"_("LINEITEM"_, "As"_("__cse0"_, "Times"_("l_extendedprice"_, 1.1), "l_discount"_,
+                                                   "l_discount"_, "l_tax"_, "l_tax"_)),
+                     "As"_("revenue"_, "Times"_("__cse0"_, "Minus"_(1.0, "l_discount"_)), "profit"_,
+                           "Minus"_("__cse0"_, "l_tax"_), "price"_, "__cse0"_, "tax"_, "l_tax"_)));
+  }
+
+  SECTION("The largest shared subexpression is hoisted") {
+    Expression projection =
+        "Project"_("Table"_(), "As"_("B"_, "Plus"_("Times"_("A"_, 2), 1), "C"_, "Minus"_("Plus"_("Times"_("A"_, 2), 1))));
+    CHECK(eliminateCommonSubexpressions(std::move(projection)) ==
+          "Project"_("Project"_("Table"_(), "As"_("__cse0"_, "Plus"_("Times"_("A"_, 2), 1))),
+                     "As"_("B"_, "__cse0"_, "C"_, "Minus"_("__cse0"_))));
+  }
+
+  SECTION("New columns don't clash with the columns of the transformation") {
+    Expression projection = "Project"_(
+        "Table"_("Column"_("__cse0"_, "List"_(1)), "Column"_("A"_, "List"_(2))),
+        "As"_("B"_, "Times"_("A"_, 2), "C"_, "Minus"_("Times"_("A"_, 2)), "__cse1"_, "__cse0"_));
+    CHECK(eliminateCommonSubexpressions(std::move(projection)) ==
+          "Project"_("Project"_("Table"_("Column"_("__cse0"_, "List"_(1)), "Column"_("A"_, "List"_(2))),
+                                "As"_("__cse2"_, "Times"_("A"_, 2), "__cse0"_, "__cse0"_)),
+                     "As"_("B"_, "__cse2"_, "C"_, "Minus"_("__cse2"_), "__cse1"_, "__cse0"_)));
+  }
+
+  SECTION("Projections without shared subexpressions are unchanged") {
+    Expression projection = "Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2), "C"_, "Times"_("A"_, 3), "D"_, "A"_));
+    Expression expected = "Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2), "C"_, "Times"_("A"_, 3), "D"_, "A"_));
+    CHECK(eliminateCommonSubexpressions(std::move(projection)) == expected);
+  }
+}
+
+TEST_CASE("Evaluate computes shared subexpressions once") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_(
+      "Project"_("Table"_("Column"_("p"_, "List"_(1, 2, 3)), "Column"_("t"_, "List"_(4, 5, 6))),
+                 "As"_("revenue"_, "Times"_("Times"_("p"_, 1.1), 2), "profit"_, "Minus"_("Times"_("p"_, 1.1), "t"_)))));
+
+  SECTION("Shared column is kept when used more than once") {
+    auto result = engine.evaluate("ApplyTransformation"_("Project"_("Transformation"_, "As"_("revenue"_, "revenue"_,
+                                                                                              "profit"_, "profit"_))));
+    CHECK(result == "Project"_("Project"_("Table"_("Column"_("p"_, "List"_(1, 2, 3)), "Column"_("t"_, "List"_(4, 5, 6))),
+                                          "As"_("__cse0"_, "Times"_("p"_, 1.1), "t"_, "t"_)),
+                               "As"_("revenue"_, "Times"_("__cse0"_, 2), "profit"_, "Minus"_("__cse0"_, "t"_))));
+  }
+
+  SECTION("Shared column used once after pruning is fused back") {
+    auto result =
+        engine.evaluate("ApplyTransformation"_("Project"_("Transformation"_, "As"_("revenue"_, "revenue"_))));
+    CHECK(result == "Project"_("Table"_("Column"_("p"_, "List"_(1, 2, 3)), "Column"_("t"_, "List"_(4, 5, 6))),
+                               "As"_("revenue"_, "Times"_("Times"_("p"_, 1.1), 2))));
+  }
+}
+
+TEST_CASE("PushDownLimits works correctly") {
+  SECTION("Limit is pushed below projections") {
+    Expression query = "Limit"_("Project"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2))), "As"_("C"_, "B"_)), 10);
+    CHECK(pushDownLimits(std::move(query)) ==
+          "Project"_("Project"_("Limit"_("Table"_(), 10), "As"_("B"_, "Times"_("A"_, 2))), "As"_("C"_, "B"_)));
+  }
+
+  SECTION("Top is pushed below projections passing its keys through") {
+    Expression query = "Top"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2), "D"_, "A"_, "E"_, "E"_)),
+                              "By"_("D"_, "desc"_, "E"_), 10);
+    CHECK(pushDownLimits(std::move(query)) ==
+          "Project"_("Top"_("Table"_(), "By"_("A"_, "desc"_, "E"_), 10),
+                     "As"_("B"_, "Times"_("A"_, 2), "D"_, "A"_, "E"_, "E"_)));
+  }
+
+  SECTION("Top is not pushed below projections computing its keys") {
+    Expression query = "Top"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2), "D"_, "A"_)), "By"_("B"_), 10);
+    Expression expected = "Top"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2), "D"_, "A"_)), "By"_("B"_), 10);
+    CHECK(pushDownLimits(std::move(query)) == expected);
+  }
+
+  SECTION("Limits are not pushed below operators changing which rows come first") {
+    Expression query = "Limit"_(
+        "Project"_("Select"_("Table"_(), "Where"_("Greater"_("A"_, 1))), "As"_("B"_, "Times"_("A"_, 2))), 10);
+    CHECK(pushDownLimits(std::move(query)) ==
+          "Project"_("Limit"_("Select"_("Table"_(), "Where"_("Greater"_("A"_, 1))), 10),
+                     "As"_("B"_, "Times"_("A"_, 2))));
+    Expression groupQuery = "Limit"_("Group"_("Table"_(), "By"_("A"_), "As"_("S"_, "Sum"_("B"_))), 10);
+    Expression expectedGroupQuery = "Limit"_("Group"_("Table"_(), "By"_("A"_), "As"_("S"_, "Sum"_("B"_))), 10);
+    CHECK(pushDownLimits(std::move(groupQuery)) == expectedGroupQuery);
+  }
+
+  SECTION("Limits are pushed together with the Select below them") {
+    Expression query = "Limit"_(
+        "Select"_("Project"_("Table"_(), "As"_("B"_, "Plus"_("A"_, 2))), "Where"_("Greater"_("B"_, 1))), 10);
+    CHECK(pushDownLimits(std::move(query)) ==
+          "Project"_("Limit"_("Select"_("Table"_(), "Where"_("Greater"_("A"_, "Minus"_(1, 2)))), 10),
+                     "As"_("B"_, "Plus"_("A"_, 2))));
+    Expression topQuery =
+        "Top"_("Select"_("Project"_("Table"_(), "As"_("D"_, "A"_, "B"_, "Times"_("A"_, 2))), "Where"_("Equal"_("D"_, 3))),
+               "By"_("D"_), 5);
+    CHECK(pushDownLimits(std::move(topQuery)) ==
+          "Project"_("Top"_("Select"_("Table"_(), "Where"_("Equal"_("A"_, 3))), "By"_("A"_), 5),
+                     "As"_("D"_, "A"_, "B"_, "Times"_("A"_, 2))));
+  }
+
+  SECTION("Limits stay above a Select that can't be moved below the projection") {
+    Expression query = "Limit"_(
+        "Select"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2))), "Where"_("Equal"_("B"_, 1))), 10);
+    Expression expected = "Limit"_(
+        "Select"_("Project"_("Table"_(), "As"_("B"_, "Times"_("A"_, 2))), "Where"_("Equal"_("B"_, 1))), 10);
+    CHECK(pushDownLimits(std::move(query)) == expected);
+  }
+}
+
+TEST_CASE("Evaluate pushes limits into the transformation") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_(
+      "Project"_("Table"_("Column"_("price"_, "List"_(1, 2, 3)), "Column"_("key"_, "List"_(4, 5, 6))),
+                 "As"_("eur_price"_, "price"_, "usd_price"_, "Times"_("price"_, 2), "key"_, "key"_))));
+
+  SECTION("Top on a renamed column is computed before the projection") {
+    auto result = engine.evaluate(
+        "ApplyTransformation"_("Top"_("Transformation"_, "By"_("eur_price"_, "desc"_), 2)));
+    CHECK(result ==
+          "Project"_("Top"_("Table"_("Column"_("price"_, "List"_(1, 2, 3)), "Column"_("key"_, "List"_(4, 5, 6))),
+                            "By"_("price"_, "desc"_), 2),
+                     "As"_("eur_price"_, "price"_)));
+  }
+
+  SECTION("Conditions over a limit are not moved below it") {
+    auto result = engine.evaluate("ApplyTransformation"_(
+        "Select"_("Top"_("Transformation"_, "By"_("usd_price"_), 2), "Where"_("Greater"_("key"_, 4)))));
+    CHECK(result ==
+          "Select"_("Top"_("Project"_("Table"_("Column"_("price"_, "List"_(1, 2, 3)),
+                                               "Column"_("key"_, "List"_(4, 5, 6))),
+                                      "As"_("usd_price"_, "Times"_("price"_, 2), "key"_, "key"_)),
+                           "By"_("usd_price"_), 2),
+                    "Where"_("Greater"_("key"_, 4))));
+  }
+}
+
 TEST_CASE("ReplaceTransformSymbolsWithQuery") {
   ComplexExpression transformationExpression = "Project"_(
       "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
@@ -628,6 +1431,16 @@ TEST_CASE("GetTransformation works correctly") {
   CHECK(transformation == "Project"_("Table"_("Column"_("D"_, "List"_(1, 2, 3)), "Column"_("E"_, "List"_(4, 5, 6)),
                                               "Column"_("F"_, "List"_(7, 8, 9))),
                                      "As"_("D"_, "D"_, "E"_, "E"_, "F"_, "F"_)));
+
+  // Transformations are returned as they were added, not as they were optimised
+  ComplexExpression optimisableTransformation =
+      "Project"_("Project"_("Table"_("Column"_("p"_, "List"_(1, 2, 3)), "Column"_("t"_, "List"_(4, 5, 6))),
+                            "As"_("q"_, "p"_, "t"_, "t"_)),
+                 "As"_("revenue"_, "Times"_("Times"_("q"_, 1.1), 2), "profit"_, "Minus"_("Times"_("q"_, 1.1), "t"_)));
+  Expression expectedTransformation = optimisableTransformation.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING);
+  result = engine.evaluate("AddTransformation"_(std::move(optimisableTransformation)));
+  CHECK(result == expected);
+  CHECK(engine.evaluate("GetTransformation"_(2)) == expectedTransformation);
 }
 
 TEST_CASE("RemoveTransformation works correctly") {
@@ -703,15 +1516,460 @@ TEST_CASE("Evaluate works correctly") {
                                          "Where"_("Equal"_("A"_, 8))));
     Expression updatedUserExpression = engine.evaluate(std::move(userExpression));
 
+    // The projection of the query is fused with the projection of the transformation
     CHECK(updatedUserExpression ==
-          "Project"_("Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
-                                                   "Column"_("C"_, "List"_(7, 8, 9))),
-                                          "Where"_("And"_("Greater"_("A"_, 2), "Greater"_("B"_, "C"_), "Equal"_("A"_, 8)))),
-                                "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_)),
+          "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                        "Column"_("C"_, "List"_(7, 8, 9))),
+                               "Where"_("And"_("Greater"_("A"_, 2), "Greater"_("B"_, "C"_), "Equal"_("A"_, 8)))),
                      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_)));
   }
 }
 
+TEST_CASE("Evaluate pushes conditions through renamed columns") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_(
+      "Project"_("Table"_("Column"_("price"_, "List"_(1, 2, 3)), "Column"_("key"_, "List"_(4, 5, 6))),
+                 "As"_("eur_price"_, "price"_, "usd_price"_, "Plus"_("price"_, 2), "key"_, "key"_))));
+
+  Expression userExpression = "ApplyTransformation"_(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("eur_price"_, 1), "Less"_("usd_price"_, 5)))));
+  Expression updatedUserExpression = engine.evaluate(std::move(userExpression));
+
+  CHECK(updatedUserExpression ==
+        "Project"_("Select"_("Table"_("Column"_("price"_, "List"_(1, 2, 3)), "Column"_("key"_, "List"_(4, 5, 6))),
+                             "Where"_("And"_("Greater"_("price"_, 1), "Less"_("price"_, "Minus"_(5, 2))))),
+                   "As"_("eur_price"_, "price"_, "usd_price"_, "Plus"_("price"_, 2))));
+}
+
+TEST_CASE("Engine stats count rewrites") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))), "As"_("A"_, "A"_, "B"_, "B"_))));
+  CHECK(engine.evaluate("SetLazyTransformationEngineNodeStats"_(true)) == "Node stats set successfully"_);
+  engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 1)))));
+
+  auto stats = get<ComplexExpression>(engine.evaluate("GetLazyTransformationEngineStats"_()));
+  const auto& phases = get<ComplexExpression>(stats.getDynamicArguments()[0]);
+  CHECK(phases.getDynamicArguments().size() == 6);
+  CHECK(get<ComplexExpression>(phases.getDynamicArguments()[0]).getHead() == "ExtractConditions"_);
+  CHECK(get<ComplexExpression>(phases.getDynamicArguments()[0]).getDynamicArguments()[1] == "Calls"_(int64_t(1)));
+  CHECK(stats.getDynamicArguments()[1] == "Rewrites"_(int64_t(1)));
+  // Select(Transformation, Where(Greater(A, Parameter(0)))), as literals are replaced for the rewrite cache
+  CHECK(stats.getDynamicArguments()[2] == "QueryNodes"_(int64_t(7)));
+
+  CHECK(engine.evaluate("ResetLazyTransformationEngineStats"_()) == "Stats reset successfully"_);
+  auto resetStats = get<ComplexExpression>(engine.evaluate("GetLazyTransformationEngineStats"_()));
+  CHECK(resetStats.getDynamicArguments()[1] == "Rewrites"_(int64_t(0)));
+  CHECK(resetStats.getDynamicArguments()[5] == "AllocatedBytes"_(int64_t(0)));
+
+  // Without node stats only the phases and rewrites are counted and reported
+  CHECK(engine.evaluate("SetLazyTransformationEngineNodeStats"_(false)) == "Node stats set successfully"_);
+  engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Less"_("B"_, 5)))));
+  auto countedStats = get<ComplexExpression>(engine.evaluate("GetLazyTransformationEngineStats"_()));
+  CHECK(countedStats.getDynamicArguments().size() == 2);
+  CHECK(countedStats.getDynamicArguments()[1] == "Rewrites"_(int64_t(1)));
+  CHECK(engine.evaluate("SetLazyTransformationEngineNodeStats"_(1)) ==
+        "Error"_("Node stats must be enabled with a bool"_));
+}
+
+TEST_CASE("ParameteriseExpression works correctly") {
+  boss::ExpressionArguments firstParameters = {};
+  std::string firstShapeKey = "";
+  Expression firstExpression = parameteriseExpression(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, 1), "Equal"_("B"_, "DateObject"_("1998-08-02"))))),
+      firstParameters, firstShapeKey);
+  CHECK(firstExpression ==
+        "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, "Parameter"_(0)), "Equal"_("B"_, "Parameter"_(1))))));
+  CHECK(firstParameters.size() == 2);
+  CHECK(firstParameters[0] == Expression(1));
+  CHECK(firstParameters[1] == "DateObject"_("1998-08-02"));
+
+  boss::ExpressionArguments secondParameters = {};
+  std::string secondShapeKey = "";
+  parameteriseExpression(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, 5), "Equal"_("B"_, "DateObject"_("1995-01-01"))))),
+      secondParameters, secondShapeKey);
+  CHECK(firstShapeKey == secondShapeKey);
+
+  // Different literal types produce different shapes
+  boss::ExpressionArguments thirdParameters = {};
+  std::string thirdShapeKey = "";
+  parameteriseExpression("Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, 5.0), "Equal"_("B"_, "C"_)))),
+                         thirdParameters, thirdShapeKey);
+  CHECK(firstShapeKey != thirdShapeKey);
+
+  // int8_t values stay in place, so they are part of the shape
+  std::vector<std::string> int8ShapeKeys(3);
+  for (auto value : {0, 1, 2}) {
+    boss::ExpressionArguments int8Parameters = {};
+    Expression int8Expression = parameteriseExpression("Greater"_("A"_, static_cast<int8_t>(value / 2)), int8Parameters,
+                                                       int8ShapeKeys[value]);
+    CHECK(int8Expression == "Greater"_("A"_, static_cast<int8_t>(value / 2)));
+    CHECK(int8Parameters.empty());
+  }
+  CHECK(int8ShapeKeys[0] == int8ShapeKeys[1]);
+  CHECK(int8ShapeKeys[0] != int8ShapeKeys[2]);
+
+  Expression boundExpression = bindParameters("Union"_("Greater"_("A"_, "Parameter"_(0)), "Greater"_("A"_, "Parameter"_(0))),
+                                              secondParameters);
+  CHECK(boundExpression == "Union"_("Greater"_("A"_, 5), "Greater"_("A"_, 5)));
+}
+
+TEST_CASE("Rewrite cache works correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+
+  Expression firstResult =
+      engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 1)))));
+  Expression secondResult =
+      engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 2)))));
+  CHECK(firstResult == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                                     "Column"_("C"_, "List"_(7, 8, 9))),
+                                            "Where"_("Greater"_("A"_, 1))),
+                                  "As"_("A"_, "A"_)));
+  CHECK(secondResult == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                                             "Where"_("Greater"_("A"_, 2))),
+                                   "As"_("A"_, "A"_)));
+  CHECK(engine.evaluate("GetLazyTransformationEngineCacheStats"_()) ==
+        "List"_("Hits"_(int64_t(1)), "Misses"_(int64_t(1)), "Entries"_(int64_t(1))));
+
+  // Queries that already contain Parameter slots are rewritten without the cache
+  Expression parameterResult = engine.evaluate("ApplyTransformation"_(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, "Parameter"_(0)), "Equal"_("B"_, "Parameter"_("B"_)))))));
+  CHECK(parameterResult ==
+        "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                      "Column"_("C"_, "List"_(7, 8, 9))),
+                             "Where"_("And"_("Greater"_("A"_, "Parameter"_(0)), "Equal"_("B"_, "Parameter"_("B"_))))),
+                   "As"_("A"_, "A"_, "B"_, "B"_)));
+  CHECK(engine.evaluate("GetLazyTransformationEngineCacheStats"_()) ==
+        "List"_("Hits"_(int64_t(1)), "Misses"_(int64_t(1)), "Entries"_(int64_t(1))));
+
+  // Changing the registered transformations invalidates the cached rewrites
+  engine.evaluate("RemoveAllTransformations"_());
+  CHECK(engine.evaluate("GetLazyTransformationEngineCacheStats"_()) ==
+        "List"_("Hits"_(int64_t(1)), "Misses"_(int64_t(1)), "Entries"_(int64_t(0))));
+}
+
+TEST_CASE("ExplainTransformation works correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+
+  auto result = engine.evaluate("ExplainTransformation"_(
+      "Project"_("Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, 1), "Equal"_("D"_, 2)))),
+                 "As"_("A"_, "A"_, "D"_, "D"_))));
+  CHECK(result ==
+        "List"_("ExtractedConditions"_("Condition"_("Greater"_("A"_, 1),
+                                                    "PushedThrough"_("Project"_, "StoppedAt"_("Table"_, "ReachedInput"_)))),
+                "KeptConditions"_("Condition"_("Equal"_("D"_, 2), "ConditionOnNonTransformationColumns"_)),
+                "DroppedColumns"_("B"_, "C"_), "EstimatedSavings"_("DroppedColumns"_(2.0 / 3), "FilteredRows"_("Unknown"_)),
+                "Strategy"_("Lazy"_),
+                "Plan"_("Project"_("Select"_("Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)),
+                                                                           "Column"_("B"_, "List"_(4, 5, 6)),
+                                                                           "Column"_("C"_, "List"_(7, 8, 9))),
+                                                                  "Where"_("Greater"_("A"_, 1))),
+                                                        "As"_("A"_, "A"_)),
+                                             "Where"_("Equal"_("D"_, 2))),
+                                   "As"_("A"_, "A"_, "D"_, "D"_)))));
+
+  // Or conditions are extracted as a whole, or kept for the reason of the branch that can't be moved
+  auto orResult = engine.evaluate("ExplainTransformation"_("Select"_(
+      "Transformation"_, "Where"_("And"_("Or"_("Greater"_("A"_, 1), "Less"_("B"_, 5)),
+                                         "Or"_("And"_("Greater"_("A"_, 2), "Equal"_("D"_, 2)), "Less"_("C"_, 8)))))));
+  REQUIRE(std::holds_alternative<boss::ComplexExpression>(orResult));
+  const auto& orExplanation = std::get<boss::ComplexExpression>(orResult).getDynamicArguments();
+  CHECK(orExplanation[0] == "ExtractedConditions"_("Condition"_("Or"_("Greater"_("A"_, 1), "Less"_("B"_, 5)),
+                                                                "PushedThrough"_("Project"_,
+                                                                                 "StoppedAt"_("Table"_, "ReachedInput"_)))));
+  CHECK(orExplanation[1] ==
+        "KeptConditions"_("Condition"_("Or"_("And"_("Greater"_("A"_, 2), "Equal"_("D"_, 2)), "Less"_("C"_, 8)),
+                                       "ConditionOnNonTransformationColumns"_)));
+}
+
+TEST_CASE("Prepared transformations work correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+
+  auto handle = engine.evaluate("PrepareTransformation"_(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, "Parameter"_(0)), "Less"_("B"_, "Parameter"_(1)))))));
+  CHECK(handle == "PreparedTransformation"_(int64_t(0)));
+  for (auto [low, high] : std::vector<std::pair<int, int>>{{1, 6}, {2, 5}}) {
+    auto result = engine.evaluate(
+        "ExecutePrepared"_(handle.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING), "List"_(low, high)));
+    CHECK(result == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                                  "Column"_("C"_, "List"_(7, 8, 9))),
+                                         "Where"_("And"_("Greater"_("A"_, low), "Less"_("B"_, high)))),
+                               "As"_("A"_, "A"_, "B"_, "B"_)));
+  }
+  CHECK(engine.evaluate("ExecutePrepared"_(handle.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING),
+                                           "List"_(1))) == "Error"_("Wrong number of parameters"_));
+
+  // Prepared queries are not rewritten again when the transformations change
+  engine.evaluate("RemoveAllTransformations"_());
+  CHECK(engine.evaluate("ExecutePrepared"_(handle.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING),
+                                           "List"_(1, 6))) == "Error"_("Prepared transformation is outdated"_));
+  CHECK(engine.evaluate("ReleasePreparedTransformation"_(std::move(handle))) ==
+        "Prepared transformation released successfully"_);
+
+  // Malformed handles are rejected instead of being read as int64
+  CHECK(engine.evaluate("ExecutePrepared"_("PreparedTransformation"_("A"_), "List"_(1, 6))) ==
+        "Error"_("Prepared transformations are executed with a handle and a List of parameters"_));
+  CHECK(engine.evaluate("ExecutePrepared"_("PreparedTransformation"_(), "List"_(1, 6))) ==
+        "Error"_("Prepared transformations are executed with a handle and a List of parameters"_));
+  CHECK(engine.evaluate("ExecutePrepared"_("PreparedTransformation"_(0), "List"_(1, 6))) ==
+        "Error"_("Unknown prepared transformation"_));
+  CHECK(engine.evaluate("ReleasePreparedTransformation"_("PreparedTransformation"_(1.5))) ==
+        "Error"_("Prepared transformations are released with a handle"_));
+}
+
+TEST_CASE("Concurrent ApplyTransformation works correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+
+  std::vector<int> mismatches(4, 0);
+  std::vector<std::thread> threads = {};
+  for (int thread = 0; thread < mismatches.size(); ++thread) {
+    threads.emplace_back([&engine, &mismatches, thread]() {
+      for (int i = 0; i < 100; ++i) {
+        Expression result = engine.evaluate(
+            "ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("B"_, thread * 100 + i)))));
+        Expression expected =
+            "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                          "Column"_("C"_, "List"_(7, 8, 9))),
+                                 "Where"_("Greater"_("B"_, thread * 100 + i))),
+                       "As"_("B"_, "B"_));
+        if (result != expected) {
+          mismatches[thread]++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK(mismatches == std::vector<int>{0, 0, 0, 0});
+}
+
+extern "C" void reset();
+
+TEST_CASE("Reset doesn't destroy the engine during evaluations") {
+  auto evaluateInEngine = [](Expression&& expression) {
+    BOSSExpression input{std::move(expression)};
+    std::unique_ptr<BOSSExpression> result(boss::engines::LazyTransformation::evaluate(&input));
+    return std::move(result->delegate);
+  };
+  std::atomic<bool> isDone = false;
+  std::thread resetThread([&isDone]() {
+    while (!isDone) {
+      reset();
+    }
+  });
+  int unexpectedResults = 0;
+  for (int i = 0; i < 200; ++i) {
+    evaluateInEngine("AddTransformation"_("Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3))), "As"_("A"_, "A"_))));
+    // The engine may have been reset since the transformation was added
+    auto result = evaluateInEngine("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, i)))));
+    if (result != "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3))), "Where"_("Greater"_("A"_, i))),
+                             "As"_("A"_, "A"_)) &&
+        result != "Error"_("No transformations added")) {
+      unexpectedResults++;
+    }
+  }
+  isDone = true;
+  resetThread.join();
+  reset();
+  CHECK(unexpectedResults == 0);
+}
+
+TEST_CASE("AddColumnRanges works correctly") {
+  std::unordered_map<boss::Symbol, ColumnRange> ranges = {};
+  ComplexExpression condition = "And"_("Greater"_("A"_, 2), "LessEqual"_(10, "A"_), "Between"_("B"_, 1, 5.5));
+  CHECK(addColumnRanges(condition, ranges) == true);
+  CHECK(ranges.size() == 2);
+  CHECK(ranges["A"_].low == 10);
+  CHECK(ranges["A"_].lowInclusive == true);
+  CHECK(ranges["A"_].high == std::numeric_limits<double>::infinity());
+  CHECK(ranges["B"_].low == 1);
+  CHECK(ranges["B"_].high == 5.5);
+  CHECK(rangesOverlap(ranges["A"_], ranges["B"_]) == false);
+
+  // Conditions that are not ranges of a column are not exact
+  std::unordered_map<boss::Symbol, ColumnRange> otherRanges = {};
+  CHECK(addColumnRanges("And"_("Less"_("A"_, 3), "Greater"_("A"_, "B"_)), otherRanges) == false);
+  CHECK(otherRanges["A"_].high == 3);
+}
+
+TEST_CASE("Result cache works correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  engine.evaluate("AddTransformation"_("Project"_(
+      "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)), "Column"_("C"_, "List"_(7, 8, 9))),
+      "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+  CHECK(engine.evaluate("CacheTransformationResult"_(
+            "Between"_("A"_, 1, 5), "Table"_("Column"_("A"_, "List"_(1, 5)), "Column"_("B"_, "List"_(4, 8)),
+                                             "Column"_("C"_, "List"_(7, 11))))) ==
+        "Transformation result cached successfully"_);
+
+  SECTION("Covered rows are read from the cached result") {
+    auto result =
+        engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Between"_("A"_, 2, 3)))));
+    CHECK(result == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 5)), "Column"_("B"_, "List"_(4, 8)),
+                                                  "Column"_("C"_, "List"_(7, 11))),
+                                         "Where"_("Between"_("A"_, 2, 3))),
+                               "As"_("A"_, "A"_)));
+  }
+
+  SECTION("Only the uncovered rows are transformed") {
+    auto result =
+        engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Between"_("A"_, 4, 8)))));
+    CHECK(result ==
+          "Union"_("Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 5)), "Column"_("B"_, "List"_(4, 8)),
+                                                 "Column"_("C"_, "List"_(7, 11))),
+                                        "Where"_("Between"_("A"_, 4, 8))),
+                              "As"_("A"_, "A"_)),
+                   "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                                 "Column"_("C"_, "List"_(7, 8, 9))),
+                                        "Where"_("And"_("Between"_("A"_, 4, 8), "Greater"_("A"_, 5)))),
+                              "As"_("A"_, "A"_))));
+    auto stats = engine.evaluate("GetLazyTransformationEngineResultCacheStats"_());
+    CHECK(get<ComplexExpression>(stats).getDynamicArguments()[0] == "Hits"_(int64_t(1)));
+  }
+
+  SECTION("Results are evicted once the budget is exceeded") {
+    CHECK(engine.evaluate("SetTransformationResultCacheBudget"_(0)) == "Result cache budget set successfully"_);
+    auto result =
+        engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Between"_("A"_, 2, 3)))));
+    CHECK(result == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                                                  "Column"_("C"_, "List"_(7, 8, 9))),
+                                         "Where"_("Between"_("A"_, 2, 3))),
+                               "As"_("A"_, "A"_)));
+    CHECK(engine.evaluate("GetLazyTransformationEngineResultCacheStats"_()) ==
+          "List"_("Hits"_(int64_t(0)), "Misses"_(int64_t(0)), "Entries"_(int64_t(0)), "Bytes"_(int64_t(0)),
+                  "Budget"_(int64_t(0))));
+  }
+
+  SECTION("Results not selected by a single column range are rejected") {
+    CHECK(engine.evaluate("CacheTransformationResult"_("Greater"_("A"_, "B"_), "Table"_())) ==
+          "Error"_("Cached results must be selected by a range of a single column"_));
+  }
+
+  SECTION("Malformed arguments are rejected") {
+    CHECK(engine.evaluate("CacheTransformationResult"_("Greater"_("A"_, 1))) ==
+          "Error"_("Results are cached with a predicate, the result and an optional transformation index"_));
+    CHECK(engine.evaluate("CacheTransformationResult"_("Greater"_("A"_, 1), "Table"_(), "A"_)) ==
+          "Error"_("Results are cached with a predicate, the result and an optional transformation index"_));
+    CHECK(engine.evaluate("CacheMaterialisedTransformation"_("Table"_(), 0.5)) ==
+          "Error"_("Results are cached with the result and an optional transformation index"_));
+    CHECK(engine.evaluate("SetTransformationResultCacheBudget"_()) == "Error"_("Result cache budget must be an int"_));
+    CHECK(engine.evaluate("SetTransformationResultCacheBudget"_(1.5)) == "Error"_("Result cache budget must be an int"_));
+  }
+}
+
+TEST_CASE("EstimateSelectivity works correctly") {
+  ColumnSample sample = {};
+  CHECK(readColumnSample("Table"_("Column"_("A"_, "List"_(1, 2, 3, 4)), "Column"_("B"_, "List"_(5, 6, 7, 8))),
+                         sample) == true);
+  std::vector<ComplexExpression> conditions = {};
+  conditions.emplace_back("Greater"_("A"_, 1));
+  CHECK(estimateSelectivity(conditions, sample) == 0.75);
+  conditions.emplace_back("Less"_("Plus"_("A"_, "B"_), 9));
+  CHECK(estimateSelectivity(conditions, sample) == 0.25);
+  // Without a sample nothing is filtered
+  CHECK(estimateSelectivity(conditions, {}) == 1.0);
+  CHECK(readColumnSample("Table"_("Column"_("A"_)), sample) == false);
+}
+
+TEST_CASE("ApplyTransformation chooses between the lazy rewrite and the cached result") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  auto table = [] {
+    return "Table"_("Column"_("A"_, "List"_(1, 2, 3, 4, 5, 6, 7, 8, 9, 10)));
+  };
+  CHECK(engine.evaluate("AddTransformation"_("Project"_(table(), "As"_("A"_, "A"_)), "Sample"_(table()))) ==
+        "Transformation added successfully"_);
+  CHECK(engine.evaluate("CacheMaterialisedTransformation"_(table())) == "Transformation result cached successfully"_);
+  auto getStrategy = [](Expression&& explained) {
+    auto decision = get<ComplexExpression>(std::move(explained)).getDynamicArguments()[1].clone(
+        boss::expressions::CloneReason::EXPRESSION_WRAPPING);
+    return get<ComplexExpression>(std::move(decision)).getDynamicArguments()[0].clone(
+        boss::expressions::CloneReason::EXPRESSION_WRAPPING);
+  };
+
+  SECTION("Unselective queries read the cached result") {
+    auto result = engine.evaluate(
+        "ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 1))), "Explain"_));
+    CHECK(getStrategy(std::move(result)) == "Strategy"_("Cached"_));
+  }
+
+  SECTION("Selective queries are rewritten lazily") {
+    auto result = engine.evaluate(
+        "ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Equal"_("A"_, 5))), "Explain"_));
+    CHECK(getStrategy(result.clone(boss::expressions::CloneReason::EXPRESSION_WRAPPING)) == "Strategy"_("Lazy"_));
+    CHECK(get<ComplexExpression>(result).getDynamicArguments()[0] ==
+          "Project"_("Select"_(table(), "Where"_("Equal"_("A"_, 5))), "As"_("A"_, "A"_)));
+  }
+}
+
+TEST_CASE("ApplyTransformationBatch works correctly") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  auto table = [] {
+    return "Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6)),
+                    "Column"_("C"_, "List"_(7, 8, 9)));
+  };
+  engine.evaluate("AddTransformation"_("Project"_(table(), "As"_("A"_, "A"_, "B"_, "B"_, "C"_, "C"_))));
+
+  SECTION("Batch results are the same as the ones of single applications") {
+    auto queries = [] {
+      return "List"_("Project"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 2))), "As"_("A"_, "A"_)),
+                     "Select"_("Transformation"_, "Where"_("Less"_("B"_, 5))),
+                     "Project"_("Transformation"_, "As"_("C"_, "C"_)));
+    };
+    auto result = engine.evaluate("ApplyTransformationBatch"_(queries(), 0));
+    auto [unused1, unused2, singleQueries, unused3] = queries().decompose();
+    boss::ExpressionArguments expected = {};
+    for (auto& query : singleQueries) {
+      expected.emplace_back(engine.evaluate("ApplyTransformation"_(std::move(query), 0)));
+    }
+    CHECK(result == boss::ComplexExpression("List"_, {}, std::move(expected), {}));
+    CHECK(result == "List"_("Project"_("Select"_(table(), "Where"_("Greater"_("A"_, 2))), "As"_("A"_, "A"_)),
+                            "Project"_("Select"_(table(), "Where"_("Less"_("B"_, 5))), "As"_("B"_, "B"_)),
+                            "Project"_(table(), "As"_("C"_, "C"_))));
+  }
+
+  CHECK(engine.evaluate("ApplyTransformationBatch"_("Transformation"_)) ==
+        "Error"_("Batches must be a List of queries"_));
+}
+
+TEST_CASE("Hybrid transformations track requested ranges") {
+  auto engine = boss::engines::LazyTransformation::Engine();
+  CHECK(engine.evaluate("AddTransformation"_(
+            "Project"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                       "As"_("A"_, "A"_, "B"_, "B"_)),
+            "Hybrid"_("List"_(), 0.5))) == "Transformation added successfully"_);
+
+  // Queries are still rewritten lazily
+  auto result = engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Greater"_("A"_, 1)))));
+  CHECK(result == "Project"_("Select"_("Table"_("Column"_("A"_, "List"_(1, 2, 3)), "Column"_("B"_, "List"_(4, 5, 6))),
+                                       "Where"_("Greater"_("A"_, 1))),
+                             "As"_("A"_, "A"_)));
+  engine.evaluate("ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Between"_("B"_, 4, 5)))));
+  // Conditions on more than one column are not tracked
+  engine.evaluate("ApplyTransformation"_(
+      "Select"_("Transformation"_, "Where"_("And"_("Greater"_("A"_, 1), "Less"_("B"_, 6))))));
+  CHECK(engine.evaluate("GetLazyTransformationEngineMaterialisationStats"_()) ==
+        "List"_("TrackedRanges"_(int64_t(2)), "MaterialisedRanges"_(int64_t(0)),
+                "MaterialisationNanoseconds"_(int64_t(0))));
+
+  CHECK(engine.evaluate("AddTransformation"_("Table"_(), "Hybrid"_("List"_(), 2))) ==
+        "Error"_("Unknown transformation options"_));
+}
+
 TEST_CASE("Line") {
   auto transform = "AddTransformation"_("GroupBy"_(
       "Select"_("Project"_(
@@ -738,24 +1996,22 @@ TEST_CASE("Line") {
   auto engine = boss::engines::LazyTransformation::Engine();
   engine.evaluate(std::move(transform));
   auto answer1 = engine.evaluate(std::move(apply1));
+  // The group of the query is collapsed into the group of the transformation, as Sum of Sum is a Sum
   CHECK(answer1 ==
         "GroupBy"_(
-            "GroupBy"_(
-                "Select"_(
-                    "Project"_("Project"_("Select"_("LINEITEM"_, "Where"_("And"_("Equal"_("l_linestatus"_, 0),
-                                                                                 "Greater"_(1, "l_partkey"_)))),
-                                          "As"_("l_newcurrencyextendedprice"_, "Times"_("l_extendedprice"_, 1.1), "l_tax"_,
-                                                "l_tax"_, "l_returnflag"_, "l_returnflag"_, "l_linestatus"_, "l_linestatus"_,
-                                                "l_partkey"_, "l_partkey"_)),
-                               "As"_("profit"_,
-                                     "Times"_("l_newcurrencyextendedprice"_, "Minus"_(1, "Plus"_("l_tax"_, "l_discount"_))),
-                                     "l_returnflag"_, "l_returnflag"_, "l_linestatus"_, "l_linestatus"_, "l_partkey"_,
-                                     "l_partkey"_, "l_newcurrencyextendedprice"_, "l_newcurrencyextendedprice"_)),
-                    "Where"_("Equal"_("l_returnflag"_, 1))),
-                "By"_("l_partkey"_, "l_linestatus"_),
-                "As"_("sum_extendedprice"_, "Sum"_("l_newcurrencyextendedprice"_), "sum_profit"_, "Sum"_("profit"_))),
+            "Select"_(
+                "Project"_("Project"_("Select"_("LINEITEM"_, "Where"_("And"_("Equal"_("l_linestatus"_, 0),
+                                                                             "Greater"_(1, "l_partkey"_)))),
+                                      "As"_("l_newcurrencyextendedprice"_, "Times"_("l_extendedprice"_, 1.1), "l_tax"_,
+                                            "l_tax"_, "l_returnflag"_, "l_returnflag"_, "l_linestatus"_, "l_linestatus"_,
+                                            "l_partkey"_, "l_partkey"_)),
+                           "As"_("profit"_,
+                                 "Times"_("l_newcurrencyextendedprice"_, "Minus"_(1, "Plus"_("l_tax"_, "l_discount"_))),
+                                 "l_returnflag"_, "l_returnflag"_, "l_linestatus"_, "l_linestatus"_, "l_partkey"_,
+                                 "l_partkey"_, "l_newcurrencyextendedprice"_, "l_newcurrencyextendedprice"_)),
+                "Where"_("Equal"_("l_returnflag"_, 1))),
             "By"_("l_partkey"_),
-            "As"_("sum_sum_extended_price"_, "Sum"_("sum_extendedprice"_), "sum__sum_profit"_, "Sum"_("sum_profit"_))));
+            "As"_("sum_sum_extended_price"_, "Sum"_("l_newcurrencyextendedprice"_), "sum__sum_profit"_, "Sum"_("profit"_))));
 }
 
 TEST_CASE("Balanced butterfly") {
@@ -778,17 +2034,31 @@ TEST_CASE("Balanced butterfly") {
     auto engine = boss::engines::LazyTransformation::Engine();
     engine.evaluate(std::move(transform));
     auto answer = engine.evaluate(std::move(apply));
-    CHECK(
-        answer ==
-        "Group"_("Group"_("Join"_("Project"_("Select"_("PARTSUPP"_, "Where"_("Greater"_(1, "ps_partkey"_))),
-                                             "As"_("ps_partkey"_, "ps_partkey"_, "ps_suppkey"_, "ps_suppkey"_,
-                                                   "ps_supplycost"_, "ps_supplycost"_)),
-                                  "Project"_("SUPPLIER"_, "As"_("s_suppkey"_, "s_suppkey"_, "s_nationkey"_, "s_nationkey"_)),
-                                  "Where"_("Equal"_("s_suppkey"_, "ps_suppkey"_))),
-                          "By"_("ps_partkey"_, "s_nationkey"_),
-                          "As"_("max_supplycost"_, "Max"_("ps_supplycost"_), "min_supplycost"_, "Min"_("ps_supplycost"_))),
-                 "By"_("ps_partkey"_),
-                 "As"_("max_max_supplycost"_, "Max"_("max_supplycost"_), "min_min_supplycost"_, "Min"_("min_supplycost"_))));
+    CHECK(answer == "Group"_("Join"_("Project"_("Select"_("PARTSUPP"_, "Where"_("Greater"_(1, "ps_partkey"_))),
+                                                "As"_("ps_partkey"_, "ps_partkey"_, "ps_suppkey"_, "ps_suppkey"_,
+                                                      "ps_supplycost"_, "ps_supplycost"_)),
+                                     "Project"_("SUPPLIER"_, "As"_("s_suppkey"_, "s_suppkey"_, "s_nationkey"_, "s_nationkey"_)),
+                                     "Where"_("Equal"_("s_suppkey"_, "ps_suppkey"_))),
+                             "By"_("ps_partkey"_),
+                             "As"_("max_max_supplycost"_, "Max"_("ps_supplycost"_), "min_min_supplycost"_,
+                                   "Min"_("ps_supplycost"_))));
+  }
+
+  SECTION("Predicate on the join key filters both inputs") {
+    auto transform = "AddTransformation"_(
+        "Join"_("Project"_("PARTSUPP"_, "As"_("ps_partkey"_, "ps_partkey"_, "ps_suppkey"_, "ps_suppkey"_)),
+                "Project"_("SUPPLIER"_, "As"_("s_suppkey"_, "s_suppkey"_, "s_nationkey"_, "s_nationkey"_)),
+                "Where"_("Equal"_("s_suppkey"_, "ps_suppkey"_))));
+
+    auto apply = "ApplyTransformation"_("Select"_("Transformation"_, "Where"_("Equal"_("s_suppkey"_, 5))));
+
+    auto engine = boss::engines::LazyTransformation::Engine();
+    engine.evaluate(std::move(transform));
+    auto answer = engine.evaluate(std::move(apply));
+    CHECK(answer ==
+          "Join"_("Project"_("Select"_("PARTSUPP"_, "Where"_("Equal"_("ps_suppkey"_, 5))), "As"_("ps_suppkey"_, "ps_suppkey"_)),
+                  "Project"_("Select"_("SUPPLIER"_, "Where"_("Equal"_("s_suppkey"_, 5))), "As"_("s_suppkey"_, "s_suppkey"_)),
+                  "Where"_("Equal"_("s_suppkey"_, "ps_suppkey"_))));
   }
 }
 